@@ -0,0 +1,63 @@
+#ifndef BENCHSTATS_H
+#define BENCHSTATS_H
+
+#include <string>
+#include <vector>
+
+/*
+ * Collects per-pass GPU times and per-frame times over a headless benchmark
+ * run and reports the mean, median, 95th and 99th percentiles as JSON. The
+ * first frames of a run are a warm-up left out of the stats, so shader
+ * compiles, the first shadow renders and cache misses don't land in the
+ * tail percentiles. The
+ * pass times come from the Profiler's sections of the same names, so the
+ * stats and the trace are timed by the same queries
+ */
+class BenchStats {
+	std::vector<std::string> passes;
+	size_t warmup, warmed;
+	//The samples of each pass then the frame's, in milliseconds
+	std::vector<std::vector<double>> samples;
+
+public:
+	struct Summary {
+		double mean, p50, p95, p99;
+	};
+
+	/*
+	 * Setup stats for the named passes, leaving out the first warmup frames
+	 */
+	BenchStats(const std::vector<std::string> &passes, size_t warmup = 0);
+	const std::vector<std::string>& passNames() const;
+	/*
+	 * Record the frame's time and the GPU time of each pass in milliseconds,
+	 * in the order of the pass names. A pass skipped in a frame (eg. a shadow
+	 * pass with nothing to redraw) should record 0
+	 */
+	void endFrame(double frameMs, const std::vector<double> &passMs);
+	/*
+	 * Check if we're still in the warm-up frames
+	 */
+	bool warmingUp() const;
+	/*
+	 * Get the number of frames recorded, not counting the warm-up
+	 */
+	size_t frames() const;
+	/*
+	 * Write the stats to the file, or stdout if it's empty. width and height
+	 * are recorded with the results, returns false if the file couldn't be
+	 * written
+	 */
+	bool writeJson(const std::string &file, int width, int height) const;
+	/*
+	 * Get the mean and percentiles of some samples, all 0 if there are none
+	 */
+	static Summary summarize(std::vector<double> samples);
+
+private:
+	BenchStats(const BenchStats&);
+	BenchStats& operator=(const BenchStats&);
+};
+
+#endif
+
@@ -0,0 +1,71 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include <vector>
+#include <glm/glm.hpp>
+#include "frustum.h"
+
+/*
+ * A bounding volume hierarchy over the world space boxes of the objects in
+ * the scene, with one object per leaf. Moving objects update their leaf and
+ * refit the boxes above it instead of rebuilding the tree, which is fine
+ * while objects don't move far from where they were when it was built
+ */
+class Bvh {
+	struct Node {
+		glm::vec3 lo, hi;
+		//Children of an interior node, -1 for leaves
+		int left, right;
+		int parent;
+		//The object in a leaf and the number of objects below the node
+		size_t object, count;
+	};
+	std::vector<Node> nodes;
+	//The leaf node holding each object
+	std::vector<int> leaves;
+	//Scratch stacks for traversals
+	mutable std::vector<int> stack, subtree;
+
+public:
+	/*
+	 * Counts from culling against the tree, the number of nodes and leaves
+	 * (objects) whose boxes were tested and the objects culled and drawn.
+	 * Objects in nodes entirely inside or outside the frustum aren't tested
+	 */
+	struct CullStats {
+		size_t nodesTested, objectsTested, culled, drawn;
+	};
+
+	/*
+	 * Build the tree over the object boxes passed, object i has the box
+	 * lo[i], hi[i]
+	 */
+	void build(const std::vector<glm::vec3> &lo, const std::vector<glm::vec3> &hi);
+	/*
+	 * Change the box of an object and refit the nodes above it
+	 */
+	void update(size_t object, const glm::vec3 &lo, const glm::vec3 &hi);
+	/*
+	 * Find the objects whose boxes intersect the frustum, their indices are
+	 * written to visible
+	 */
+	CullStats cull(const Frustum &frustum, std::vector<size_t> &visible) const;
+	/*
+	 * Get the box of an object
+	 */
+	void bounds(size_t object, glm::vec3 &lo, glm::vec3 &hi) const;
+	size_t size() const;
+
+private:
+	/*
+	 * Build the subtree over objects [first, last) of order, returns its node
+	 */
+	int build(std::vector<size_t> &order, size_t first, size_t last, int parent,
+		const std::vector<glm::vec3> &lo, const std::vector<glm::vec3> &hi);
+	/*
+	 * Add all the objects below node to visible
+	 */
+	void addAll(int node, std::vector<size_t> &visible) const;
+};
+
+#endif
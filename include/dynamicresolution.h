@@ -0,0 +1,105 @@
+#ifndef DYNAMICRESOLUTION_H
+#define DYNAMICRESOLUTION_H
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+/*
+ * Scales the resolution the geometry and lighting passes are drawn at to hold
+ * a frame time budget. The render targets are allocated once at the window's
+ * size and the passes draw into the bottom left render rect of them, sized
+ * from the smoothed frame time each frame, so changing the resolution never
+ * reallocates anything. The lighting is drawn into a color target and the
+ * render rect is upscaled to the window at the end of the frame. The lighting
+ * passes sample the G-buffer's depth, so it's never attached to the lighting
+ * target: that would be a feedback loop. Passes that also need to depth and
+ * stencil test, like the light volumes, get a depth-stencil renderbuffer of
+ * their own that the G-buffer's depth is blitted into
+ * Since the frame time includes waiting on vsync the budget should be above
+ * the refresh interval, or vsync turned off
+ */
+class DynamicResolution {
+	//Size of the targets and of the render rect
+	int width, height, renderW, renderH;
+	float scale, minScale;
+	//Frame budget in seconds, 0 to always draw at full resolution
+	float budget;
+	GLuint fbo, colorTex, depthStencil;
+	GLenum depthStencilFormat;
+
+public:
+	//Render rect sizes are kept to multiples of this many pixels so small
+	//changes in frame time don't change the resolution every frame
+	static const int GRANULARITY = 8;
+
+	/*
+	 * Setup the lighting target for a width x height window. If
+	 * depthStencilFormat isn't GL_NONE the target gets a depth-stencil
+	 * renderbuffer of that format, which must be the G-buffer's for its depth
+	 * to be blitted in. budgetMs is the frame time to hold, 0 to turn scaling
+	 * off, and the render rect is never scaled below minScale of the window
+	 * on each side
+	 */
+	DynamicResolution(int width, int height, GLenum depthStencilFormat, float budgetMs,
+		float minScale = 0.5f);
+	~DynamicResolution();
+	/*
+	 * Check the lighting target is complete
+	 */
+	bool ready() const;
+	/*
+	 * Reallocate the lighting target for a width x height window
+	 */
+	void resize(int width, int height);
+	/*
+	 * Move the resolution towards what should fit the budget given the
+	 * smoothed frame time in seconds, returns true if the render rect changed
+	 */
+	bool update(float frameTime);
+	int renderWidth() const;
+	int renderHeight() const;
+	float renderScale() const;
+	/*
+	 * Get the matrix taking clip space of the render rect to clip space of
+	 * the full targets, for things that work in the targets' pixels like the
+	 * light tiles and the occlusion depth
+	 */
+	glm::mat4 targetProjection() const;
+	/*
+	 * Get the fraction of the targets the render rect covers in xy and its
+	 * size in pixels in zw, see the Frame block's render_scale
+	 */
+	glm::vec4 frameScale() const;
+	/*
+	 * Set the viewport to the render rect
+	 */
+	void viewport() const;
+	/*
+	 * Bind and clear the lighting target and set the viewport to the render
+	 * rect. If depthFbo is passed its depth over the render rect is blitted
+	 * into the target's depth-stencil for the passes to test against, the
+	 * stencil is left for them to clear
+	 */
+	void begin(GLuint depthFbo = 0) const;
+	/*
+	 * Upscale the render rect of the lighting to the default framebuffer,
+	 * which is left bound with the viewport covering the window
+	 */
+	void resolve() const;
+
+private:
+	/*
+	 * Allocate the lighting target at the current size
+	 */
+	void allocate();
+	/*
+	 * Size the render rect from the scale
+	 */
+	void fitRect();
+
+	DynamicResolution(const DynamicResolution&);
+	DynamicResolution& operator=(const DynamicResolution&);
+};
+
+#endif
+
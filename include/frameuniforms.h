@@ -0,0 +1,56 @@
+#ifndef FRAMEUNIFORMS_H
+#define FRAMEUNIFORMS_H
+
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+/*
+ * The camera and light data shared by all the programs each frame, kept in
+ * a std140 uniform buffer bound to the Frame uniform block so it's uploaded
+ * once per frame no matter how many programs or models use it. The block is
+ * declared the same way in each shader using it:
+ *
+ * layout(std140) uniform Frame {
+ *     mat4 proj, view, inv_proj, inv_view;
+ *     vec4 light_dir, view_pos, render_scale;
+ * };
+ *
+ * render_scale is the fraction of the render targets drawn to in xy and the
+ * size in pixels of the rect drawn to in zw, see DynamicResolution
+ */
+class FrameUniforms {
+	GLuint ubo;
+
+public:
+	//The uniform buffer binding point the Frame block is read from
+	static const GLuint BINDING = 0;
+	/*
+	 * The contents of the Frame block, with only mat4s and vec4s the std140
+	 * layout has no padding so it matches the C++ layout
+	 */
+	struct Data {
+		glm::mat4 proj, view, invProj, invView;
+		glm::vec4 lightDir, viewPos, renderScale;
+	};
+
+	/*
+	 * Create the uniform buffer and bind it to BINDING
+	 */
+	FrameUniforms();
+	~FrameUniforms();
+	/*
+	 * Upload this frame's data, the buffer is orphaned first so we don't stall
+	 * waiting on draws from last frame that are still reading it
+	 */
+	void update(const Data &data);
+	/*
+	 * Point the program's Frame block, if it has one, at BINDING
+	 */
+	static void bindBlock(GLuint program);
+
+private:
+	FrameUniforms(const FrameUniforms&);
+	FrameUniforms& operator=(const FrameUniforms&);
+};
+
+#endif
@@ -0,0 +1,29 @@
+#ifndef FRUSTUM_H
+#define FRUSTUM_H
+
+#include <glm/glm.hpp>
+
+/*
+ * A view frustum as 6 planes pointing inwards, extracted from a view-projection
+ * matrix (Gribb & Hartmann) so it works for both the camera's perspective and
+ * the light's orthographic projection
+ */
+struct Frustum {
+	enum Result { OUTSIDE, INTERSECTS, INSIDE };
+	//The planes as (normal, distance), a point p is inside if dot(n, p) + d >= 0
+	glm::vec4 planes[6];
+
+	Frustum(const glm::mat4 &viewProj);
+	/*
+	 * Test an axis aligned box against the frustum
+	 */
+	Result test(const glm::vec3 &lo, const glm::vec3 &hi) const;
+};
+/*
+ * Compute the world space axis aligned box of a box in object space transformed
+ * by the matrix, this is the tight box around the transformed box (Arvo 1990)
+ */
+void transformBounds(const glm::mat4 &m, const glm::vec3 &lo, const glm::vec3 &hi,
+	glm::vec3 &outLo, glm::vec3 &outHi);
+
+#endif
@@ -0,0 +1,91 @@
+#ifndef GBUFFER_H
+#define GBUFFER_H
+
+#include <string>
+#include <GL/glew.h>
+
+/*
+ * The render targets the geometry pass fills for the deferred pass: diffuse
+ * on texture unit 0, normals on unit 1 and depth-stencil on unit 2. The
+ * normals and depth can be stored a few ways to trade precision for the
+ * bandwidth of writing and reading the G-buffer back:
+ * NORMALS_RGB8: diffuse RGB8 and normals as (n + 1) / 2 in RGB8
+ * NORMALS_OCT16, NORMALS_OCT8: diffuse RGBA8 and normals octahedral encoded
+ * in RG16 or RG8. The material, specular strength and shininess 4 bits each,
+ * is packed into the diffuse alpha
+ * Depth is either 24bit or 32bit float, with an 8bit stencil either way for
+ * the light volumes. The programs writing and reading the G-buffer are built
+ * with defines() to pick the matching encoding
+ */
+class GBuffer {
+public:
+	enum Normals { NORMALS_RGB8, NORMALS_OCT16, NORMALS_OCT8 };
+	enum Depth { DEPTH_24, DEPTH_32F };
+	enum Target { DIFFUSE, NORMAL, DEPTH_STENCIL, TARGET_COUNT };
+
+private:
+	int width, height;
+	Normals normals;
+	Depth depth;
+	GLuint fbo;
+	GLuint textures[TARGET_COUNT];
+
+public:
+	/*
+	 * Setup the targets for a width x height screen, the textures are left
+	 * bound to texture units 0-2
+	 */
+	GBuffer(int width, int height, Normals normals, Depth depth);
+	~GBuffer();
+	/*
+	 * Check the framebuffer is complete
+	 */
+	bool ready() const;
+	/*
+	 * Reallocate the targets for a width x height screen, the textures and
+	 * framebuffer keep their names so anything attaching or sampling them
+	 * doesn't need updating
+	 */
+	void resize(int width, int height);
+	GLuint framebuffer() const;
+	GLuint texture(Target target) const;
+	/*
+	 * Get the internal format of the depth-stencil texture, for targets the
+	 * depth is blitted into
+	 */
+	GLenum depthStencilFormat() const;
+	/*
+	 * Get the defines to build programs writing or reading this layout with,
+	 * OCT_NORMALS and PACKED_MATERIAL for the octahedral layouts
+	 */
+	std::string defines() const;
+	/*
+	 * Get the bytes each pixel of a target takes in memory, RGB8 and the
+	 * depth formats are counted padded out the way drivers store them
+	 */
+	size_t bytesPerPixel(Target target) const;
+	size_t bytesPerPixel() const;
+	/*
+	 * Print the layout, its bytes per pixel and an estimate of the bandwidth
+	 * spent writing it in the geometry pass and reading it back in the
+	 * deferred pass each frame, and how it compares to the original layout
+	 */
+	void printStats() const;
+	/*
+	 * Parse a normals layout name, rgb8, oct16 or oct8, returns false if the
+	 * name is unknown
+	 */
+	static bool parseNormals(const std::string &name, Normals &normals);
+
+private:
+	/*
+	 * Allocate the targets' storage at the current size
+	 */
+	void allocate();
+
+	GBuffer(const GBuffer&);
+	GBuffer& operator=(const GBuffer&);
+};
+
+#endif
+
@@ -0,0 +1,161 @@
+#ifndef GEOMETRYARENA_H
+#define GEOMETRYARENA_H
+
+#include <vector>
+#include <GL/glew.h>
+#include "mesh.h"
+
+/*
+ * First fit allocator over a range of [0, capacity) elements, the free
+ * ranges are kept sorted and merged with their neighbours when released
+ */
+class FreeList {
+	struct Range {
+		size_t offset, size;
+	};
+	std::vector<Range> ranges;
+	size_t capacity;
+
+public:
+	FreeList();
+	/*
+	 * Allocate size elements, returns false if no free range fits them
+	 */
+	bool allocate(size_t size, size_t &offset);
+	void release(size_t offset, size_t size);
+	/*
+	 * Make the first used elements taken and the rest up to capacity free,
+	 * for after the allocations have been packed to the front
+	 */
+	void reset(size_t used, size_t capacity);
+	size_t size() const;
+	size_t freeElements() const;
+	/*
+	 * Number of separate free ranges
+	 */
+	size_t fragments() const;
+};
+
+/*
+ * Shared vertex and index buffers that many meshes of one vertex layout and
+ * index type are suballocated from, drawn through one VAO so switching
+ * between them costs no VAO bind and draws can be merged into one
+ * glMultiDrawElementsBaseVertex. Each mesh's block is a range of vertices
+ * and a range of indices, drawn by adding the block's base vertex and index
+ * offset to the mesh's own. When an allocation doesn't fit in any free range
+ * the blocks are packed together to the front of the buffers, growing them
+ * first if there isn't enough free space in total, so the blocks' offsets
+ * must be read each time they're drawn. The buffers keep their names when
+ * repacked, so VAOs pointed at them stay valid
+ */
+class GeometryArena {
+public:
+	typedef size_t Handle;
+	static const Handle INVALID = ~static_cast<size_t>(0);
+	//Capacity of the buffers when first allocated from
+	static const size_t INITIAL_VERTICES = 1 << 16;
+	static const size_t INITIAL_INDICES = 1 << 18;
+	//Free ranges the buffers can split into before geometry::defragment packs them
+	static const size_t MAX_FRAGMENTS = 16;
+
+	struct Stats {
+		size_t vertexCapacity, verticesUsed, indexCapacity, indicesUsed;
+		size_t blocks, fragments, repacks;
+	};
+
+private:
+	struct Block {
+		size_t vertexStart, vertexCount, indexStart, indexCount;
+		bool live;
+	};
+	VertexLayout layout;
+	GLenum type;
+	size_t stride, indexSize;
+	GLuint vao, vbo, ebo;
+	FreeList vertexFree, indexFree;
+	std::vector<Block> blocks;
+	std::vector<Handle> freeHandles;
+	size_t repacks;
+
+public:
+	/*
+	 * Setup an empty arena for meshes with the vertex layout and index type,
+	 * GL_UNSIGNED_SHORT or GL_UNSIGNED_INT
+	 */
+	GeometryArena(VertexLayout layout, GLenum indexType);
+	~GeometryArena();
+	/*
+	 * Copy vertexCount vertices and indexCount indices into a new block,
+	 * returns INVALID if the data was empty
+	 */
+	Handle allocate(const void *vertices, size_t vertexCount, const void *indices,
+		size_t indexCount);
+	void release(Handle block);
+	/*
+	 * Get the vertex the block's vertices start at and the byte offset its
+	 * indices start at, to add to its draws' base vertices and offsets
+	 */
+	GLint baseVertex(Handle block) const;
+	size_t indexOffset(Handle block) const;
+	VertexLayout vertexLayout() const;
+	GLenum indexType() const;
+	/*
+	 * Get the VAO reading the arena's buffers in its layout
+	 */
+	GLuint vertexArray() const;
+	/*
+	 * Point the bound VAO's attributes 0-2 and element buffer at the arena's
+	 * buffers, for VAOs with attributes of their own like InstancedModel's
+	 */
+	void setupVertexArray() const;
+	/*
+	 * Pack the blocks together to the front of the buffers if the free space
+	 * has split into more than maxFragments ranges, returns true if it did
+	 */
+	bool defragment(size_t maxFragments = 1);
+	/*
+	 * Delete the buffers and VAO, releasing blocks afterwards is still fine
+	 */
+	void destroy();
+	Stats stats() const;
+
+private:
+	/*
+	 * Pack the blocks to the front of new storage for the buffers with the
+	 * capacities passed, which must fit them
+	 */
+	void repack(size_t vertexCapacity, size_t indexCapacity);
+
+	GeometryArena(const GeometryArena&);
+	GeometryArena& operator=(const GeometryArena&);
+};
+
+/*
+ * The arenas all meshes are loaded into, one per vertex layout and index type
+ */
+namespace geometry {
+	/*
+	 * Get the arena for meshes with the layout and index type, making it if
+	 * it's the first. Needs a current GL context
+	 */
+	GeometryArena& arena(VertexLayout layout, GLenum indexType);
+	/*
+	 * Pack the blocks of the arenas whose free space has split into more than
+	 * MAX_FRAGMENTS ranges as meshes were released, so later meshes fit
+	 * without growing the buffers. Called between frames, it's cheap when
+	 * nothing was released
+	 */
+	void defragment();
+	/*
+	 * Print each arena's usage
+	 */
+	void printStats();
+	/*
+	 * Free the arenas' GL objects, models released later just update the
+	 * free lists
+	 */
+	void shutdown();
+}
+
+#endif
+
@@ -0,0 +1,57 @@
+#ifndef GLCHECK_H
+#define GLCHECK_H
+
+#include <string>
+#include <GL/glew.h>
+
+/*
+ * How much we pay to catch OpenGL errors. glGetError makes many drivers wait
+ * for the GPU, so the frame's checks only poll it as often as the mode asks:
+ * OFF: never poll and turn debug output off
+ * SAMPLED: poll on one frame in every interval, debug messages are reported
+ * asynchronously as the driver finds them
+ * SYNC: poll at every check and make debug output synchronous, so messages
+ * are reported from inside the call causing them, for debugging
+ * Debug messages go to util::glDebugCallback and the errors seen through
+ * either route are counted. Debug output needs GL_KHR_debug, or
+ * GL_ARB_debug_output and a debug context, otherwise only the polling is done
+ */
+namespace glcheck {
+	enum Mode { OFF, SAMPLED, SYNC };
+	struct Stats {
+		//Checks that polled glGetError and the errors they found
+		size_t polls, errors;
+		//Messages from debug output and how many of them were errors
+		size_t debugMessages, debugErrors;
+	};
+	/*
+	 * Install the debug callback if debug output is supported and set the
+	 * mode, polling once every interval frames when sampling. Needs a current
+	 * GL context
+	 */
+	void init(Mode mode, unsigned interval);
+	/*
+	 * Switch modes at runtime
+	 */
+	void setMode(Mode mode);
+	Mode mode();
+	/*
+	 * Poll glGetError if the mode says this frame should be checked and log
+	 * the errors found along with msg, returns true if there were any
+	 */
+	bool check(const std::string &msg);
+	/*
+	 * Move on to the next frame for sampling
+	 */
+	void endFrame();
+	Stats stats();
+	/*
+	 * Parse a mode name, off, sampled or sync, returns false if the name is
+	 * unknown
+	 */
+	bool parseMode(const std::string &name, Mode &mode);
+	const char* modeName(Mode mode);
+}
+
+#endif
+
@@ -0,0 +1,152 @@
+#ifndef HIZ_H
+#define HIZ_H
+
+#include <vector>
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include "bvh.h"
+
+/*
+ * Hierarchical-Z occlusion culling from the depth buffer of earlier frames.
+ * After the geometry pass the depth buffer is reduced on the GPU to a 1/4 by 1/4
+ * size texture keeping the farthest depth of each block, which is read back
+ * through a ring of pixel buffers so we never wait on the GPU. Once a readback
+ * has landed the CPU builds a max depth pyramid from it and boxes can be
+ * tested against the pyramid, projected with the view-projection matrix the
+ * depth was drawn with. The depth is a few frames old so the test is kept
+ * conservative: boxes crossing the near plane or reaching outside the screen
+ * the depth covered are never culled, objects that moved have their old
+ * rect dropped from the depth so nothing they hid is culled, and whatever
+ * was culled is tested again against the current frame's depth with
+ * occlusion queries and drawn if it shows, since the camera may have moved
+ * enough to reveal it
+ */
+class HiZ {
+	//Number of readbacks that can be in flight
+	static const int RING_SIZE = 3;
+	//Size of the depth buffer and of the reduced base level
+	int width, height, baseWidth, baseHeight;
+	GLuint fbo, tex, vao, program, boxProgram;
+	GLint boxLoUnif, boxHiUnif;
+	//A query for each object culled this frame
+	std::vector<GLuint> queries;
+	GLuint pbos[RING_SIZE];
+	GLsync fences[RING_SIZE];
+	//The view-projection matrix, generation and capture number each readback
+	//was captured with
+	glm::mat4 viewProjs[RING_SIZE];
+	unsigned generations[RING_SIZE], captureIds[RING_SIZE];
+	//Next slot to capture into and the oldest one in flight
+	int next, pending;
+	unsigned generation, captures;
+	/*
+	 * The box an object moved away from and the number of captures made
+	 * before it moved, so the captures still showing it there
+	 */
+	struct Stale {
+		unsigned captures;
+		glm::vec3 lo, hi;
+	};
+	std::vector<Stale> stale;
+	//The pyramid, level 0 is the read back base level
+	std::vector<std::vector<float>> levels;
+	std::vector<int> levelWidths, levelHeights;
+	glm::mat4 viewProj;
+	bool valid;
+
+public:
+	struct Stats {
+		size_t tested, occluded;
+	};
+
+	/*
+	 * Setup culling against a depth buffer of width x height
+	 */
+	HiZ(int width, int height);
+	~HiZ();
+	/*
+	 * Check that the reduction program loaded and the framebuffer is complete
+	 */
+	bool ready() const;
+	/*
+	 * Reallocate for a depth buffer of width x height, dropping the pyramid
+	 * and any readbacks in flight
+	 */
+	void resize(int width, int height);
+	/*
+	 * Reduce the depth texture drawn with viewProj and start reading it back.
+	 * Changes the framebuffer, the viewport is put back after. If all the
+	 * slots are in flight the capture is skipped
+	 */
+	void capture(GLuint depthTex, const glm::mat4 &viewProj);
+	/*
+	 * Take the oldest readback if the GPU has finished it and rebuild the
+	 * pyramid from it, returns true if the pyramid was rebuilt
+	 */
+	bool update();
+	/*
+	 * Drop the pyramid and the readbacks in flight, the depth no longer matches
+	 * the scene. Culling resumes once a capture made after this lands
+	 */
+	void invalidate();
+	/*
+	 * Tell us an object moved away from the world space box, the box's rect
+	 * is dropped from the pyramid and from the readbacks in flight when they
+	 * land, so nothing it was hiding gets culled
+	 */
+	void moved(const glm::vec3 &lo, const glm::vec3 &hi);
+	/*
+	 * Check if we've got a pyramid to test against
+	 */
+	bool active() const;
+	/*
+	 * Test if the world space box is hidden behind the depth in the pyramid,
+	 * returns false if we can't be sure
+	 */
+	bool occluded(const glm::vec3 &lo, const glm::vec3 &hi) const;
+	/*
+	 * Move the objects whose boxes in the BVH are occluded from visible to
+	 * hidden. Objects flagged in moving are never tested, the depth we have
+	 * doesn't show them where they are now
+	 */
+	Stats cull(const Bvh &bvh, const std::vector<char> &moving, std::vector<size_t> &visible,
+		std::vector<size_t> &hidden) const;
+	/*
+	 * Draw the boxes of the occluded objects against the bound depth buffer with
+	 * an occlusion query each, once the visible objects have been drawn to it.
+	 * Leaves the program and VAO changed
+	 */
+	void testOccluded(const Bvh &bvh, const std::vector<size_t> &occluded);
+	/*
+	 * Draws made between beginRevealed and endRevealed are only made if the box
+	 * of occluded[i] passed the depth test in testOccluded
+	 */
+	void beginRevealed(size_t i) const;
+	void endRevealed() const;
+
+private:
+	/*
+	 * Allocate the reduced texture, pixel buffers and pyramid for the
+	 * current size
+	 */
+	void allocate();
+	void buildPyramid();
+	/*
+	 * Project the world space box to its rect of base level texels and its
+	 * nearest depth as it would have been drawn when the depth was captured,
+	 * clamped to the screen. Returns false if it crosses the near plane,
+	 * onScreen is set if none of it was clamped
+	 */
+	bool project(const glm::vec3 &lo, const glm::vec3 &hi, int &x0, int &y0, int &x1, int &y1,
+		float &nearest, bool &onScreen) const;
+	/*
+	 * Set the box's rect in every level of the pyramid to the far plane
+	 */
+	void clearRect(const glm::vec3 &lo, const glm::vec3 &hi);
+
+	HiZ(const HiZ&);
+	HiZ& operator=(const HiZ&);
+};
+
+#endif
+
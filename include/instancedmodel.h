@@ -0,0 +1,75 @@
+#ifndef INSTANCEDMODEL_H
+#define INSTANCEDMODEL_H
+
+#include <string>
+#include <vector>
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include "model.h"
+
+/*
+ * A model drawn many times with a single instanced draw call per sub-mesh.
+ * The instances' model matrices are kept in a per-instance VBO read as a
+ * mat4 attribute at locations 3-6, so the programs should be built with
+ * INSTANCED defined which swaps the model uniform for that attribute
+ * The model's own translate/rotate/scale aren't used, each instance has
+ * its own transform
+ */
+class InstancedModel : public Model {
+	GLuint instanceBuf;
+	std::vector<glm::mat4> instances;
+	//If the instances changed since they were last uploaded
+	bool dirty;
+
+public:
+	//Location of the first column of the instance matrix attribute
+	static const GLuint INSTANCE_ATTRIB = 3;
+
+	/*
+	 * Load the model with no instances, see Model::Model
+	 */
+	InstancedModel(const std::string &file, GLuint program, GLuint shadowProgram = 0,
+		unsigned meshFlags = 0);
+	~InstancedModel();
+	/*
+	 * Add an instance with the model matrix passed, returns its index
+	 */
+	size_t addInstance(const glm::mat4 &transform);
+	/*
+	 * Change the model matrix of an instance
+	 */
+	void setInstance(size_t i, const glm::mat4 &transform);
+	/*
+	 * Remove all the instances
+	 */
+	void clearInstances();
+	size_t instanceCount() const;
+	/*
+	 * Bind the model for rendering, uploading the instances if they've changed
+	 */
+	void bind() override;
+	void bindShadow() override;
+	void bindCached(StateCache &cache, bool shadow) override;
+	/*
+	 * Pick the levels of detail for all instances, from the instance that
+	 * needs the most detail
+	 */
+	void selectLod(const glm::vec3 &viewPos, float pixelsPerUnit, float maxError,
+		size_t shadowBias) override;
+	/*
+	 * Get the box around all the instances, or an empty box at the origin
+	 * if there are none
+	 */
+	void worldBounds(glm::vec3 &lo, glm::vec3 &hi) override;
+
+protected:
+	void drawLod(size_t level) override;
+
+private:
+	/*
+	 * Send the instance matrices to the instance VBO if they've changed
+	 */
+	void upload();
+};
+
+#endif
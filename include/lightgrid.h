@@ -0,0 +1,97 @@
+#ifndef LIGHTGRID_H
+#define LIGHTGRID_H
+
+#include <vector>
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include "parallel.h"
+
+/*
+ * A point or spot light shading the scene in the deferred pass, lighting
+ * falls off to nothing at radius. Spot lights fade out between the cosines
+ * of their inner and outer cone angles about dir
+ */
+struct Light {
+	enum Type { POINT, SPOT };
+	Type type;
+	glm::vec3 pos, color, dir;
+	float radius, cosInner, cosOuter;
+};
+/*
+ * Bins the lights into TILE_SIZE x TILE_SIZE pixel screen tiles each frame
+ * so the deferred pass only shades each pixel with the lights that can reach
+ * its tile. The light data, the (offset, count) of each tile's lights and the
+ * list of light indices are sent to buffer textures read by fsecondpass:
+ * lights: 3 RGBA32F texels per light, (pos, radius), (color, cos inner) and
+ * (dir, cos outer), point lights have a cos outer of -1
+ * light_tiles: an RG32UI texel per tile, row major from the bottom left
+ * light_indices: R16UI light indices, each tile's run starting at its offset
+ * Binning is spread over a pool of worker threads kept for the grid's lifetime
+ */
+class LightGrid {
+	int width, height, tilesX, tilesY;
+	GLuint buffers[3], textures[3];
+	//The screen rect of tiles each light covers, empty if x0 > x1
+	struct Rect {
+		int x0, y0, x1, y1;
+	};
+	std::vector<Rect> rects;
+	std::vector<GLfloat> lightData;
+	std::vector<GLuint> tileData;
+	//The light indices binned by each thread, in tile order
+	std::vector<std::vector<GLushort>> threadIndices;
+	std::vector<GLushort> indices;
+	//Kept across frames so binning doesn't start threads every frame
+	parallel::Pool pool;
+
+public:
+	static const int TILE_SIZE = 16;
+	//Texture units the light data, tiles and light indices are bound to
+	static const int LIGHTS_UNIT = 7, TILES_UNIT = 8, INDICES_UNIT = 9;
+	//Light indices are 16bit
+	static const size_t MAX_LIGHTS = 65535;
+	//Below this many lights binning isn't worth spreading over threads
+	static const size_t MIN_PARALLEL_LIGHTS = 64;
+
+	struct Stats {
+		//Lights on screen and the total light indices over all tiles
+		size_t visible, indices;
+		//CPU time spent binning and uploading in milliseconds
+		double ms;
+	};
+
+	/*
+	 * Setup tiles covering a width x height screen and the buffer textures
+	 */
+	LightGrid(int width, int height);
+	~LightGrid();
+	/*
+	 * Re-tile for a width x height screen, the programs' tiles per row must
+	 * be updated with setupProgram after
+	 */
+	void resize(int width, int height);
+	/*
+	 * Bin the lights for the camera and upload the lists, lights past
+	 * MAX_LIGHTS are ignored
+	 */
+	Stats update(const std::vector<Light> &lights, const glm::mat4 &view,
+		const glm::mat4 &proj);
+	/*
+	 * Point the program's light samplers at the units the buffer textures
+	 * are bound to and tell it how many tiles there are per row
+	 */
+	void setupProgram(GLuint program) const;
+
+private:
+	/*
+	 * Compute the rect of tiles the light's sphere covers on screen
+	 */
+	Rect screenRect(const Light &light, const glm::mat4 &view, const glm::mat4 &proj,
+		float nearPlane) const;
+
+	LightGrid(const LightGrid&);
+	LightGrid& operator=(const LightGrid&);
+};
+
+#endif
+
@@ -0,0 +1,54 @@
+#ifndef LIGHTVOLUMES_H
+#define LIGHTVOLUMES_H
+
+#include <string>
+#include <vector>
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include "lightgrid.h"
+#include "model.h"
+
+/*
+ * Shades the point and spot lights by drawing a sphere or cone around each
+ * light, as an alternative to looping over the tile lists in the full-screen
+ * pass. Each light first marks the pixels whose G-buffer surface is inside
+ * its volume in the stencil buffer (the back faces behind the surface count
+ * up, the front faces behind it count down) and then its volume is drawn with
+ * additive blending shading only the marked pixels. The lighting is added to
+ * the bound framebuffer, which needs a depth-stencil holding a copy of the
+ * G-buffer's depth, see DynamicResolution::begin. The light data is read from LightGrid's lights buffer texture
+ */
+class LightVolumes {
+	enum { POINT_VOLUME, SPOT_VOLUME, VOLUME_COUNT };
+	//The sphere and cone, drawn with the shading program and with the
+	//stencil marking program as their "shadow" program
+	Model *volumes[VOLUME_COUNT];
+	GLint indexUnifs[VOLUME_COUNT], stencilIndexUnifs[VOLUME_COUNT];
+	bool loaded;
+
+public:
+	/*
+	 * Load the volumes, the programs are setup to read the G-buffer from
+	 * texture units 0-2 and built with gbufferDefines to decode its layout,
+	 * see GBuffer::defines
+	 */
+	LightVolumes(const LightGrid &grid, const std::string &gbufferDefines);
+	~LightVolumes();
+	/*
+	 * Check that the volumes and their programs loaded
+	 */
+	bool ready() const;
+	/*
+	 * Add the light of each light in the list to the bound framebuffer by
+	 * drawing its volume. Lights outside the camera's viewProj frustum are
+	 * skipped, returns the number of lights drawn
+	 */
+	size_t render(const std::vector<Light> &lights, const glm::mat4 &viewProj);
+
+private:
+	LightVolumes(const LightVolumes&);
+	LightVolumes& operator=(const LightVolumes&);
+};
+
+#endif
+
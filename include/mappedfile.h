@@ -0,0 +1,58 @@
+#ifndef MAPPEDFILE_H
+#define MAPPEDFILE_H
+
+#include <string>
+
+/*
+ * A read-only memory mapping of a file, the mapping is released
+ * when the object is destroyed. Empty files are treated as opened
+ * successfully but with a null data pointer
+ */
+class MappedFile {
+	const char *ptr;
+	size_t len;
+	bool mapped;
+#ifdef _WIN32
+	//The file and mapping HANDLEs, kept as void* to avoid pulling in windows.h
+	void *file, *mapping;
+#else
+	int fd;
+#endif
+
+public:
+	MappedFile();
+	/*
+	 * Map the file passed, check isOpen to see if the mapping succeeded
+	 */
+	MappedFile(const std::string &fName);
+	/*
+	 * Unmap the file if it's mapped
+	 */
+	~MappedFile();
+	/*
+	 * Map a file, if a file is already mapped it will be closed first
+	 * returns true on success, false on failure
+	 */
+	bool open(const std::string &fName);
+	/*
+	 * Unmap the file and close it
+	 */
+	void close();
+	/*
+	 * Check if a file is currently mapped
+	 */
+	bool isOpen() const;
+	/*
+	 * Get the mapped data and its size in bytes
+	 */
+	const char* data() const;
+	size_t size() const;
+
+private:
+	//Mappings aren't copyable
+	MappedFile(const MappedFile&);
+	MappedFile& operator=(const MappedFile&);
+};
+
+#endif
+
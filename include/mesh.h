@@ -0,0 +1,146 @@
+#ifndef MESH_H
+#define MESH_H
+
+#include <vector>
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+/*
+ * Flags controlling how a mesh is prepared for upload
+ */
+enum MeshFlag {
+	//Split meshes with too many vertices for 16bit indices into 16bit
+	//sub-meshes instead of switching the whole mesh to 32bit indices
+	MESH_SPLIT_16BIT = 1,
+	//Always use the VERTEX_FLOAT layout instead of choosing a packed one
+	MESH_FLOAT_VERTICES = 2,
+	//Skip the vertex cache, overdraw and vertex fetch optimizations
+	MESH_NO_OPTIMIZE = 4,
+	//Don't build the simplified levels of detail
+	MESH_NO_LOD = 8
+};
+/*
+ * The layouts vertices can be uploaded in, Model picks the most compact one
+ * that represents a mesh accurately enough
+ */
+enum VertexLayout {
+	//vec3 pos, vec3 normal, vec3 uv all as floats, 36 bytes
+	VERTEX_FLOAT = 0,
+	//float vec3 pos, GL_INT_2_10_10_10_REV normal, half float uv, 20 bytes
+	VERTEX_PACKED_FLOAT_POS = 1,
+	//half float pos padded to 4, GL_INT_2_10_10_10_REV normal, half float uv, 16 bytes
+	VERTEX_PACKED_HALF_POS = 2
+};
+/*
+ * A single vertex as it's loaded and stored in the VERTEX_FLOAT layout:
+ * vec3 pos, vec3 normal, vec3 uv with the uv padded out to a vec3
+ */
+struct Vertex {
+	glm::vec3 pos, normal, uv;
+};
+/*
+ * A level of detail of a mesh. In a Mesh first and count are the range of
+ * indices making up the level, once uploaded they're the range of sub-meshes
+ * drawn for it. error is how far the level's surface may be from the full
+ * detail mesh in object space, 0 for the full detail level
+ * Fixed size types are used since these are also written to the mesh cache
+ */
+struct Lod {
+	GLuint first, count;
+	GLfloat error;
+};
+/*
+ * CPU side mesh data produced by the OBJ loader before being sent to the GPU
+ * indices are always kept as 32bit here regardless of how they're uploaded
+ * The levels of detail all share the vertices and are stored one after another
+ * in the indices, if lods is empty all the indices are a single level
+ */
+struct Mesh {
+	std::vector<Vertex> vertices;
+	std::vector<GLuint> indices;
+	std::vector<Lod> lods;
+};
+/*
+ * Vertices as stored in the packed layouts
+ */
+struct PackedVertexFloatPos {
+	GLfloat pos[3];
+	GLuint normal;
+	GLhalf uv[2];
+};
+struct PackedVertexHalfPos {
+	GLhalf pos[4];
+	GLuint normal;
+	GLhalf uv[2];
+};
+/*
+ * A range of the element buffer that's drawn with a single draw call, the
+ * offset of the first index is in bytes and baseVertex is added to each index
+ * Fixed size types are used since these are also written to the mesh cache
+ */
+struct SubMesh {
+	GLuint count;
+	GLint baseVertex;
+	GLuint64 offset;
+};
+/*
+ * Split the triangles in indices into chunks that each reference at most
+ * 65536 vertices so they can be drawn with 16bit indices. The vertices used
+ * by each chunk are appended to outVerts, the chunk relative indices to
+ * outIndices and a SubMesh describing each chunk to subMeshes
+ */
+void splitMesh(const std::vector<Vertex> &vertices, const std::vector<GLuint> &indices,
+	std::vector<Vertex> &outVerts, std::vector<GLushort> &outIndices,
+	std::vector<SubMesh> &subMeshes);
+/*
+ * Get the size in bytes of a vertex in some layout
+ */
+size_t vertexStride(VertexLayout layout);
+/*
+ * Compute the bounding box of the vertices' positions
+ */
+void computeBounds(const std::vector<Vertex> &vertices, glm::vec3 &lo, glm::vec3 &hi);
+/*
+ * Choose the most compact layout that can represent the vertices accurately
+ * Half float positions are used if the rounding error is small relative to the
+ * mesh's size and half float uvs if they're accurate to about a texel of a
+ * 1024x1024 texture, otherwise we fall back to VERTEX_FLOAT
+ */
+VertexLayout chooseLayout(const std::vector<Vertex> &vertices);
+/*
+ * Encode the vertices in the layout passed, out is resized to fit them
+ */
+void packVertices(const std::vector<Vertex> &vertices, VertexLayout layout,
+	std::vector<char> &out);
+/*
+ * Convert between floats and half floats, rounding to nearest
+ */
+GLhalf packHalf(float f);
+float unpackHalf(GLhalf h);
+/*
+ * Pack a normal into the signed normalized GL_INT_2_10_10_10_REV format
+ */
+GLuint packNormal(const glm::vec3 &n);
+/*
+ * Info about a mesh that's been uploaded to the GPU
+ */
+struct MeshInfo {
+	VertexLayout layout;
+	GLenum indexType;
+	std::vector<SubMesh> subMeshes;
+	//The range of subMeshes drawn for each level of detail, level 0 is full detail
+	std::vector<Lod> lods;
+	size_t vertexCount;
+	//Object space bounding box of the mesh and the sphere around it
+	glm::vec3 boundsMin, boundsMax;
+	glm::vec3 sphereCenter;
+	float sphereRadius;
+
+	MeshInfo();
+	//Size of the VBO and what it would be in the VERTEX_FLOAT layout
+	size_t vboBytes() const;
+	size_t floatVboBytes() const;
+};
+
+#endif
+
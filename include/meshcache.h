@@ -0,0 +1,127 @@
+#ifndef MESHCACHE_H
+#define MESHCACHE_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include "mappedfile.h"
+#include "mesh.h"
+
+/*
+ * A compact binary mesh format so we can skip parsing the text OBJs on each run.
+ * The file is a Header followed by the interleaved vertex blob, the index blob,
+ * the sub-mesh table and the level of detail table. The vertex and index blobs are stored exactly as they're
+ * sent to glBufferData so a cache can be mapped and uploaded directly
+ */
+namespace meshcache {
+	const char MAGIC[4] = { 'D', 'R', 'M', 'C' };
+	//Bump whenever the layout of the header or the blobs changes
+	const uint32_t VERSION = 5;
+
+	struct Header {
+		char magic[4];
+		uint32_t version;
+		//Hash and size of the OBJ file the cache was baked from
+		uint64_t sourceHash, sourceSize;
+		//The MeshFlags the mesh was prepared with and its VertexLayout
+		uint32_t flags, layout;
+		uint32_t vertexCount, vertexStride;
+		uint32_t indexCount, indexSize;
+		uint32_t subMeshCount, lodCount;
+		//Object space bounding box of the mesh
+		float boundsMin[3], boundsMax[3];
+		//Offsets of the blobs from the start of the file
+		uint64_t vertexOffset, indexOffset, subMeshOffset, lodOffset;
+	};
+	/*
+	 * A view of vertex and index data ready to be sent to the GPU, pointing
+	 * either into a mapped cache file or into some Mesh's buffers
+	 */
+	struct MeshView {
+		const void *vertices, *indices;
+		const SubMesh *subMeshes;
+		const Lod *lods;
+		size_t vertexCount, vertexStride, indexCount, indexSize, subMeshCount, lodCount;
+		unsigned flags;
+		VertexLayout layout;
+		glm::vec3 boundsMin, boundsMax;
+
+		MeshView();
+		size_t vertexBytes() const;
+		size_t indexBytes() const;
+		/*
+		 * Get the GL type of the indices, eg. GL_UNSIGNED_SHORT
+		 */
+		GLenum indexType() const;
+	};
+	/*
+	 * Buffers holding a mesh's data once it's been packed for upload, the
+	 * vertices are only filled if the mesh had to be split and the vertex
+	 * data only if a packed vertex layout was chosen
+	 */
+	struct PackedMesh {
+		std::vector<Vertex> vertices;
+		std::vector<char> vertexData;
+		std::vector<GLushort> shortIndices;
+		std::vector<SubMesh> subMeshes;
+		std::vector<Lod> lods;
+	};
+	/*
+	 * A mesh loaded through the cache, the view points either into the mapped
+	 * cache file or into the freshly parsed and packed mesh data
+	 */
+	struct CachedMesh {
+		MappedFile cache;
+		Mesh mesh;
+		PackedMesh packed;
+		MeshView view;
+		bool fromCache;
+	};
+	/*
+	 * Get the path of the cache file for some OBJ file
+	 */
+	std::string cachePath(const std::string &source);
+	/*
+	 * Hash the contents of a file for detecting if a cache is stale
+	 */
+	uint64_t hash(const char *data, size_t len);
+	/*
+	 * Get a view of the mesh for upload. Meshes with few enough vertices have their
+	 * indices packed down to 16bit, larger ones use 32bit indices or are split into
+	 * 16bit sub-meshes if MESH_SPLIT_16BIT is set, each level of detail gets its
+	 * own sub-meshes. Vertices are encoded in the
+	 * layout picked by chooseLayout unless MESH_FLOAT_VERTICES is set. Any packed
+	 * data is written to the buffers passed, which must outlive the view
+	 */
+	MeshView makeView(const Mesh &mesh, unsigned flags, PackedMesh &packed);
+	/*
+	 * Write the mesh data to the cache file, tagging it with the hash and size
+	 * of the OBJ file it was built from. The cache is written to a temporary file
+	 * and moved into place so a partially written cache is never read
+	 * returns true on success, false on failure
+	 */
+	bool write(const std::string &file, const MeshView &view, uint64_t sourceHash,
+		uint64_t sourceSize);
+	/*
+	 * Map a cache file and fill out the view to point into the mapping, which
+	 * must stay open while the view is used. The cache's header is returned
+	 * in header so the caller can check if it's out of date
+	 * returns true if the cache is valid, false otherwise
+	 */
+	bool open(const std::string &file, MappedFile &cache, MeshView &view, Header &header);
+	/*
+	 * Load an OBJ file through its cache. If the cache is missing, out of date or
+	 * was built with different MeshFlags (or rebuild is true) the OBJ is parsed,
+	 * optimized with meshopt::optimize unless MESH_NO_OPTIMIZE is set, given
+	 * levels of detail by simplify::buildLods unless MESH_NO_LOD is set, and
+	 * the cache is written
+	 * returns true on success, false on failure
+	 */
+	bool load(const std::string &objFile, CachedMesh &out, unsigned flags = 0,
+		bool rebuild = false);
+}
+
+#endif
+
@@ -0,0 +1,60 @@
+#ifndef MESHOPT_H
+#define MESHOPT_H
+
+#include <vector>
+#include <GL/glew.h>
+#include "mesh.h"
+
+/*
+ * Mesh optimizations run after loading and before upload to cut the vertex
+ * shader and vertex fetch work done when drawing a mesh. Triangles are
+ * reordered for the post-transform vertex cache with Tipsify (Sander et al.
+ * 2007), the cache friendly clusters it produces are then sorted to reduce
+ * overdraw and finally vertices are reordered to match the order they're used
+ */
+namespace meshopt {
+	//The FIFO post-transform cache size we optimize for and measure with
+	const size_t CACHE_SIZE = 16;
+
+	/*
+	 * Vertex cache efficiency of an index buffer, average cache miss ratio
+	 * (transformed vertices per triangle) and average transform to vertex
+	 * ratio (transformed vertices per unique vertex, 1 is ideal)
+	 */
+	struct CacheStats {
+		float acmr, atvr;
+	};
+	/*
+	 * Simulate a FIFO vertex cache of size cacheSize over the indices
+	 */
+	CacheStats measureCache(const std::vector<GLuint> &indices, size_t vertexCount,
+		size_t cacheSize = CACHE_SIZE);
+	/*
+	 * Reorder the triangles for a FIFO vertex cache of size cacheSize using Tipsify
+	 * The start of each cluster of triangles, where Tipsify had to jump to a
+	 * new part of the mesh, is appended to clusters if it's non-null
+	 */
+	void optimizeVertexCache(std::vector<GLuint> &indices, size_t vertexCount,
+		size_t cacheSize = CACHE_SIZE, std::vector<size_t> *clusters = nullptr);
+	/*
+	 * Sort the clusters of triangles found by optimizeVertexCache so the ones
+	 * facing out from the center of the mesh are drawn first, these are more
+	 * likely to occlude the others. If the sort costs more than a few percent
+	 * of the vertex cache efficiency the original order is kept
+	 */
+	void optimizeOverdraw(const std::vector<Vertex> &vertices, std::vector<GLuint> &indices,
+		const std::vector<size_t> &clusters, size_t cacheSize = CACHE_SIZE);
+	/*
+	 * Reorder the vertices in the order they're first used by the indices so
+	 * vertex fetches walk through the VBO, unused vertices are dropped
+	 */
+	void optimizeVertexFetch(Mesh &mesh);
+	/*
+	 * Run all the optimizations on the mesh, the vertex cache efficiency before
+	 * and after is returned so it can be reported
+	 */
+	void optimize(Mesh &mesh, CacheStats &before, CacheStats &after);
+}
+
+#endif
+
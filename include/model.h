@@ -2,61 +2,172 @@
 #define MODEL_H
 
 #include <string>
+#include <vector>
 #include <GL/glew.h>
 #include <glm/glm.hpp>
+#include "geometryarena.h"
+#include "mesh.h"
+#include "transforms.h"
+
+struct StateCache;
+struct DrawBatch;
 
 /*
  * A simple very light abstraction of a 3d model, will
- * load a Wavefront OBJ model file and setup the VAO
- * assuming that the program inputs are 0,1,2: pos, normals, uv
+ * load a Wavefront OBJ model file into the geometry arena for its vertex format
+ * and draw with the arena's VAO, assuming that the program inputs are 0,1,2:
+ * pos, normals, uv. The vertex format depends on the VertexLayout chosen for the mesh
  * must also be assigned a program to use for rendering, but other
  * program inputs must be set separately
- * TODO: not hack in shadow pass, perhaps look into sharing shaders better?
+ * Programs come from programcache and may be shared with other models, so the
+ * model's texture, material and the index of its transform are sent when it's bound
+ * instead of being kept in the program's uniforms. The model's matrix lives in
+ * the transforms store and is read by the shader from its buffer texture
  */
 class Model {
+protected:
+	//The arena holding the mesh and the mesh's block of it, the arena is
+	//null if loading failed
+	GeometryArena *arena;
+	GeometryArena::Handle block;
+	//The arena's VAO, unless a subclass makes its own
 	GLuint vao;
-	//The vbo and ebo
-	GLuint buf[2];
 	size_t nElems;
+	//The vertex layout and index type used and the ranges of the ebo to draw
+	MeshInfo info;
+	//The levels of detail picked for the camera and shadow passes
+	size_t lod, shadowLod;
 	//The regular and shadow pass shader programs
 	//shadowProgram will be 0 if this model isn't given a shadow pass program
 	GLuint program, shadowProgram;
-	//We keep the matrices separate and compose only when sending to GPU
-	//to not screw up order of operation
-	GLint matUnif, shadowMatUnif;
-	glm::mat4 translation, rotation, scaling;
+	//The model's transform and the programs' transform index uniforms. Programs
+	//built with MULTI_DRAW read it from the draw_transforms array instead, whose
+	//first element is set for lone draws
+	transforms::Handle transform;
+	GLint indexUnif, shadowIndexUnif;
+	bool multiDraw, shadowMultiDraw;
+	//The diffuse texture and the unit it's bound to, texture is 0 if the model has none
+	GLuint texture, texUnit;
+	//The specular strength and shininess and the camera program's uniform for
+	//them, -1 if the program doesn't write the material to the G-buffer
+	glm::vec2 material;
+	GLint materialUnif;
 
 public:
 	/*
 	 * Load the model from a file and give it a shader program to use
 	 * The shader program should take position, normal and uv as inputs 0, 1, 2
-	 * and have a uniform mat4 input for the model matrix if not doing instanced
-	 * rendering
+	 * and if not doing instanced rendering read its model matrix from the
+	 * transforms samplerBuffer at the transform_index uniform
+	 * The model takes over a reference to the programs from programcache::acquire
+	 * meshFlags are MeshFlags controlling how the mesh is prepared, see util::loadOBJ
 	 */
-	Model(const std::string &file, GLuint program, GLuint shadowProgram = 0);
+	Model(const std::string &file, GLuint program, GLuint shadowProgram = 0,
+		unsigned meshFlags = 0);
 	/*
-	 * Free the model's buffers and program
+	 * Free the model's block of the arena and release its programs
 	 */
-	~Model();
+	virtual ~Model();
 	/*
-	 * Bind the model and its program for rendering
+	 * Bind the model and its program for rendering, sending the model's
+	 * transform index and material and binding its texture
 	 */
-	void bind();
+	virtual void bind();
 	/*
 	 * Bind the model and its program for shadow map pass
 	 */
-	void bindShadow();
+	virtual void bindShadow();
+	/*
+	 * Bind the model for the shadow pass if shadow is set or the camera pass
+	 * otherwise, skipping the program, VAO and texture binds the cache says
+	 * are already in place, see RenderQueue
+	 */
+	virtual void bindCached(StateCache &cache, bool shadow);
+	/*
+	 * Get the program drawn with in the shadow or camera pass, the VAO and
+	 * the diffuse texture (0 for none), eg. to sort draws by the state they need
+	 */
+	GLuint passProgram(bool shadow) const;
+	GLuint vertexArray() const;
+	GLuint diffuseTexture() const;
+	/*
+	 * Get the specular strength and shininess sent to the camera pass program
+	 */
+	const glm::vec2& surfaceMaterial() const;
+	/*
+	 * Check if the program for the shadow or camera pass reads each draw's
+	 * transform index from draw_transforms, so the model can be drawn in a
+	 * multi-draw batch with others using the program
+	 */
+	bool multiDrawable(bool shadow) const;
+	/*
+	 * Get the transform index uniform of the program for the pass, for
+	 * multi-draw programs the location of draw_transforms
+	 */
+	GLint transformUniform(bool shadow) const;
+	/*
+	 * Add the sub-meshes of the level of detail picked for the pass to a
+	 * multi-draw batch, offset to where the arena holds them
+	 */
+	void batchDraws(bool shadow, DrawBatch &batch) const;
+	/*
+	 * Set the diffuse texture to bind to texture unit unit when drawing
+	 */
+	void setTexture(GLuint tex, GLuint unit);
+	/*
+	 * Set the specular strength in [0, 1] and shininess in [1, 128] the camera
+	 * pass writes to the G-buffer for the model, defaults to 0.4 and 50
+	 */
+	void setMaterial(float specular, float shininess);
+	/*
+	 * Pick the levels of detail to draw from the model's projected size. The
+	 * camera pass uses the coarsest level whose error projects to at most maxError
+	 * pixels, where pixelsPerUnit is the size in pixels of one unit at a distance
+	 * of 1 from the camera. The shadow pass uses a level shadowBias levels coarser
+	 */
+	virtual void selectLod(const glm::vec3 &viewPos, float pixelsPerUnit, float maxError,
+		size_t shadowBias);
+	/*
+	 * Draw the model's triangles at the level of detail picked for the camera
+	 * pass, the model should be bound with bind first
+	 */
+	void draw();
+	/*
+	 * Draw the model's triangles at the level of detail picked for the shadow
+	 * pass, the model should be bound with bindShadow first
+	 */
+	void drawShadow();
+	/*
+	 * Get the model's world space bounding box, as of the last transforms::update
+	 */
+	virtual void worldBounds(glm::vec3 &lo, glm::vec3 &hi);
 	/*
-	 * Set the shadow pass view/projection matrix
-	 * this is sorta hacked in
+	 * Get the handle of the model's transform in the transforms store
 	 */
-	void setShadowVP(const glm::mat4 &vp);
+	transforms::Handle transformHandle() const;
 	/*
-	 * Get the number of elements in the element buffer
+	 * Get the number of levels of detail the model has
+	 */
+	size_t lodCount();
+	/*
+	 * Get the level of detail picked for the shadow pass
+	 */
+	size_t shadowLodLevel() const;
+	/*
+	 * Get the number of elements drawn for the full detail level
 	 */
 	size_t elems();
 	/*
-	 * Apply some translation to the model
+	 * Get the type of the element buffer's indices, GL_UNSIGNED_SHORT or GL_UNSIGNED_INT
+	 */
+	GLenum indexType();
+	/*
+	 * Get info about the model's mesh, eg. its vertex layout and VBO size
+	 */
+	const MeshInfo& meshInfo();
+	/*
+	 * Apply some translation to the model, the transform changes are only
+	 * seen after the next transforms::update and transforms::upload
 	 */
 	void translate(const glm::vec3 &vec);
 	/*
@@ -68,15 +179,23 @@ public:
 	 */
 	void scale(const glm::vec3 &scale);
 
-private:
+protected:
 	/*
-	 * Load the model from the file and setup the VAO
+	 * Draw the sub-meshes making up a level of detail
 	 */
-	void load(const std::string &file);
+	virtual void drawLod(size_t level);
 	/*
-	 * Update the uniform model matrix being sent to the shader
+	 * Pick the levels of detail for the mesh drawn with each of the count
+	 * model matrices, the level is picked for the one needing the most detail
+	 */
+	void selectLod(const glm::mat4 *matrices, size_t count, const glm::vec3 &viewPos,
+		float pixelsPerUnit, float maxError, size_t shadowBias);
+
+private:
+	/*
+	 * Load the model from the file and setup the VAO
 	 */
-	void updateMatrix();
+	void load(const std::string &file, unsigned meshFlags);
 };
 
 #endif
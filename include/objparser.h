@@ -0,0 +1,53 @@
+#ifndef OBJPARSER_H
+#define OBJPARSER_H
+
+#include <string>
+#include "mesh.h"
+
+/*
+ * A streaming Wavefront OBJ parser, the file is memory mapped and tokenized
+ * in place so no allocations are made per line or per face. Unique v/vt/vn
+ * triples are found with an open addressing hash on the index triple
+ */
+namespace obj {
+	/*
+	 * Timing and size information about a parse, for tracking loader throughput
+	 */
+	struct ParseStats {
+		size_t bytes, triangles, vertices;
+		double seconds;
+
+		ParseStats();
+		double mbPerSec() const;
+		double trisPerSec() const;
+	};
+	/*
+	 * Parse the OBJ file into the mesh passed, any existing mesh data is replaced
+	 * Faces with more than 3 vertices are triangulated as fans and faces missing
+	 * uv or normal indices will have those components zeroed
+	 * If stats is non-null it will be filled out with the parse timing
+	 * returns true on success, false on failure
+	 */
+	bool parse(const std::string &fName, Mesh &mesh, ParseStats *stats = nullptr);
+	/*
+	 * Parse OBJ data already in memory, begin to end
+	 * If stats is non-null it will be filled out with the parse timing
+	 */
+	bool parse(const char *begin, const char *end, Mesh &mesh, ParseStats *stats = nullptr);
+	/*
+	 * Parse OBJ data in memory using multiple threads. The data is split into
+	 * chunks at line boundaries which are parsed concurrently, then merged and
+	 * deduplicated so the mesh is identical to what parse would produce
+	 * If threads is 0 the hardware concurrency is used, small files that aren't
+	 * worth splitting are parsed serially
+	 */
+	bool parseParallel(const char *begin, const char *end, Mesh &mesh, size_t threads = 0,
+		ParseStats *stats = nullptr);
+	/*
+	 * Print the parse stats for some file to stdout
+	 */
+	void logStats(const std::string &fName, const ParseStats &stats);
+}
+
+#endif
+
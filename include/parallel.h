@@ -0,0 +1,68 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <vector>
+#include <thread>
+
+namespace parallel {
+	/*
+	 * Run fn(t) for t in [0, threads), with t = 0 run on the calling thread.
+	 * The threads are started and joined each call, which costs about as much
+	 * as a small job, so work run every frame should go through a Pool
+	 */
+	template<typename F>
+	void run(size_t threads, const F &fn){
+		std::vector<std::thread> workers;
+		for (size_t t = 1; t < threads; ++t){
+			workers.push_back(std::thread(fn, t));
+		}
+		fn(0);
+		for (std::thread &w : workers){
+			w.join();
+		}
+	}
+
+	/*
+	 * Worker threads kept waiting between jobs, so running work every frame
+	 * only costs waking them up. The calling thread takes part in each job
+	 */
+	class Pool {
+		std::vector<std::thread> workers;
+		std::mutex mutex;
+		std::condition_variable wake, done;
+		//The job being run, the threads it's run on and the workers still on it
+		const std::function<void(size_t)> *job;
+		size_t jobThreads, remaining;
+		//Bumped for each job so the workers can tell a new one was posted
+		unsigned generation;
+		bool quit;
+
+	public:
+		/*
+		 * Start threads - 1 workers, the calling thread makes up the last
+		 */
+		Pool(size_t threads);
+		~Pool();
+		/*
+		 * Get the most threads a job can run on
+		 */
+		size_t size() const;
+		/*
+		 * Run fn(t) for t in [0, threads) and wait for it to finish, with t = 0
+		 * run on the calling thread. threads is clamped to the pool's size
+		 */
+		void run(size_t threads, const std::function<void(size_t)> &fn);
+
+	private:
+		void work(size_t t);
+
+		Pool(const Pool&);
+		Pool& operator=(const Pool&);
+	};
+}
+
+#endif
+
@@ -0,0 +1,148 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <chrono>
+#include <deque>
+#include <string>
+#include <vector>
+#include <GL/glew.h>
+
+/*
+ * Times named sections of each frame on the CPU and the GPU. Sections are
+ * opened and closed with a Scope and may nest. The GPU side of a section is
+ * a pair of GL_TIMESTAMP queries, so sections can wrap passes running their
+ * own GL_TIME_ELAPSED queries, and each frame's queries come from a ring of
+ * QUERY_FRAMES sets which are only read back when the set comes around again.
+ * By then the GPU has long finished with them, if it somehow hasn't that
+ * frame's GPU times are dropped instead of waiting on it. Benchmarks needing
+ * every frame's times can instead have each frame read back as it ends,
+ * waiting on the GPU
+ * The last TRACE_FRAMES frames with their times are kept for a rolling
+ * summary and a Chrome trace (chrome://tracing or Perfetto) export
+ */
+class Profiler {
+public:
+	//Number of frames of queries in flight before they're read back
+	static const int QUERY_FRAMES = 4;
+	//Number of finished frames kept for the trace and the summary
+	static const size_t TRACE_FRAMES = 300;
+
+	/*
+	 * Times a section from its construction to its destruction
+	 */
+	class Scope {
+		Profiler &profiler;
+
+	public:
+		Scope(Profiler &profiler, const std::string &name);
+		~Scope();
+
+	private:
+		Scope(const Scope&);
+		Scope& operator=(const Scope&);
+	};
+
+	/*
+	 * The average and longest CPU and GPU times of a section over some frames,
+	 * in milliseconds
+	 */
+	struct Summary {
+		std::string name;
+		int depth;
+		double cpuMs, cpuMaxMs, gpuMs, gpuMaxMs;
+	};
+
+private:
+	typedef std::chrono::high_resolution_clock Clock;
+
+	//A section timed in a frame, times are in milliseconds since the
+	//profiler was made, the GPU's included after calibrating the clocks
+	struct Event {
+		size_t section;
+		int depth;
+		double cpuStart, cpuEnd, gpuStart, gpuEnd;
+		//Index of the section's start query in its frame's set, the end query
+		//follows it
+		size_t query;
+	};
+	struct Frame {
+		std::vector<Event> events;
+		//Number of queries the frame used from its set
+		size_t queriesUsed;
+	};
+
+	std::vector<std::string> sections;
+	Clock::time_point epoch;
+	//The GPU's timestamp in nanoseconds when the profiler was made
+	GLint64 gpuEpoch;
+	Frame pending[QUERY_FRAMES];
+	std::vector<GLuint> queries[QUERY_FRAMES];
+	int current;
+	//Events of the current frame still open
+	std::vector<size_t> open;
+	std::deque<Frame> finished;
+	size_t droppedFrames;
+	bool waitGpu;
+
+public:
+	/*
+	 * Setup the profiler, if waitGpu is set each frame's queries are read back
+	 * when it ends, waiting on the GPU, instead of QUERY_FRAMES frames later
+	 */
+	Profiler(bool waitGpu = false);
+	~Profiler();
+	/*
+	 * Open and close a section, prefer a Scope. Sections must be closed in
+	 * the reverse of the order they were opened
+	 */
+	void begin(const std::string &name);
+	void end();
+	/*
+	 * Finish the frame, all its sections must be closed. The oldest set of
+	 * queries is read back and that frame joins the finished frames
+	 */
+	void endFrame();
+	/*
+	 * Get each section's average and longest times over the last frames
+	 * finished, in the order the sections were first seen. Frames whose GPU
+	 * times were dropped still count towards the CPU times
+	 */
+	std::vector<Summary> summarize(size_t frames) const;
+	/*
+	 * Format the summary over the last frames finished on one line, eg. for
+	 * the window title or stdout
+	 */
+	std::string summaryLine(size_t frames) const;
+	/*
+	 * Get the GPU time of each named section in milliseconds, totaled over the
+	 * newest finished frame, which is the frame just ended if waiting on the
+	 * GPU. Sections not timed in the frame get 0, returns false if there's no
+	 * finished frame or its GPU times were dropped
+	 */
+	bool gpuTimes(const std::vector<std::string> &names, std::vector<double> &ms) const;
+	/*
+	 * Write the frames kept as a Chrome trace to the file with the CPU and GPU
+	 * times on their own tracks, returns false if the file couldn't be written
+	 */
+	bool writeTrace(const std::string &file) const;
+	/*
+	 * Number of frames whose GPU times were dropped since the queries weren't
+	 * done when their set came around again
+	 */
+	size_t dropped() const;
+
+private:
+	double cpuNow() const;
+	size_t sectionIndex(const std::string &name);
+	/*
+	 * Read back the queries of the frame in set q, returns false if they
+	 * weren't all available. If wait is set the GPU is waited on instead
+	 */
+	bool resolve(int q, bool wait);
+
+	Profiler(const Profiler&);
+	Profiler& operator=(const Profiler&);
+};
+
+#endif
+
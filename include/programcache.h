@@ -0,0 +1,60 @@
+#ifndef PROGRAMCACHE_H
+#define PROGRAMCACHE_H
+
+#include <string>
+#include <GL/glew.h>
+
+/*
+ * A reference counted cache of shader programs keyed by the vertex and fragment
+ * shader files and the preprocessor defines they're built with, so models drawn
+ * with the same shaders share one program and it's only compiled and linked once.
+ * Since programs are shared, per-model data like the model matrix or textures
+ * must be set when the model is bound and not stored in the program's uniforms
+ * If enableBinaryCache is called, linked programs are also saved to disk with
+ * glGetProgramBinary and loaded back on later runs to skip compiling
+ */
+namespace programcache {
+	struct Stats {
+		//Programs built, from source or the binary cache, and requests served
+		//by an existing program
+		size_t linked, shared;
+		//Calls to use that actually changed the bound program
+		size_t switches;
+		//Programs loaded from the binary cache and time spent loading programs
+		size_t binaryLoads;
+		double seconds;
+	};
+	/*
+	 * Save linked program binaries to dir and load them from it when building
+	 * programs, if the driver supports GL_ARB_get_program_binary. Binaries are
+	 * keyed on the shader sources, defines and the GL vendor, renderer and version
+	 * and we fall back to compiling from source if the driver rejects one.
+	 * Needs a current GL context
+	 */
+	void enableBinaryCache(const std::string &dir);
+	/*
+	 * Get the program built from the shaders and defines passed, compiling
+	 * and linking it if it isn't in the cache yet. defines is inserted after the
+	 * #version line of both shaders, eg. "#define SHADOW_PCF\n"
+	 * Each successful call holds a reference which must be given back with release
+	 * returns -1 if loading failed
+	 */
+	GLint acquire(const std::string &vertfname, const std::string &fragfname,
+		const std::string &defines = "");
+	/*
+	 * Give back a reference to a program, the program is deleted once the last
+	 * reference is released
+	 */
+	void release(GLuint program);
+	/*
+	 * Bind the program if it isn't already bound, all program binds should go
+	 * through here so redundant glUseProgram calls can be skipped
+	 */
+	void use(GLuint program);
+	/*
+	 * Get the cache's stats so far
+	 */
+	const Stats& stats();
+}
+
+#endif
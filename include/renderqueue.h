@@ -0,0 +1,138 @@
+#ifndef RENDERQUEUE_H
+#define RENDERQUEUE_H
+
+#include <cstdint>
+#include <vector>
+#include <GL/glew.h>
+
+class Model;
+
+/*
+ * Tracks the program, VAO and textures bound while a RenderQueue is drawn so
+ * binds of what's already bound can be skipped. Anything binding state behind
+ * its back makes it stale, so it's reset before each run of draws
+ */
+struct StateCache {
+	static const int MAX_UNITS = 16;
+
+	GLuint program, vao;
+	GLuint textures[MAX_UNITS];
+	//Binds actually made since the cache was made
+	size_t programChanges, vaoChanges, textureChanges;
+
+	StateCache();
+	/*
+	 * Forget what's bound, the next bind of each kind is always made
+	 */
+	void reset();
+	void useProgram(GLuint program);
+	void bindVertexArray(GLuint vao);
+	/*
+	 * Bind a GL_TEXTURE_2D to the unit, leaving the unit active
+	 */
+	void bindTexture(GLuint unit, GLuint texture);
+};
+
+/*
+ * The sub-mesh draws of a glMultiDrawElementsBaseVertex batch and the
+ * transform index each reads through draw_transforms[gl_DrawIDARB]
+ */
+struct DrawBatch {
+	std::vector<GLsizei> counts;
+	std::vector<const GLvoid*> offsets;
+	std::vector<GLint> baseVertices, transforms;
+
+	void clear();
+};
+
+/*
+ * Collects the draws of a pass as packets with a 64 bit sort key then sorts
+ * and draws them so draws needing the same state are issued together. The
+ * key holds from high to low bits:
+ * pass (4 bits), program (12), texture (12), VAO (12), depth (24)
+ * so the most expensive changes, the program then the texture, are made the
+ * fewest times and draws sharing all their state go front to back for the
+ * early depth test. The ids are masked down to their bits, ids colliding in
+ * their bits only costs some sorting since the binds check the real ids
+ * Runs of draws sharing their program, VAO and texture whose programs were
+ * built with MULTI_DRAW go out as one glMultiDrawElementsBaseVertex, which
+ * needs GL_ARB_shader_draw_parameters for each draw to find its transform.
+ * Since models share their arena's VAO a run is usually every model using
+ * a program and texture
+ */
+class RenderQueue {
+public:
+	enum Pass { SHADOW, GBUFFER, PASS_COUNT };
+	//Most draws in one multi-draw call, the size of draw_transforms in the shaders
+	static const size_t MAX_BATCH = 64;
+	/*
+	 * The binds made drawing the queue, next to what binding every model
+	 * with bind and bindShadow in the order they were submitted would have
+	 * made, counting programs as programcache::use filters them, and the
+	 * submissions made, a model drawn on its own or a multi-draw call each
+	 */
+	struct Stats {
+		size_t draws;
+		size_t unsortedChanges, changes;
+		size_t drawCalls;
+	};
+
+private:
+	struct Packet {
+		uint64_t key;
+		Model *model;
+	};
+	std::vector<Packet> packets, scratch;
+	StateCache cache;
+	DrawBatch batch;
+	Stats counts;
+
+public:
+	RenderQueue();
+	/*
+	 * Queue a draw of the model in the pass, depth is its distance from the
+	 * camera and must not be negative
+	 */
+	void submit(Pass pass, Model *model, float depth);
+	/*
+	 * Sort the queue and draw it, then clear it for the next frame
+	 */
+	void execute();
+	size_t size() const;
+	/*
+	 * Get the state change counts since the last resetStats
+	 */
+	const Stats& stats() const;
+	void resetStats();
+	/*
+	 * Build the sort key of a draw
+	 */
+	static uint64_t makeKey(Pass pass, GLuint program, GLuint texture, GLuint vao, float depth);
+
+private:
+	/*
+	 * Sort the packets by key with an LSD radix sort over the key's bytes,
+	 * skipping bytes every key shares
+	 */
+	void sort();
+	/*
+	 * Count the binds drawing the packets in the order they're in would take
+	 * without the state cache
+	 */
+	size_t countUnsortedChanges() const;
+	/*
+	 * Check if two packets' models need the same state in the pass
+	 */
+	static bool sameState(const Packet &a, const Packet &b, bool shadow);
+	/*
+	 * Draw the batch with the program using draw_transforms at the uniform
+	 * location passed bound, in calls of at most MAX_BATCH draws
+	 */
+	void drawBatch(GLint transformsUnif, GLenum indexType);
+
+	RenderQueue(const RenderQueue&);
+	RenderQueue& operator=(const RenderQueue&);
+};
+
+#endif
+
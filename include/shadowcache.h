@@ -0,0 +1,42 @@
+#ifndef SHADOWCACHE_H
+#define SHADOWCACHE_H
+
+#include <vector>
+#include <glm/glm.hpp>
+#include "model.h"
+
+/*
+ * Remembers what a shadow map was last drawn with so the shadow pass can be
+ * skipped while none of it has changed: the light's matrix, which casters
+ * were drawn and the levels of detail they were drawn at. The cache can't
+ * see casters moving, whoever moves them must call invalidate
+ */
+class ShadowCache {
+	glm::mat4 lightVP;
+	std::vector<size_t> casters, lods;
+	bool valid;
+	size_t skipped, rendered;
+
+public:
+	ShadowCache();
+	/*
+	 * Check if the shadow map must be redrawn for the light and the casters
+	 * passed, which are indices into models. If it's still up to date the
+	 * skipped pass is counted, otherwise the cache assumes it's redrawn
+	 * returns true if the shadow map must be redrawn
+	 */
+	bool stale(const glm::mat4 &lightVP, const std::vector<size_t> &casters,
+		const std::vector<Model*> &models);
+	/*
+	 * Force the shadow map to be redrawn the next time it's checked
+	 */
+	void invalidate();
+	/*
+	 * Get the number of shadow passes skipped and drawn so far
+	 */
+	size_t skippedPasses() const;
+	size_t renderedPasses() const;
+};
+
+#endif
+
@@ -0,0 +1,125 @@
+#ifndef SHADOWCASCADES_H
+#define SHADOWCASCADES_H
+
+#include <vector>
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include "bvh.h"
+#include "model.h"
+#include "renderqueue.h"
+#include "shadowcache.h"
+
+/*
+ * Cascaded shadow maps for the directional light. The camera's view out to
+ * the shadow distance is split into cascades with the practical split scheme
+ * (a blend of logarithmic and uniform splits) and each cascade gets its own
+ * layer of a GL_TEXTURE_2D_ARRAY of depth. A cascade's projection is an ortho
+ * box around the bounding sphere of its slice of the view frustum, with the
+ * sphere's radius quantized and its center snapped to whole shadow map texels
+ * so the shadows don't shimmer as the camera moves or turns. Each cascade
+ * culls the casters against its own box and is only redrawn when its
+ * ShadowCache says something it draws changed
+ *
+ * The programs read the cascades through two std140 blocks, the lookup
+ * programs through
+ * layout(std140) uniform Cascades {
+ *     mat4 cascade_vp[MAX_CASCADES];
+ *     vec4 cascade_splits;
+ * };
+ * where the split is the far view space distance of each cascade, -1 for
+ * unused cascades, and the shadow pass programs through
+ * layout(std140) uniform ShadowPass {
+ *     mat4 pass_vp;
+ * };
+ * holding the matrix of the cascade being drawn
+ */
+class ShadowCascades {
+public:
+	static const int MAX_CASCADES = 4;
+	//Uniform buffer binding points of the Cascades and ShadowPass blocks
+	static const GLuint BINDING = 1, PASS_BINDING = 2;
+
+private:
+	//Frames of GPU timer queries kept in flight per cascade
+	static const int QUERY_FRAMES = 3;
+	int size, count;
+	float distance, lambda;
+	GLuint tex, fbo, ubo, passUbo;
+	//Offset between the cascades' matrices in the pass buffer, a multiple
+	//of the uniform buffer offset alignment
+	GLint passStride;
+	glm::mat4 viewProjs[MAX_CASCADES];
+	float splits[MAX_CASCADES];
+	ShadowCache caches[MAX_CASCADES];
+	std::vector<size_t> visible, casters;
+	//Each cascade's casters are sorted by program and VAO before drawing
+	RenderQueue queue;
+	//The casters drawn into each cascade last frame and whether it was skipped
+	size_t drawCounts[MAX_CASCADES];
+	bool skippedCascades[MAX_CASCADES];
+	GLuint queries[QUERY_FRAMES][MAX_CASCADES];
+	bool queryPending[QUERY_FRAMES][MAX_CASCADES];
+	int queryFrame;
+	double times[MAX_CASCADES];
+
+public:
+	/*
+	 * Setup count cascades of size x size texels for shadows out to distance
+	 * from the camera, lambda blends between uniform (0) and logarithmic (1)
+	 * splits. The texture array is bound to the texture unit passed
+	 */
+	ShadowCascades(int size, int count, GLenum unit, float distance = 20.f,
+		float lambda = 0.75f);
+	~ShadowCascades();
+	/*
+	 * Check the framebuffer is complete
+	 */
+	bool ready() const;
+	/*
+	 * Fit the cascades to the camera's view with a perspective projection of
+	 * fovy degrees, aspect and near plane and to the light pointing along
+	 * -lightDir, then upload the lookup data
+	 */
+	void fit(const glm::mat4 &view, float fovy, float aspect, float nearPlane,
+		const glm::vec3 &lightDir);
+	/*
+	 * Draw each cascade whose casters changed since it was last drawn, the
+	 * casters are the models in the BVH inside the cascade's box with a non-zero
+	 * entry in layer
+	 */
+	void render(const Bvh &bvh, const std::vector<Model*> &models,
+		const std::vector<char> &layer);
+	/*
+	 * Force every cascade to be redrawn, eg. because a caster moved
+	 */
+	void invalidate();
+	int cascades() const;
+	/*
+	 * Get the casters drawn into a cascade last frame, if it was skipped and
+	 * the last GPU time measured for drawing it in milliseconds
+	 */
+	size_t drawn(int cascade) const;
+	bool skipped(int cascade) const;
+	double ms(int cascade) const;
+	/*
+	 * Get the number of cascade passes skipped and drawn so far
+	 */
+	size_t skippedPasses() const;
+	size_t renderedPasses() const;
+	/*
+	 * Get the state changes drawing the cascades took in the last render
+	 */
+	const RenderQueue::Stats& stateStats() const;
+	/*
+	 * Point the program's Cascades and ShadowPass blocks, if it has them,
+	 * at BINDING and PASS_BINDING
+	 */
+	static void bindBlocks(GLuint program);
+
+private:
+	ShadowCascades(const ShadowCascades&);
+	ShadowCascades& operator=(const ShadowCascades&);
+};
+
+#endif
+
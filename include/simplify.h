@@ -0,0 +1,35 @@
+#ifndef SIMPLIFY_H
+#define SIMPLIFY_H
+
+#include <GL/glew.h>
+#include "mesh.h"
+
+/*
+ * Mesh simplification for building LOD chains. Edges are collapsed in order
+ * of their quadric error (Garland & Heckbert 1997), each vertex is collapsed
+ * onto one of its neighbours so the coarser levels only need new indices and
+ * can share the full detail level's vertices. Vertices on attribute seams or
+ * open borders are never moved so the coarser levels don't tear or lose
+ * their outline
+ */
+namespace simplify {
+	//The most levels to build, including the full detail level
+	const size_t MAX_LODS = 4;
+	//Each level targets this fraction of the previous level's triangles
+	const float LOD_REDUCTION = 0.5f;
+	//Don't bother building levels with fewer triangles than this
+	const size_t MIN_LOD_TRIS = 64;
+
+	/*
+	 * Build up to maxLods levels of detail for the mesh. The triangles of the
+	 * coarser levels are appended to mesh.indices and mesh.lods is filled with
+	 * the range of indices used by each level, starting with the full detail
+	 * mesh as level 0. Each level's error is the square root of the largest
+	 * quadric error of the collapses made to reach it, roughly how far in
+	 * object space the surface has moved. The chain stops early once the
+	 * mesh can't be simplified much further
+	 */
+	void buildLods(Mesh &mesh, size_t maxLods = MAX_LODS);
+}
+
+#endif
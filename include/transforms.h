@@ -0,0 +1,62 @@
+#ifndef TRANSFORMS_H
+#define TRANSFORMS_H
+
+#include <vector>
+#include <cstdint>
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+
+/*
+ * Storage for the transforms of everything in the scene. The translation, 3x3
+ * rotation and scale of each transform are kept in separate arrays with a
+ * dirty flag so changing a transform is just a few stores. Once per frame
+ * update composes translation * rotation * scaling for the transforms that
+ * changed and upload sends the new matrices to a buffer texture in one call.
+ * Shaders fetch their model matrix from the buffer texture with texelFetch,
+ * 4 RGBA32F texels (columns) per matrix, at the index of their transform
+ */
+namespace transforms {
+	typedef uint32_t Handle;
+	//Texture unit the buffer texture of model matrices is bound to
+	const GLuint TEXTURE_UNIT = 6;
+
+	/*
+	 * Create a new identity transform
+	 */
+	Handle create();
+	/*
+	 * Free the transform so its slot can be reused
+	 */
+	void destroy(Handle h);
+	/*
+	 * Apply some translation, rotation or scaling to the transform, only the
+	 * upper 3x3 of rot is used
+	 */
+	void translate(Handle h, const glm::vec3 &vec);
+	void rotate(Handle h, const glm::mat4 &rot);
+	void scale(Handle h, const glm::vec3 &scale);
+	/*
+	 * Get the composed matrix of the transform as of the last update
+	 */
+	const glm::mat4& matrix(Handle h);
+	/*
+	 * Compose the matrices of the transforms that changed since the last
+	 * update, returns the number of matrices composed
+	 */
+	size_t update();
+	/*
+	 * Get the transforms whose matrices were composed by the last update
+	 */
+	const std::vector<Handle>& updated();
+	/*
+	 * Send the matrices composed since the last upload to the buffer texture
+	 * in one batch and bind it to TEXTURE_UNIT. Needs a current GL context
+	 */
+	void upload();
+	/*
+	 * Free the buffer texture
+	 */
+	void shutdown();
+}
+
+#endif
@@ -1,8 +1,8 @@
 #ifndef UTIL_H
 #define UTIL_H
 
-#include <array>
 #include <string>
+#include <vector>
 #include <GL/glew.h>
 #include <glm/glm.hpp>
 
@@ -12,6 +12,9 @@
 #include <SDL_opengl.h>
 #endif
 
+#include "geometryarena.h"
+#include "mesh.h"
+
 namespace util {
 	/*
 	* Read the entire contents of a file into a string, if an error occurs
@@ -20,14 +23,19 @@ namespace util {
 	std::string readFile(const std::string &fName);
 	/*
 	 * Load a GLSL shader from some file, returns -1 if loading failed
+	 * defines are inserted after the #version line, eg. "#define SHADOW_PCF\n"
 	 */
-	GLint loadShader(const std::string &file, GLenum type);
+	GLint loadShader(const std::string &file, GLenum type, const std::string &defines = "");
 	/*
 	 * Load a simple shader program using the vertex and fragment
-	 * shaders in the files passed
+	 * shaders in the files passed, built with the defines passed
+	 * If retrievable is true the driver is hinted that we'll read the
+	 * program back with glGetProgramBinary
+	 * Prefer programcache::acquire so identical programs are shared
 	 * returns -1 if loading failed
 	 */
-	GLint loadProgram(const std::string &vertfname, const std::string &fragfname);
+	GLint loadProgram(const std::string &vertfname, const std::string &fragfname,
+		const std::string &defines = "", bool retrievable = false);
 	/*
 	 * Load an image into an OpenGL texture. SDL is used to read the image into
 	 * a surface which is then passed to OpenGL. A new texture id is created
@@ -38,46 +46,52 @@ namespace util {
 	 * just BMP support for now
 	 */
 	GLuint loadTexture(const std::string &file);
+	/*
+	 * Read back the width x height color buffer of the default framebuffer and
+	 * save it as a BMP file, the back buffer is read so this should be called
+	 * before swapping. Returns true if the file was written
+	 */
+	bool saveScreenshot(const std::string &file, int width, int height);
 	/*
 	 * Check for an OpenGL error and log it along with the message passed
 	 * if an error occured. Will return true if an error occured & was logged
 	 */
 	bool logGLError(const std::string &msg);
 	/*
-	 * A debug callback for the GL_ARB_debug_out extension
+	 * A debug callback for the GL_ARB_debug_output and GL_KHR_debug extensions,
+	 * glcheck installs it and counts the messages passing through
 	 */
 #ifdef _WIN32
 	void APIENTRY glDebugCallback(GLenum src, GLenum type, GLuint id, GLenum severity,
-		GLsizei len, const GLchar *msg, GLvoid *user);
+		GLsizei len, const GLchar *msg, const GLvoid *user);
 #else
 	void glDebugCallback(GLenum src, GLenum type, GLuint id, GLenum severity,
-		GLsizei len, const GLchar *msg, GLvoid *user);
+		GLsizei len, const GLchar *msg, const GLvoid *user);
 #endif
 	/*
-	* Load an OBJ model file into the vbo and ebo passed in
-	* The model must have vertex, texture and normal data and be a triangle mesh
-	* vbo & ebo should be already created and will be filled with the model data
-	* vbo should be GL_ARRAY_BUFFER and ebo should be GL_ELEMENT_ARRAY_BUFFER, data will
-	* be written with GL_STATIC_DRAW, the element indices will be stored as GL_UNSIGNED_SHORT
-	* The vbo will be packed: vec3 pos, vec3 normal, vec3 uv
+	* Load an OBJ model file into a block of the geometry arena for its vertex layout and
+	* index type, which are returned in arena and block
+	* The model must be a triangle mesh, faces missing uv or normal data will have them zeroed
+	* The sub-meshes' offsets and base vertices in info are relative to the block, see
+	* GeometryArena::baseVertex and indexOffset. The element indices are stored as GL_UNSIGNED_SHORT
+	* if the mesh has few enough vertices and GL_UNSIGNED_INT otherwise, unless flags
+	* has MESH_SPLIT_16BIT set in which case large meshes are split into 16bit sub-meshes.
+	* The vertices will be packed in the most compact VertexLayout that represents the mesh
+	* accurately, unless flags has MESH_FLOAT_VERTICES set. The layout and index type used,
+	* the ranges of the indices to draw for each level of detail and the mesh's bounding box
+	* and sphere are returned in info, and the bytes per vertex and VBO size are logged
+	* The file is parsed with obj::parse and the parse throughput is logged, the result
+	* is baked into a mesh cache file next to the OBJ which will be mapped and uploaded
+	* directly on later loads, as long as the OBJ hasn't changed
 	* returns true on success, false on failure
 	*/
-	bool loadOBJ(const std::string &fName, GLuint &vbo, GLuint &ebo, size_t &nElems);
-	/*
-	* Functions to get values from formatted strings, for use in reading the
-	* model file
-	*/
-	glm::vec2 captureVec2(const std::string &str);
-	glm::vec3 captureVec3(const std::string &str);
-	/*
-	* Get the vertex informaton for a face as an array of 3 strings
-	*/
-	std::array<std::string, 3> captureFaces(const std::string &str);
+	bool loadOBJ(const std::string &fName, GeometryArena *&arena, GeometryArena::Handle &block,
+		MeshInfo &info, unsigned flags = 0);
 	/*
-	* Capture the indices of the vertex components, the array contains the
-	* face information: v/vt/vn
+	* Setup the vertex attribute pointers for the vertex layout passed on the currently
+	* bound VAO and GL_ARRAY_BUFFER. Attributes 0, 1, 2 are position, normal and uv
 	*/
-	std::array<unsigned int, 3> captureVertex(const std::string &str);
+	void setupVertexAttribs(VertexLayout layout);
 }
 
 #endif
@@ -3,15 +3,24 @@
 //Simple textured forward rendering shader for when I want to output
 //some luminosity debug textures to screen. gDEBugger is great but I can't seem
 //to interact with the program
+//With ARRAY_TEXTURE it shows one layer of an array texture, eg. a shadow cascade
 
+#ifdef ARRAY_TEXTURE
+uniform sampler2DArray tex;
+uniform int layer;
+#else
 uniform sampler2D tex;
+#endif
 
 in vec2 f_uv;
 
 out vec4 color;
 
 void main(void){
+#ifdef ARRAY_TEXTURE
+	float l = texture(tex, vec3(f_uv, float(layer))).x;
+#else
 	float l = texture(tex, f_uv).x;
+#endif
 	color = vec4(l);
 }
-
@@ -0,0 +1,25 @@
+#version 330
+
+//Each output texel covers a SCALE x SCALE block of the depth buffer
+const int SCALE = 4;
+
+uniform sampler2D depth;
+
+out float max_depth;
+
+/*
+ * Keep the farthest depth in the block, so anything behind it is
+ * behind everything drawn to the block
+ */
+void main(void){
+	ivec2 size = textureSize(depth, 0);
+	ivec2 base = ivec2(gl_FragCoord.xy) * SCALE;
+	float d = 0.f;
+	for (int y = 0; y < SCALE; ++y){
+		for (int x = 0; x < SCALE; ++x){
+			ivec2 p = min(base + ivec2(x, y), size - 1);
+			d = max(d, texelFetch(depth, p, 0).x);
+		}
+	}
+	max_depth = d;
+}
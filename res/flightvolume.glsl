@@ -0,0 +1,105 @@
+#version 330
+
+//Shades the pixels inside light light_index's volume with just that light,
+//the results of each light are added together by blending
+
+uniform sampler2D diffuse;
+uniform sampler2D normal;
+uniform sampler2D depth;
+
+//Camera and light data shared by all programs, see FrameUniforms
+layout(std140) uniform Frame {
+	mat4 proj;
+	mat4 view;
+	mat4 inv_proj;
+	mat4 inv_view;
+	vec4 light_dir;
+	vec4 view_pos;
+	vec4 render_scale;
+};
+
+//The point and spot lights, see LightGrid
+uniform samplerBuffer lights;
+uniform int light_index;
+
+out vec4 color;
+
+//Linearize the depth value passed in
+float linearize(float d){
+	return (2.f * d - gl_DepthRange.near - gl_DepthRange.far)
+		/ (gl_DepthRange.far - gl_DepthRange.near);
+}
+/*
+ * Reconstruct the view-space position of the pixel at uv in the G-buffer
+ * and ndc_uv in the render rect
+ */
+vec4 compute_view_pos(vec2 uv, vec2 ndc_uv){
+	float z = linearize(texture(depth, uv).x);
+	vec4 pos = vec4(ndc_uv * 2.f - 1.f, z, 1.f);
+	pos = inv_proj * pos;
+	return pos / pos.w;
+}
+#ifdef OCT_NORMALS
+vec2 oct_wrap(vec2 v){
+	return (1.f - abs(v.yx)) * vec2(v.x >= 0.f ? 1.f : -1.f, v.y >= 0.f ? 1.f : -1.f);
+}
+/*
+ * Decode an octahedral encoded normal, see fshader
+ */
+vec3 decode_normal(vec2 e){
+	e = e * 2.f - 1.f;
+	vec3 n = vec3(e, 1.f - abs(e.x) - abs(e.y));
+	if (n.z < 0.f){
+		n.xy = oct_wrap(n.xy);
+	}
+	return normalize(n);
+}
+#endif
+#ifdef PACKED_MATERIAL
+/*
+ * Unpack the specular strength and shininess packed 4 bits each into a
+ * channel, see fshader
+ */
+vec2 unpack_material(float m){
+	float bits = floor(m * 255.f + 0.5f);
+	float s = floor(bits / 16.f);
+	float g = bits - s * 16.f;
+	return vec2(s / 15.f, 1.f + g / 15.f * 127.f);
+}
+#endif
+
+void main(void){
+	//The volume is drawn over the G-buffer's render rect, so we find the uv
+	//from the pixel position
+	vec2 uv = gl_FragCoord.xy / vec2(textureSize(depth, 0));
+	vec3 pos = (inv_view * compute_view_pos(uv, gl_FragCoord.xy / render_scale.zw)).xyz;
+#ifdef OCT_NORMALS
+	vec3 n = decode_normal(texture(normal, uv).xy);
+#else
+	vec3 n = normalize(texture(normal, uv).xyz * 2.f - 1.f);
+#endif
+	vec4 albedo = texture(diffuse, uv);
+#ifdef PACKED_MATERIAL
+	vec2 material = unpack_material(albedo.a);
+#else
+	vec2 material = vec2(0.4f, 50.f);
+#endif
+	vec3 v = normalize(view_pos.xyz - pos);
+
+	vec4 pos_radius = texelFetch(lights, 3 * light_index);
+	vec4 color_inner = texelFetch(lights, 3 * light_index + 1);
+	vec4 dir_outer = texelFetch(lights, 3 * light_index + 2);
+	vec3 l = pos_radius.xyz - pos;
+	float d = length(l);
+	l /= d;
+	//Fall off smoothly to nothing at the light's radius
+	float x = min(d / pos_radius.w, 1.f);
+	float falloff = (1.f - x * x) * (1.f - x * x);
+	//Point lights have a cos outer of -1 and no cone
+	if (dir_outer.w > -1.f){
+		falloff *= smoothstep(dir_outer.w, color_inner.w, dot(-l, dir_outer.xyz));
+	}
+	float diff = max(0.f, dot(n, l));
+	float spec = diff > 0.f ? pow(max(0.f, dot(n, normalize(l + v))), material.y) : 0.f;
+	color = vec4(color_inner.rgb * falloff * (albedo.rgb * diff + material.x * spec), 1.f);
+}
@@ -3,12 +3,38 @@
 uniform sampler2D diffuse;
 uniform sampler2D normal;
 uniform sampler2D depth;
-uniform sampler2DShadow shadow_map;
-uniform mat4 inv_proj;
-uniform mat4 inv_view;
-uniform mat4 light_vp;
-uniform vec4 light_dir;
-uniform vec4 view_pos;
+//One layer per shadow cascade, see ShadowCascades
+uniform sampler2DArrayShadow shadow_map;
+#ifdef SHADOW_LAYERS
+//The casters that have moved are kept in their own shadow cascades
+uniform sampler2DArrayShadow dynamic_shadow_map;
+#endif
+//The point and spot lights and the lists of lights reaching each screen
+//tile, see LightGrid
+uniform samplerBuffer lights;
+uniform usamplerBuffer light_tiles;
+uniform usamplerBuffer light_indices;
+uniform int tiles_x;
+const int TILE_SIZE = 16;
+
+//Camera and light data shared by all programs, see FrameUniforms
+layout(std140) uniform Frame {
+	mat4 proj;
+	mat4 view;
+	mat4 inv_proj;
+	mat4 inv_view;
+	vec4 light_dir;
+	vec4 view_pos;
+	vec4 render_scale;
+};
+
+//The light's matrix for each cascade and the far view space distance each
+//cascade reaches, -1 for unused cascades
+const int MAX_CASCADES = 4;
+layout(std140) uniform Cascades {
+	mat4 cascade_vp[MAX_CASCADES];
+	vec4 cascade_splits;
+};
 
 in vec2 f_uv;
 
@@ -21,22 +47,125 @@ float linearize(float d){
 }
 /*
  * Reconstruct the view-space position, this relies on the fact that
- * the second pass draws the quad over the entire screen so the
+ * the second pass draws the quad over the entire render rect so the
  * uv coords map to our NDC coords
  */
-vec4 compute_view_pos(void){
-	float z = linearize(texture(depth, f_uv).x);
+vec4 compute_view_pos(vec2 uv){
+	float z = linearize(texture(depth, uv).x);
 	vec4 pos = vec4(f_uv * 2.f - 1.f, z, 1.f);
 	pos = inv_proj * pos;
 	return pos / pos.w;
 }
 
+#ifdef OCT_NORMALS
+vec2 oct_wrap(vec2 v){
+	return (1.f - abs(v.yx)) * vec2(v.x >= 0.f ? 1.f : -1.f, v.y >= 0.f ? 1.f : -1.f);
+}
+/*
+ * Decode an octahedral encoded normal, see fshader
+ */
+vec3 decode_normal(vec2 e){
+	e = e * 2.f - 1.f;
+	vec3 n = vec3(e, 1.f - abs(e.x) - abs(e.y));
+	if (n.z < 0.f){
+		n.xy = oct_wrap(n.xy);
+	}
+	return normalize(n);
+}
+#endif
+#ifdef PACKED_MATERIAL
+/*
+ * Unpack the specular strength and shininess packed 4 bits each into a
+ * channel, see fshader
+ */
+vec2 unpack_material(float m){
+	float bits = floor(m * 255.f + 0.5f);
+	float s = floor(bits / 16.f);
+	float g = bits - s * 16.f;
+	return vec2(s / 15.f, 1.f + g / 15.f * 127.f);
+}
+#endif
+
+/*
+ * Add the light from light i reaching the surface at pos with normal n
+ * viewed along v to the scattered and reflected light, material is the
+ * surface's specular strength and shininess
+ */
+void shade_light(int i, vec3 pos, vec3 n, vec3 v, vec2 material, inout vec3 scattered,
+	inout vec3 reflected)
+{
+	vec4 pos_radius = texelFetch(lights, 3 * i);
+	vec4 color_inner = texelFetch(lights, 3 * i + 1);
+	vec4 dir_outer = texelFetch(lights, 3 * i + 2);
+	vec3 l = pos_radius.xyz - pos;
+	float d = length(l);
+	if (d >= pos_radius.w){
+		return;
+	}
+	l /= d;
+	//Fall off smoothly to nothing at the light's radius
+	float x = d / pos_radius.w;
+	float falloff = (1.f - x * x) * (1.f - x * x);
+	//Point lights have a cos outer of -1 and no cone
+	if (dir_outer.w > -1.f){
+		falloff *= smoothstep(dir_outer.w, color_inner.w, dot(-l, dir_outer.xyz));
+	}
+	float diff = max(0.f, dot(n, l));
+	if (diff == 0.f){
+		return;
+	}
+	float spec = pow(max(0.f, dot(n, normalize(l + v))), material.y);
+	scattered += color_inner.rgb * falloff * diff;
+	reflected += color_inner.rgb * falloff * spec * material.x;
+}
+
+/*
+ * Find how much of the directional light reaches the point at world_pos
+ * depth units in front of the camera, beyond the last cascade nothing is
+ * shadowed
+ */
+float shadow_factor(vec4 world_pos, float depth){
+	int cascade = 0;
+	for (int c = 0; c < MAX_CASCADES - 1; ++c){
+		if (cascade_splits[c + 1] > 0.f && depth > cascade_splits[c]){
+			cascade = c + 1;
+		}
+	}
+	if (depth > cascade_splits[cascade]){
+		return 1.f;
+	}
+	//The cascades are orthographic so there's no perspective division, just
+	//scale into texture space
+	vec3 shadow_pos = (cascade_vp[cascade] * world_pos).xyz * 0.5f + 0.5f;
+	vec4 coord = vec4(shadow_pos.xy, float(cascade), shadow_pos.z);
+	float f = texture(shadow_map, coord);
+#ifdef SHADOW_LAYERS
+	f = min(f, texture(dynamic_shadow_map, coord));
+#endif
+	return f;
+}
+
 void main(void){
-	vec4 world_pos = inv_view * compute_view_pos();
-	vec4 n = texture(normal, f_uv);
+	//The G-buffer is only drawn to in the render rect's part of its targets
+	vec2 uv = f_uv * render_scale.xy;
+	vec4 pos_view = compute_view_pos(uv);
+	vec4 world_pos = inv_view * pos_view;
+	vec4 albedo = texture(diffuse, uv);
+#ifdef OCT_NORMALS
+	vec4 n = vec4(decode_normal(texture(normal, uv).xy), 0.f);
+#else
+	vec4 n = texture(normal, uv);
 	n = n * 2.f - 1.f;
 	n.w = 0.f;
 	n = normalize(n);
+#endif
+#ifdef PACKED_MATERIAL
+	vec2 material = unpack_material(albedo.a);
+	albedo.a = 1.f;
+#else
+	//Without the packed material everyone gets the same specular
+	vec2 material = vec2(0.4f, 50.f);
+#endif
 	vec4 v = normalize(view_pos - world_pos);
 	vec4 half_vect = normalize(light_dir + v);
 
@@ -46,22 +175,31 @@ void main(void){
 		spec = 0.f;
 	}
 	else {
-		//Just give everyone 50 shininess
-		spec = pow(spec, 50.f);
+		spec = pow(spec, material.y);
 	}
 	//Check if we're in shadow
-	vec4 shadow_pos = light_vp * world_pos;
-	//Not needed for directional light but we do need to do the perspective
-	//division for point lights (perspective proj.)
-	shadow_pos /= shadow_pos.w;
-	//Scale the depth values into projection space
-	shadow_pos = (shadow_pos + 1.f) / 2.f;
-	float f = textureProj(shadow_map, shadow_pos);
+	float f = shadow_factor(world_pos, -pos_view.z);
 	//Apply some ambient as well and set light color to white
 	//with a rather low strength
 	vec3 scattered = vec3(0.2f, 0.2f, 0.2f) + f * diff;
-	vec3 reflected = f * vec3(1.f * spec * 0.4f);
-	color = texture(diffuse, f_uv);
+	vec3 reflected = f * vec3(1.f * spec * material.x);
+#if defined(UNTILED_LIGHTS)
+	//Shade with every light, for comparing against the tiled lists
+	int count = textureSize(lights) / 3;
+	for (int i = 0; i < count; ++i){
+		shade_light(i, world_pos.xyz, n.xyz, v.xyz, material, scattered, reflected);
+	}
+#elif !defined(NO_LIGHT_LIST)
+	//Only the lights binned to this pixel's tile can reach it, with
+	//NO_LIGHT_LIST the lights are drawn as light volumes instead
+	ivec2 tile = ivec2(gl_FragCoord.xy) / TILE_SIZE;
+	uvec2 range = texelFetch(light_tiles, tile.y * tiles_x + tile.x).xy;
+	for (uint j = 0u; j < range.y; ++j){
+		int i = int(texelFetch(light_indices, int(range.x + j)).x);
+		shade_light(i, world_pos.xyz, n.xyz, v.xyz, material, scattered, reflected);
+	}
+#endif
+	color = albedo;
 	color.xyz = min(color.xyz * scattered + reflected, vec3(1.f));
 }
 
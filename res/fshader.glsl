@@ -6,11 +6,52 @@ in vec4 f_normal;
 in vec2 f_uv;
 
 layout(location = 0) out vec4 diffuse;
+#ifdef OCT_NORMALS
+layout(location = 1) out vec2 normal;
+#else
 layout(location = 1) out vec4 normal;
+#endif
+
+#ifdef PACKED_MATERIAL
+//Specular strength and shininess of the model, see Model::setMaterial
+uniform vec2 material;
+#endif
+
+#ifdef OCT_NORMALS
+vec2 oct_wrap(vec2 v){
+	return (1.f - abs(v.yx)) * vec2(v.x >= 0.f ? 1.f : -1.f, v.y >= 0.f ? 1.f : -1.f);
+}
+/*
+ * Octahedral encode the unit vector n into [0, 1]^2, the sphere is projected
+ * onto an octahedron which is unfolded onto a square
+ */
+vec2 encode_normal(vec3 n){
+	n /= abs(n.x) + abs(n.y) + abs(n.z);
+	vec2 e = n.z >= 0.f ? n.xy : oct_wrap(n.xy);
+	return e * 0.5f + 0.5f;
+}
+#endif
+#ifdef PACKED_MATERIAL
+/*
+ * Pack specular strength in [0, 1] and shininess in [1, 128] into 4 bits each
+ * of one 8bit channel
+ */
+float pack_material(float specular, float shininess){
+	float s = floor(clamp(specular, 0.f, 1.f) * 15.f + 0.5f);
+	float g = floor(clamp((shininess - 1.f) / 127.f, 0.f, 1.f) * 15.f + 0.5f);
+	return (s * 16.f + g) / 255.f;
+}
+#endif
 
 void main(void){
 	diffuse = texture(tex_diffuse, f_uv);
+#ifdef PACKED_MATERIAL
+	diffuse.a = pack_material(material.x, material.y);
+#endif
+#ifdef OCT_NORMALS
+	normal = encode_normal(normalize(f_normal.xyz));
+#else
 	normal = (f_normal + 1.f) / 2.f;
 	normal.w = 0.f;
+#endif
 }
-
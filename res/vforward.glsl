@@ -4,7 +4,9 @@
 //output some debug textures to the screen, it's expected these
 //are being drawn to the NDC, perhaps with some scaling/translation
 
-uniform mat4 model;
+//Model matrices of all objects as 4 RGBA32F texels each, see transforms.h
+uniform samplerBuffer transforms;
+uniform int transform_index;
 
 layout(location = 0) in vec3 position;
 layout(location = 2) in vec2 uv;
@@ -12,6 +14,10 @@ layout(location = 2) in vec2 uv;
 out vec2 f_uv;
 
 void main(void){
+	mat4 model = mat4(texelFetch(transforms, transform_index * 4),
+		texelFetch(transforms, transform_index * 4 + 1),
+		texelFetch(transforms, transform_index * 4 + 2),
+		texelFetch(transforms, transform_index * 4 + 3));
 	gl_Position = model * vec4(position, 1.f);
 	f_uv = uv;
 }
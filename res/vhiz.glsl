@@ -0,0 +1,8 @@
+#version 330
+
+//Draws a triangle covering the screen from gl_VertexID alone, so the
+//depth reduction needs no vertex buffers
+void main(void){
+	vec2 pos = vec2((gl_VertexID & 1) * 4.f - 1.f, (gl_VertexID & 2) * 2.f - 1.f);
+	gl_Position = vec4(pos, 0.f, 1.f);
+}
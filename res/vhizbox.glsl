@@ -0,0 +1,26 @@
+#version 330
+
+//Draws the world space box from lo to hi as a triangle strip of 14 vertices
+//made from gl_VertexID alone, for HiZ to test the boxes of occluded objects
+//against the depth buffer
+
+//Camera and light data shared by all programs, see FrameUniforms
+layout(std140) uniform Frame {
+	mat4 proj;
+	mat4 view;
+	mat4 inv_proj;
+	mat4 inv_view;
+	vec4 light_dir;
+	vec4 view_pos;
+	vec4 render_scale;
+};
+
+uniform vec3 lo;
+uniform vec3 hi;
+
+void main(void){
+	//Each mask holds one axis of the strip's corners, a bit per vertex
+	int b = 1 << gl_VertexID;
+	vec3 corner = vec3((0x287a & b) != 0, (0x02af & b) != 0, (0x31e3 & b) != 0);
+	gl_Position = proj * view * vec4(mix(lo, hi, corner), 1.f);
+}
@@ -0,0 +1,39 @@
+#version 330
+
+//Places the unit sphere or cone light volume around light light_index, the
+//light's position, radius and cone are read from the lights buffer texture
+//see LightGrid. Built with SPOT for the cone volumes of spot lights
+
+layout(location = 0) in vec3 position;
+
+//Camera and light data shared by all programs, see FrameUniforms
+layout(std140) uniform Frame {
+	mat4 proj;
+	mat4 view;
+	mat4 inv_proj;
+	mat4 inv_view;
+	vec4 light_dir;
+	vec4 view_pos;
+	vec4 render_scale;
+};
+
+uniform samplerBuffer lights;
+uniform int light_index;
+
+void main(void){
+	vec4 pos_radius = texelFetch(lights, 3 * light_index);
+#ifdef SPOT
+	vec4 dir_outer = texelFetch(lights, 3 * light_index + 2);
+	//The cone points down -z with its base at z = -1, stretch it out along the
+	//light's direction to its radius and widen the base to the outer angle
+	vec3 w = dir_outer.xyz;
+	vec3 u = normalize(cross(abs(w.y) < 0.99f ? vec3(0.f, 1.f, 0.f) : vec3(1.f, 0.f, 0.f), w));
+	vec3 v = cross(w, u);
+	float tan_outer = sqrt(1.f - dir_outer.w * dir_outer.w) / dir_outer.w;
+	vec3 world = pos_radius.xyz + pos_radius.w * (tan_outer * (position.x * u + position.y * v)
+		- position.z * w);
+#else
+	vec3 world = pos_radius.xyz + pos_radius.w * position;
+#endif
+	gl_Position = proj * view * vec4(world, 1.f);
+}
@@ -1,13 +1,52 @@
 #version 330
 
+#ifdef MULTI_DRAW
+#extension GL_ARB_shader_draw_parameters : require
+#endif
+
 //A simple shader for rendering shadow maps
 
-uniform mat4 view_proj;
-uniform mat4 model;
+#ifdef INSTANCED
+//Each instance's model matrix comes from the instance VBO, see InstancedModel
+layout(location = 3) in mat4 model;
+#else
+//Model matrices of all objects as 4 RGBA32F texels each, see transforms.h
+uniform samplerBuffer transforms;
+#ifdef MULTI_DRAW
+//Each draw of a multi-draw batch finds its transform index by its draw id.
+//MAX_BATCH is defined to RenderQueue::MAX_BATCH when the program is built
+uniform int draw_transforms[MAX_BATCH];
+#define transform_index draw_transforms[gl_DrawIDARB]
+#else
+uniform int transform_index;
+#endif
+#endif
+
+//Camera and light data shared by all programs, see FrameUniforms
+layout(std140) uniform Frame {
+	mat4 proj;
+	mat4 view;
+	mat4 inv_proj;
+	mat4 inv_view;
+	vec4 light_dir;
+	vec4 view_pos;
+	vec4 render_scale;
+};
+
+//The matrix of the shadow cascade being drawn, see ShadowCascades
+layout(std140) uniform ShadowPass {
+	mat4 pass_vp;
+};
 
 layout(location = 0) in vec3 position;
 
 void main(void){
-	gl_Position = view_proj * model * vec4(position, 1.f);
+#ifndef INSTANCED
+	mat4 model = mat4(texelFetch(transforms, transform_index * 4),
+		texelFetch(transforms, transform_index * 4 + 1),
+		texelFetch(transforms, transform_index * 4 + 2),
+		texelFetch(transforms, transform_index * 4 + 3));
+#endif
+	gl_Position = pass_vp * model * vec4(position, 1.f);
 }
 
@@ -0,0 +1,77 @@
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include "benchstats.h"
+
+BenchStats::BenchStats(const std::vector<std::string> &passes, size_t warmup)
+	: passes(passes), warmup(warmup), warmed(0), samples(passes.size() + 1)
+{}
+const std::vector<std::string>& BenchStats::passNames() const {
+	return passes;
+}
+void BenchStats::endFrame(double frameMs, const std::vector<double> &passMs){
+	if (warmed < warmup){
+		++warmed;
+		return;
+	}
+	for (size_t i = 0; i < passes.size(); ++i){
+		samples[i].push_back(i < passMs.size() ? passMs[i] : 0.0);
+	}
+	samples.back().push_back(frameMs);
+}
+bool BenchStats::warmingUp() const {
+	return warmed < warmup;
+}
+size_t BenchStats::frames() const {
+	return samples.back().size();
+}
+bool BenchStats::writeJson(const std::string &file, int width, int height) const {
+	std::ostringstream json;
+	json << "{\n\t\"frames\": " << frames() << ",\n\t\"warmup\": " << warmup
+		<< ",\n\t\"width\": " << width
+		<< ",\n\t\"height\": " << height << ",\n\t\"units\": \"ms\",\n\t\"passes\": {";
+	for (size_t i = 0; i <= passes.size(); ++i){
+		const Summary s = summarize(samples[i]);
+		std::ostringstream entry;
+		entry << "{ \"mean\": " << s.mean << ", \"p50\": " << s.p50 << ", \"p95\": " << s.p95
+			<< ", \"p99\": " << s.p99 << " }";
+		if (i < passes.size()){
+			json << (i == 0 ? "\n" : ",\n") << "\t\t\"" << passes[i] << "\": " << entry.str();
+		}
+		else {
+			json << "\n\t},\n\t\"frame\": " << entry.str() << "\n}\n";
+		}
+	}
+	if (file.empty()){
+		std::cout << json.str();
+		return true;
+	}
+	std::ofstream out(file, std::ios::trunc);
+	out << json.str();
+	if (!out){
+		std::cerr << "BenchStats: Failed to write " << file << "\n";
+		return false;
+	}
+	return true;
+}
+BenchStats::Summary BenchStats::summarize(std::vector<double> samples){
+	Summary s = { 0.0, 0.0, 0.0, 0.0 };
+	if (samples.empty()){
+		return s;
+	}
+	std::sort(samples.begin(), samples.end());
+	for (double x : samples){
+		s.mean += x;
+	}
+	s.mean /= samples.size();
+	//Nearest rank percentiles
+	const double pcts[3] = { 50.0, 95.0, 99.0 };
+	double *outs[3] = { &s.p50, &s.p95, &s.p99 };
+	for (int p = 0; p < 3; ++p){
+		size_t rank = static_cast<size_t>(std::ceil(pcts[p] / 100.0 * samples.size()));
+		*outs[p] = samples[std::max(rank, static_cast<size_t>(1)) - 1];
+	}
+	return s;
+}
@@ -0,0 +1,136 @@
+#include <vector>
+#include <algorithm>
+#include <glm/glm.hpp>
+#include "frustum.h"
+#include "bvh.h"
+
+void Bvh::build(const std::vector<glm::vec3> &lo, const std::vector<glm::vec3> &hi){
+	nodes.clear();
+	leaves.assign(lo.size(), -1);
+	if (lo.empty()){
+		return;
+	}
+	nodes.reserve(lo.size() * 2 - 1);
+	std::vector<size_t> order(lo.size());
+	for (size_t i = 0; i < order.size(); ++i){
+		order[i] = i;
+	}
+	build(order, 0, order.size(), -1, lo, hi);
+}
+void Bvh::update(size_t object, const glm::vec3 &lo, const glm::vec3 &hi){
+	int n = leaves[object];
+	nodes[n].lo = lo;
+	nodes[n].hi = hi;
+	//Refit up the tree, stopping once a node's box doesn't change
+	for (n = nodes[n].parent; n != -1; n = nodes[n].parent){
+		Node &node = nodes[n];
+		glm::vec3 newLo = glm::min(nodes[node.left].lo, nodes[node.right].lo);
+		glm::vec3 newHi = glm::max(nodes[node.left].hi, nodes[node.right].hi);
+		if (newLo == node.lo && newHi == node.hi){
+			break;
+		}
+		node.lo = newLo;
+		node.hi = newHi;
+	}
+}
+Bvh::CullStats Bvh::cull(const Frustum &frustum, std::vector<size_t> &visible) const {
+	CullStats stats = { 0, 0, 0, 0 };
+	visible.clear();
+	if (nodes.empty()){
+		return stats;
+	}
+	stack.clear();
+	stack.push_back(0);
+	while (!stack.empty()){
+		const int n = stack.back();
+		stack.pop_back();
+		const Node &node = nodes[n];
+		const bool leaf = node.left == -1;
+		++stats.nodesTested;
+		if (leaf){
+			++stats.objectsTested;
+		}
+		switch (frustum.test(node.lo, node.hi)){
+		case Frustum::OUTSIDE:
+			stats.culled += node.count;
+			break;
+		case Frustum::INSIDE:
+			addAll(n, visible);
+			stats.drawn += node.count;
+			break;
+		default:
+			if (leaf){
+				visible.push_back(node.object);
+				++stats.drawn;
+			}
+			else {
+				stack.push_back(node.right);
+				stack.push_back(node.left);
+			}
+		}
+	}
+	return stats;
+}
+void Bvh::bounds(size_t object, glm::vec3 &lo, glm::vec3 &hi) const {
+	const Node &n = nodes[leaves[object]];
+	lo = n.lo;
+	hi = n.hi;
+}
+size_t Bvh::size() const {
+	return leaves.size();
+}
+int Bvh::build(std::vector<size_t> &order, size_t first, size_t last, int parent,
+	const std::vector<glm::vec3> &lo, const std::vector<glm::vec3> &hi)
+{
+	const int n = nodes.size();
+	nodes.push_back(Node());
+	nodes[n].parent = parent;
+	nodes[n].left = nodes[n].right = -1;
+	nodes[n].object = 0;
+	nodes[n].count = last - first;
+	if (last - first == 1){
+		nodes[n].object = order[first];
+		nodes[n].lo = lo[order[first]];
+		nodes[n].hi = hi[order[first]];
+		leaves[order[first]] = n;
+		return n;
+	}
+	//Split at the median along the longest axis of the box centers
+	glm::vec3 cLo = lo[order[first]] + hi[order[first]], cHi = cLo;
+	for (size_t i = first; i < last; ++i){
+		glm::vec3 c = lo[order[i]] + hi[order[i]];
+		cLo = glm::min(cLo, c);
+		cHi = glm::max(cHi, c);
+	}
+	glm::vec3 size = cHi - cLo;
+	int axis = size.x > size.y ? (size.x > size.z ? 0 : 2) : (size.y > size.z ? 1 : 2);
+	const size_t mid = first + (last - first) / 2;
+	std::nth_element(order.begin() + first, order.begin() + mid, order.begin() + last,
+		[&](size_t a, size_t b){
+			return lo[a][axis] + hi[a][axis] < lo[b][axis] + hi[b][axis];
+		});
+	int left = build(order, first, mid, n, lo, hi);
+	int right = build(order, mid, last, n, lo, hi);
+	Node &node = nodes[n];
+	node.left = left;
+	node.right = right;
+	node.lo = glm::min(nodes[left].lo, nodes[right].lo);
+	node.hi = glm::max(nodes[left].hi, nodes[right].hi);
+	return n;
+}
+void Bvh::addAll(int node, std::vector<size_t> &visible) const {
+	//Use our own stack so we don't disturb the one cull is using
+	subtree.clear();
+	subtree.push_back(node);
+	while (!subtree.empty()){
+		const Node &n = nodes[subtree.back()];
+		subtree.pop_back();
+		if (n.left == -1){
+			visible.push_back(n.object);
+		}
+		else {
+			subtree.push_back(n.left);
+			subtree.push_back(n.right);
+		}
+	}
+}
@@ -0,0 +1,143 @@
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include "dynamicresolution.h"
+
+//Frame times between this fraction of the budget and the budget leave the
+//resolution alone, so it doesn't hunt back and forth around the budget
+const float LOWER_BAND = 0.85f;
+//Most the scale can change by in one frame
+const float MAX_STEP = 0.1f;
+
+DynamicResolution::DynamicResolution(int width, int height, GLenum depthStencilFormat,
+	float budgetMs, float minScale)
+	: width(width), height(height), renderW(width), renderH(height), scale(1.f),
+	minScale(glm::clamp(minScale, 0.1f, 1.f)), budget(budgetMs / 1000.f), fbo(0), colorTex(0),
+	depthStencil(0), depthStencilFormat(depthStencilFormat)
+{
+	glGenTextures(1, &colorTex);
+	if (depthStencilFormat != GL_NONE){
+		glGenRenderbuffers(1, &depthStencil);
+	}
+	allocate();
+	glGenFramebuffers(1, &fbo);
+	glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, colorTex, 0);
+	if (depthStencil != 0){
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER,
+			depthStencil);
+	}
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+DynamicResolution::~DynamicResolution(){
+	glDeleteFramebuffers(1, &fbo);
+	glDeleteTextures(1, &colorTex);
+	if (depthStencil != 0){
+		glDeleteRenderbuffers(1, &depthStencil);
+	}
+}
+bool DynamicResolution::ready() const {
+	glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+	GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	if (status != GL_FRAMEBUFFER_COMPLETE){
+		std::cerr << "DynamicResolution: Lighting framebuffer incomplete: " << status << "\n";
+		return false;
+	}
+	return true;
+}
+void DynamicResolution::resize(int w, int h){
+	width = w;
+	height = h;
+	allocate();
+	fitRect();
+}
+bool DynamicResolution::update(float frameTime){
+	if (budget <= 0.f || frameTime <= 0.f){
+		return false;
+	}
+	if (frameTime <= budget && frameTime >= budget * LOWER_BAND){
+		return false;
+	}
+	//The scaled passes cost about the number of pixels drawn, so each side
+	//goes with the square root of how far off the budget we are
+	float target = scale * std::sqrt(budget / frameTime);
+	target = glm::clamp(target, scale * (1.f - MAX_STEP), scale * (1.f + MAX_STEP));
+	scale = glm::clamp(target, minScale, 1.f);
+	const int prevW = renderW, prevH = renderH;
+	fitRect();
+	return renderW != prevW || renderH != prevH;
+}
+int DynamicResolution::renderWidth() const {
+	return renderW;
+}
+int DynamicResolution::renderHeight() const {
+	return renderH;
+}
+float DynamicResolution::renderScale() const {
+	return scale;
+}
+glm::mat4 DynamicResolution::targetProjection() const {
+	//The render rect sits in the bottom left, so scale clip space about the
+	//targets' bottom left corner
+	const float sx = renderW / static_cast<float>(width);
+	const float sy = renderH / static_cast<float>(height);
+	glm::mat4 m(1.f);
+	m[0][0] = sx;
+	m[1][1] = sy;
+	m[3][0] = sx - 1.f;
+	m[3][1] = sy - 1.f;
+	return m;
+}
+glm::vec4 DynamicResolution::frameScale() const {
+	return glm::vec4(renderW / static_cast<float>(width), renderH / static_cast<float>(height),
+		renderW, renderH);
+}
+void DynamicResolution::viewport() const {
+	glViewport(0, 0, renderW, renderH);
+}
+void DynamicResolution::begin(GLuint depthFbo) const {
+	glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+	glClear(GL_COLOR_BUFFER_BIT);
+	if (depthFbo != 0 && depthStencil != 0){
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, depthFbo);
+		glBlitFramebuffer(0, 0, renderW, renderH, 0, 0, renderW, renderH, GL_DEPTH_BUFFER_BIT,
+			GL_NEAREST);
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, fbo);
+	}
+	viewport();
+}
+void DynamicResolution::resolve() const {
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, fbo);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+	const GLenum filter = renderW == width && renderH == height ? GL_NEAREST : GL_LINEAR;
+	glBlitFramebuffer(0, 0, renderW, renderH, 0, 0, width, height, GL_COLOR_BUFFER_BIT, filter);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glViewport(0, 0, width, height);
+}
+void DynamicResolution::allocate(){
+	//Unit 0 holds the G-buffer's diffuse texture, put it back once we're done
+	GLint prevTex = 0;
+	glActiveTexture(GL_TEXTURE0);
+	glGetIntegerv(GL_TEXTURE_BINDING_2D, &prevTex);
+	glBindTexture(GL_TEXTURE_2D, colorTex);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glBindTexture(GL_TEXTURE_2D, prevTex);
+
+	if (depthStencil != 0){
+		glBindRenderbuffer(GL_RENDERBUFFER, depthStencil);
+		glRenderbufferStorage(GL_RENDERBUFFER, depthStencilFormat, width, height);
+		glBindRenderbuffer(GL_RENDERBUFFER, 0);
+	}
+}
+void DynamicResolution::fitRect(){
+	renderW = static_cast<int>(std::floor(width * scale / GRANULARITY + 0.5f)) * GRANULARITY;
+	renderH = static_cast<int>(std::floor(height * scale / GRANULARITY + 0.5f)) * GRANULARITY;
+	renderW = std::max(std::min(renderW, width), std::min(GRANULARITY, width));
+	renderH = std::max(std::min(renderH, height), std::min(GRANULARITY, height));
+}
@@ -0,0 +1,24 @@
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include "frameuniforms.h"
+
+FrameUniforms::FrameUniforms() : ubo(0){
+	glGenBuffers(1, &ubo);
+	glBindBuffer(GL_UNIFORM_BUFFER, ubo);
+	glBufferData(GL_UNIFORM_BUFFER, sizeof(Data), NULL, GL_STREAM_DRAW);
+	glBindBufferBase(GL_UNIFORM_BUFFER, BINDING, ubo);
+}
+FrameUniforms::~FrameUniforms(){
+	glDeleteBuffers(1, &ubo);
+}
+void FrameUniforms::update(const Data &data){
+	glBindBuffer(GL_UNIFORM_BUFFER, ubo);
+	glBufferData(GL_UNIFORM_BUFFER, sizeof(Data), NULL, GL_STREAM_DRAW);
+	glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(Data), &data);
+}
+void FrameUniforms::bindBlock(GLuint program){
+	GLuint block = glGetUniformBlockIndex(program, "Frame");
+	if (block != GL_INVALID_INDEX){
+		glUniformBlockBinding(program, block, BINDING);
+	}
+}
@@ -0,0 +1,45 @@
+#include <cmath>
+#include <glm/glm.hpp>
+#include "frustum.h"
+
+Frustum::Frustum(const glm::mat4 &viewProj){
+	//glm is column major so row i is (m[0][i], m[1][i], m[2][i], m[3][i])
+	glm::vec4 rows[4];
+	for (int i = 0; i < 4; ++i){
+		rows[i] = glm::vec4(viewProj[0][i], viewProj[1][i], viewProj[2][i], viewProj[3][i]);
+	}
+	for (int i = 0; i < 3; ++i){
+		planes[i * 2] = rows[3] + rows[i];
+		planes[i * 2 + 1] = rows[3] - rows[i];
+	}
+}
+Frustum::Result Frustum::test(const glm::vec3 &lo, const glm::vec3 &hi) const {
+	Result result = INSIDE;
+	for (const glm::vec4 &p : planes){
+		//The corners furthest along and furthest against the plane's normal
+		glm::vec3 far(p.x > 0.f ? hi.x : lo.x, p.y > 0.f ? hi.y : lo.y, p.z > 0.f ? hi.z : lo.z);
+		glm::vec3 near(p.x > 0.f ? lo.x : hi.x, p.y > 0.f ? lo.y : hi.y, p.z > 0.f ? lo.z : hi.z);
+		if (glm::dot(glm::vec3(p), far) + p.w < 0.f){
+			return OUTSIDE;
+		}
+		if (glm::dot(glm::vec3(p), near) + p.w < 0.f){
+			result = INTERSECTS;
+		}
+	}
+	return result;
+}
+void transformBounds(const glm::mat4 &m, const glm::vec3 &lo, const glm::vec3 &hi,
+	glm::vec3 &outLo, glm::vec3 &outHi)
+{
+	const glm::vec3 center = (lo + hi) / 2.f;
+	const glm::vec3 extent = (hi - lo) / 2.f;
+	glm::vec3 c(m[3]), e(0.f);
+	for (int col = 0; col < 3; ++col){
+		for (int row = 0; row < 3; ++row){
+			c[row] += m[col][row] * center[col];
+			e[row] += std::abs(m[col][row]) * extent[col];
+		}
+	}
+	outLo = c - e;
+	outHi = c + e;
+}
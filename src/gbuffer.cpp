@@ -0,0 +1,159 @@
+#include <iostream>
+#include <GL/glew.h>
+#include "gbuffer.h"
+
+//Frame rate the bandwidth estimate is given at
+const double ESTIMATE_FPS = 60.0;
+//Bytes per pixel of the G-buffer before the layouts were added: RGB8 diffuse
+//and normals padded to 4 bytes each and 32bit depth with no stencil
+const size_t ORIGINAL_BYTES = 12;
+
+GBuffer::GBuffer(int width, int height, Normals normals, Depth depth)
+	: width(width), height(height), normals(normals), depth(depth), fbo(0)
+{
+	glGenFramebuffers(1, &fbo);
+	glGenTextures(TARGET_COUNT, textures);
+	allocate();
+	glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+	for (int i = 0; i < 2; ++i){
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + i, GL_TEXTURE_2D,
+			textures[i], 0);
+	}
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_TEXTURE_2D,
+		textures[DEPTH_STENCIL], 0);
+	GLenum drawBuffers[2] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+	glDrawBuffers(2, drawBuffers);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+GBuffer::~GBuffer(){
+	glDeleteFramebuffers(1, &fbo);
+	glDeleteTextures(TARGET_COUNT, textures);
+}
+bool GBuffer::ready() const {
+	glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+	GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	if (status != GL_FRAMEBUFFER_COMPLETE){
+		std::cerr << "GBuffer: Framebuffer incomplete: " << status << "\n";
+		return false;
+	}
+	return true;
+}
+void GBuffer::resize(int w, int h){
+	width = w;
+	height = h;
+	allocate();
+}
+void GBuffer::allocate(){
+	//The packed layouts keep the material in the diffuse alpha
+	GLenum diffuseFormat = GL_RGBA8, diffuseChannels = GL_RGBA;
+	if (normals == NORMALS_RGB8){
+		diffuseFormat = GL_RGB8;
+		diffuseChannels = GL_RGB;
+	}
+	GLenum normalFormat = GL_RGB8, normalChannels = GL_RGB, normalType = GL_UNSIGNED_BYTE;
+	if (normals == NORMALS_OCT16){
+		normalFormat = GL_RG16;
+		normalChannels = GL_RG;
+		normalType = GL_UNSIGNED_SHORT;
+	}
+	else if (normals == NORMALS_OCT8){
+		normalFormat = GL_RG8;
+		normalChannels = GL_RG;
+	}
+	const GLenum formats[2] = { diffuseFormat, normalFormat };
+	const GLenum channels[2] = { diffuseChannels, normalChannels };
+	const GLenum types[2] = { GL_UNSIGNED_BYTE, normalType };
+	for (int i = 0; i < 2; ++i){
+		glActiveTexture(GL_TEXTURE0 + i);
+		glBindTexture(GL_TEXTURE_2D, textures[i]);
+		glTexImage2D(GL_TEXTURE_2D, 0, formats[i], width, height, 0, channels[i], types[i], NULL);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+		//Filtering would blend the encoded normals and packed material of
+		//neighbouring pixels
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	}
+	glActiveTexture(GL_TEXTURE2);
+	glBindTexture(GL_TEXTURE_2D, textures[DEPTH_STENCIL]);
+	//The stencil is used to mark the pixels inside each light volume
+	if (depth == DEPTH_24){
+		glTexImage2D(GL_TEXTURE_2D, 0, depthStencilFormat(), width, height,
+			0, GL_DEPTH_STENCIL, GL_UNSIGNED_INT_24_8, NULL);
+	}
+	else {
+		glTexImage2D(GL_TEXTURE_2D, 0, depthStencilFormat(), width, height,
+			0, GL_DEPTH_STENCIL, GL_FLOAT_32_UNSIGNED_INT_24_8_REV, NULL);
+	}
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+}
+GLuint GBuffer::framebuffer() const {
+	return fbo;
+}
+GLuint GBuffer::texture(Target target) const {
+	return textures[target];
+}
+GLenum GBuffer::depthStencilFormat() const {
+	return depth == DEPTH_24 ? GL_DEPTH24_STENCIL8 : GL_DEPTH32F_STENCIL8;
+}
+std::string GBuffer::defines() const {
+	return normals == NORMALS_RGB8 ? "" : "#define OCT_NORMALS\n#define PACKED_MATERIAL\n";
+}
+size_t GBuffer::bytesPerPixel(Target target) const {
+	switch (target){
+		case DIFFUSE:
+			return 4;
+		case NORMAL:
+			return normals == NORMALS_OCT8 ? 2 : 4;
+		case DEPTH_STENCIL:
+			//32F depth with 8bit stencil is stored in 64 bits
+			return depth == DEPTH_24 ? 4 : 8;
+		default:
+			return 0;
+	}
+}
+size_t GBuffer::bytesPerPixel() const {
+	return bytesPerPixel(DIFFUSE) + bytesPerPixel(NORMAL) + bytesPerPixel(DEPTH_STENCIL);
+}
+void GBuffer::printStats() const {
+	const char *normalNames[] = { "rgb8", "oct16", "oct8" };
+	//Every pixel is written in the geometry pass and read back at least once
+	//by the deferred pass, overdraw and light volumes only add to this
+	const double frameBytes = 2.0 * bytesPerPixel() * width * height;
+	std::cout << "G-buffer: " << normalNames[normals] << " normals, "
+		<< (depth == DEPTH_24 ? "24bit" : "32bit float") << " depth, "
+		<< bytesPerPixel() << " bytes/pixel (diffuse " << bytesPerPixel(DIFFUSE)
+		<< ", normals " << bytesPerPixel(NORMAL) << ", depth-stencil "
+		<< bytesPerPixel(DEPTH_STENCIL) << "), ~" << frameBytes / (1024.0 * 1024.0)
+		<< "MB written and read per frame, " << frameBytes * ESTIMATE_FPS / (1024.0 * 1024.0)
+		<< "MB/s at " << ESTIMATE_FPS << "fps\n";
+	//The stencil the light volumes need pads 32bit float depth out to 8 bytes,
+	//which outweighs what the smaller normals save. Only 32F depth can get here
+	if (bytesPerPixel() > ORIGINAL_BYTES){
+		std::cout << "G-buffer: " << bytesPerPixel() - ORIGINAL_BYTES
+			<< " bytes/pixel more than the original " << ORIGINAL_BYTES
+			<< " byte layout for the 32bit float depth-stencil, --depth24 trades"
+			<< " depth precision for 4 bytes/pixel less\n";
+	}
+	else {
+		std::cout << "G-buffer: " << ORIGINAL_BYTES - bytesPerPixel()
+			<< " bytes/pixel less than the original " << ORIGINAL_BYTES << " byte layout\n";
+	}
+}
+bool GBuffer::parseNormals(const std::string &name, Normals &normals){
+	if (name == "rgb8"){
+		normals = NORMALS_RGB8;
+	}
+	else if (name == "oct16"){
+		normals = NORMALS_OCT16;
+	}
+	else if (name == "oct8"){
+		normals = NORMALS_OCT8;
+	}
+	else {
+		return false;
+	}
+	return true;
+}
@@ -0,0 +1,277 @@
+#include <algorithm>
+#include <iostream>
+#include <memory>
+#include <vector>
+#include <GL/glew.h>
+#include "util.h"
+#include "geometryarena.h"
+
+namespace {
+	std::vector<std::unique_ptr<GeometryArena>> arenas;
+
+	/*
+	 * Give buf new storage of capacity elements of elemSize bytes holding the
+	 * ranges of elements at starts with the counts passed packed one after
+	 * another, the starts are updated to where the ranges were moved to. The
+	 * ranges are staged in a temporary buffer so buf keeps its name
+	 */
+	void packBuffer(GLuint buf, size_t elemSize, size_t capacity, const std::vector<size_t*> &starts,
+		const std::vector<size_t> &counts)
+	{
+		size_t used = 0;
+		for (size_t c : counts){
+			used += c;
+		}
+		//The copy targets are used so we don't disturb the bound VAO's element buffer
+		GLuint staging = 0;
+		if (used > 0){
+			glGenBuffers(1, &staging);
+			glBindBuffer(GL_COPY_WRITE_BUFFER, staging);
+			glBufferData(GL_COPY_WRITE_BUFFER, used * elemSize, NULL, GL_STREAM_COPY);
+			glBindBuffer(GL_COPY_READ_BUFFER, buf);
+			size_t at = 0;
+			for (size_t i = 0; i < starts.size(); ++i){
+				glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, *starts[i] * elemSize,
+					at * elemSize, counts[i] * elemSize);
+				*starts[i] = at;
+				at += counts[i];
+			}
+		}
+		glBindBuffer(GL_COPY_WRITE_BUFFER, buf);
+		glBufferData(GL_COPY_WRITE_BUFFER, capacity * elemSize, NULL, GL_STATIC_DRAW);
+		if (used > 0){
+			glBindBuffer(GL_COPY_READ_BUFFER, staging);
+			glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, used * elemSize);
+			glDeleteBuffers(1, &staging);
+		}
+	}
+}
+
+//Defined for the std::max calls taking them by reference
+const size_t GeometryArena::INITIAL_VERTICES;
+const size_t GeometryArena::INITIAL_INDICES;
+const size_t GeometryArena::MAX_FRAGMENTS;
+
+FreeList::FreeList() : capacity(0){}
+bool FreeList::allocate(size_t size, size_t &offset){
+	for (size_t i = 0; i < ranges.size(); ++i){
+		Range &r = ranges[i];
+		if (r.size >= size){
+			offset = r.offset;
+			r.offset += size;
+			r.size -= size;
+			if (r.size == 0){
+				ranges.erase(ranges.begin() + i);
+			}
+			return true;
+		}
+	}
+	return false;
+}
+void FreeList::release(size_t offset, size_t size){
+	Range freed = { offset, size };
+	std::vector<Range>::iterator next = std::lower_bound(ranges.begin(), ranges.end(), freed,
+		[](const Range &a, const Range &b){ return a.offset < b.offset; });
+	//Merge with the free ranges on either side if they touch
+	if (next != ranges.end() && offset + size == next->offset){
+		freed.size += next->size;
+		next = ranges.erase(next);
+	}
+	if (next != ranges.begin()){
+		Range &prev = *(next - 1);
+		if (prev.offset + prev.size == offset){
+			prev.size += freed.size;
+			return;
+		}
+	}
+	ranges.insert(next, freed);
+}
+void FreeList::reset(size_t used, size_t cap){
+	capacity = cap;
+	ranges.clear();
+	if (used < capacity){
+		Range r = { used, capacity - used };
+		ranges.push_back(r);
+	}
+}
+size_t FreeList::size() const {
+	return capacity;
+}
+size_t FreeList::freeElements() const {
+	size_t n = 0;
+	for (const Range &r : ranges){
+		n += r.size;
+	}
+	return n;
+}
+size_t FreeList::fragments() const {
+	return ranges.size();
+}
+
+GeometryArena::GeometryArena(VertexLayout layout, GLenum indexType)
+	: layout(layout), type(indexType), stride(vertexStride(layout)),
+	indexSize(indexType == GL_UNSIGNED_INT ? 4 : 2), vao(0), vbo(0), ebo(0), repacks(0)
+{
+	glGenBuffers(1, &vbo);
+	glGenBuffers(1, &ebo);
+	glGenVertexArrays(1, &vao);
+	glBindVertexArray(vao);
+	setupVertexArray();
+	glBindVertexArray(0);
+}
+GeometryArena::~GeometryArena(){
+	destroy();
+}
+GeometryArena::Handle GeometryArena::allocate(const void *vertices, size_t vertexCount,
+	const void *indices, size_t indexCount)
+{
+	if (vertexCount == 0 || indexCount == 0){
+		return INVALID;
+	}
+	size_t vertexStart = 0, indexStart = 0;
+	bool fits = vertexFree.allocate(vertexCount, vertexStart);
+	if (fits && !indexFree.allocate(indexCount, indexStart)){
+		vertexFree.release(vertexStart, vertexCount);
+		fits = false;
+	}
+	if (!fits){
+		//Pack the blocks together to make one free range at the end, growing
+		//the buffers if that still won't fit the new block
+		size_t vertexCapacity = vertexFree.size(), indexCapacity = indexFree.size();
+		const size_t verticesUsed = vertexCapacity - vertexFree.freeElements();
+		const size_t indicesUsed = indexCapacity - indexFree.freeElements();
+		if (verticesUsed + vertexCount > vertexCapacity){
+			vertexCapacity = std::max(std::max(vertexCapacity * 2, INITIAL_VERTICES),
+				verticesUsed + vertexCount);
+		}
+		if (indicesUsed + indexCount > indexCapacity){
+			indexCapacity = std::max(std::max(indexCapacity * 2, INITIAL_INDICES),
+				indicesUsed + indexCount);
+		}
+		repack(vertexCapacity, indexCapacity);
+		vertexFree.allocate(vertexCount, vertexStart);
+		indexFree.allocate(indexCount, indexStart);
+	}
+	glBindBuffer(GL_COPY_WRITE_BUFFER, vbo);
+	glBufferSubData(GL_COPY_WRITE_BUFFER, vertexStart * stride, vertexCount * stride, vertices);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, ebo);
+	glBufferSubData(GL_COPY_WRITE_BUFFER, indexStart * indexSize, indexCount * indexSize, indices);
+
+	Block b = { vertexStart, vertexCount, indexStart, indexCount, true };
+	if (!freeHandles.empty()){
+		const Handle h = freeHandles.back();
+		freeHandles.pop_back();
+		blocks[h] = b;
+		return h;
+	}
+	blocks.push_back(b);
+	return blocks.size() - 1;
+}
+void GeometryArena::release(Handle block){
+	if (block >= blocks.size() || !blocks[block].live){
+		return;
+	}
+	Block &b = blocks[block];
+	vertexFree.release(b.vertexStart, b.vertexCount);
+	indexFree.release(b.indexStart, b.indexCount);
+	b.live = false;
+	freeHandles.push_back(block);
+}
+GLint GeometryArena::baseVertex(Handle block) const {
+	return blocks[block].vertexStart;
+}
+size_t GeometryArena::indexOffset(Handle block) const {
+	return blocks[block].indexStart * indexSize;
+}
+VertexLayout GeometryArena::vertexLayout() const {
+	return layout;
+}
+GLenum GeometryArena::indexType() const {
+	return type;
+}
+GLuint GeometryArena::vertexArray() const {
+	return vao;
+}
+void GeometryArena::setupVertexArray() const {
+	glBindBuffer(GL_ARRAY_BUFFER, vbo);
+	util::setupVertexAttribs(layout);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+}
+bool GeometryArena::defragment(size_t maxFragments){
+	if (vertexFree.fragments() > maxFragments || indexFree.fragments() > maxFragments){
+		repack(vertexFree.size(), indexFree.size());
+		return true;
+	}
+	return false;
+}
+void GeometryArena::destroy(){
+	if (vao){
+		glDeleteVertexArrays(1, &vao);
+		glDeleteBuffers(1, &vbo);
+		glDeleteBuffers(1, &ebo);
+		vao = vbo = ebo = 0;
+	}
+}
+GeometryArena::Stats GeometryArena::stats() const {
+	Stats s;
+	s.vertexCapacity = vertexFree.size();
+	s.verticesUsed = s.vertexCapacity - vertexFree.freeElements();
+	s.indexCapacity = indexFree.size();
+	s.indicesUsed = s.indexCapacity - indexFree.freeElements();
+	s.blocks = blocks.size() - freeHandles.size();
+	s.fragments = vertexFree.fragments() + indexFree.fragments();
+	s.repacks = repacks;
+	return s;
+}
+void GeometryArena::repack(size_t vertexCapacity, size_t indexCapacity){
+	std::vector<size_t*> vertexStarts, indexStarts;
+	std::vector<size_t> vertexCounts, indexCounts;
+	for (Block &b : blocks){
+		if (b.live){
+			vertexStarts.push_back(&b.vertexStart);
+			vertexCounts.push_back(b.vertexCount);
+			indexStarts.push_back(&b.indexStart);
+			indexCounts.push_back(b.indexCount);
+		}
+	}
+	packBuffer(vbo, stride, vertexCapacity, vertexStarts, vertexCounts);
+	packBuffer(ebo, indexSize, indexCapacity, indexStarts, indexCounts);
+	size_t verticesUsed = 0, indicesUsed = 0;
+	for (size_t i = 0; i < vertexCounts.size(); ++i){
+		verticesUsed += vertexCounts[i];
+		indicesUsed += indexCounts[i];
+	}
+	vertexFree.reset(verticesUsed, vertexCapacity);
+	indexFree.reset(indicesUsed, indexCapacity);
+	++repacks;
+}
+
+GeometryArena& geometry::arena(VertexLayout layout, GLenum indexType){
+	for (std::unique_ptr<GeometryArena> &a : arenas){
+		if (a->vertexLayout() == layout && a->indexType() == indexType){
+			return *a;
+		}
+	}
+	arenas.push_back(std::unique_ptr<GeometryArena>(new GeometryArena(layout, indexType)));
+	return *arenas.back();
+}
+void geometry::defragment(){
+	for (std::unique_ptr<GeometryArena> &a : arenas){
+		a->defragment(GeometryArena::MAX_FRAGMENTS);
+	}
+}
+void geometry::printStats(){
+	for (const std::unique_ptr<GeometryArena> &a : arenas){
+		const GeometryArena::Stats s = a->stats();
+		std::cout << "Geometry arena (layout " << a->vertexLayout() << ", "
+			<< (a->indexType() == GL_UNSIGNED_INT ? 32 : 16) << "bit indices): "
+			<< s.verticesUsed << "/" << s.vertexCapacity << " vertices, " << s.indicesUsed << "/"
+			<< s.indexCapacity << " indices, " << s.blocks << " meshes, " << s.fragments
+			<< " free ranges, " << s.repacks << " repacks\n";
+	}
+}
+void geometry::shutdown(){
+	for (std::unique_ptr<GeometryArena> &a : arenas){
+		a->destroy();
+	}
+}
@@ -0,0 +1,127 @@
+#include <atomic>
+#include <iostream>
+#include <GL/glew.h>
+#include "util.h"
+#include "glcheck.h"
+
+namespace {
+	std::atomic<glcheck::Mode> checkMode(glcheck::OFF);
+	unsigned sampleInterval = 1;
+	unsigned frame = 0;
+	bool debugOutput = false;
+	size_t polls = 0, errors = 0;
+	//Asynchronous debug output may call back from a driver thread
+	std::atomic<size_t> debugMessages(0), debugErrors(0);
+
+	void APIENTRY countMessage(GLenum src, GLenum type, GLuint id, GLenum severity,
+		GLsizei len, const GLchar *msg, const GLvoid *user)
+	{
+		if (checkMode == glcheck::OFF){
+			return;
+		}
+		++debugMessages;
+		if (type == GL_DEBUG_TYPE_ERROR_ARB){
+			++debugErrors;
+		}
+		util::glDebugCallback(src, type, id, severity, len, msg, user);
+	}
+	/*
+	 * Turn debug output on or off and make it synchronous or not to match the mode
+	 */
+	void applyMode(){
+		if (!debugOutput){
+			return;
+		}
+		if (checkMode == glcheck::SYNC){
+			glEnable(GL_DEBUG_OUTPUT_SYNCHRONOUS_ARB);
+		}
+		else {
+			glDisable(GL_DEBUG_OUTPUT_SYNCHRONOUS_ARB);
+		}
+		//With only ARB_debug_output the messages are on for the debug context's
+		//lifetime, so countMessage just drops them
+		if (GLEW_KHR_debug){
+			if (checkMode == glcheck::OFF){
+				glDisable(GL_DEBUG_OUTPUT);
+			}
+			else {
+				glEnable(GL_DEBUG_OUTPUT);
+			}
+		}
+	}
+}
+
+void glcheck::init(Mode mode, unsigned interval){
+	sampleInterval = interval > 0 ? interval : 1;
+	if (GLEW_KHR_debug){
+		glDebugMessageCallback(countMessage, NULL);
+		glDebugMessageControl(GL_DONT_CARE, GL_DONT_CARE, GL_DONT_CARE, 0, NULL, GL_TRUE);
+		//Some drivers send a notification for every buffer upload, which would
+		//cost more than the checks we're saving
+		glDebugMessageControl(GL_DONT_CARE, GL_DONT_CARE, GL_DEBUG_SEVERITY_NOTIFICATION,
+			0, NULL, GL_FALSE);
+		debugOutput = true;
+	}
+	else if (GLEW_ARB_debug_output){
+		glDebugMessageCallbackARB(countMessage, NULL);
+		glDebugMessageControlARB(GL_DONT_CARE, GL_DONT_CARE, GL_DONT_CARE, 0, NULL, GL_TRUE);
+		debugOutput = true;
+	}
+	setMode(mode);
+}
+void glcheck::setMode(Mode mode){
+	checkMode = mode;
+	applyMode();
+}
+glcheck::Mode glcheck::mode(){
+	return checkMode;
+}
+bool glcheck::check(const std::string &msg){
+	if (checkMode == OFF || (checkMode == SAMPLED && frame % sampleInterval != 0)){
+		return false;
+	}
+	++polls;
+	bool found = false;
+	for (GLenum err = glGetError(); err != GL_NO_ERROR; err = glGetError()){
+		std::cerr << "OpenGL Error: " << gluErrorString(err) << " - " << msg << "\n";
+		++errors;
+		found = true;
+	}
+	return found;
+}
+void glcheck::endFrame(){
+	++frame;
+}
+glcheck::Stats glcheck::stats(){
+	Stats s;
+	s.polls = polls;
+	s.errors = errors;
+	s.debugMessages = debugMessages;
+	s.debugErrors = debugErrors;
+	return s;
+}
+bool glcheck::parseMode(const std::string &name, Mode &mode){
+	if (name == "off"){
+		mode = OFF;
+	}
+	else if (name == "sampled"){
+		mode = SAMPLED;
+	}
+	else if (name == "sync"){
+		mode = SYNC;
+	}
+	else {
+		return false;
+	}
+	return true;
+}
+const char* glcheck::modeName(Mode mode){
+	switch (mode){
+		case SAMPLED:
+			return "sampled";
+		case SYNC:
+			return "sync";
+		default:
+			return "off";
+	}
+}
@@ -0,0 +1,384 @@
+#include <algorithm>
+#include <iostream>
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include "frameuniforms.h"
+#include "programcache.h"
+#include "hiz.h"
+
+//How much the reduction shader shrinks the depth buffer on each side, see fhiz.glsl
+const int SCALE = 4;
+//Texture unit the depth buffer is read from, the deferred pass keeps it on unit 2
+const int DEPTH_UNIT = 2;
+//Vertices in the triangle strip vhizbox.glsl draws a box with
+const int BOX_VERTICES = 14;
+
+HiZ::HiZ(int width, int height) : width(width), height(height),
+	baseWidth((width + SCALE - 1) / SCALE), baseHeight((height + SCALE - 1) / SCALE),
+	fbo(0), tex(0), vao(0), program(0), boxProgram(0), boxLoUnif(-1), boxHiUnif(-1),
+	next(0), pending(0), generation(0), captures(0), valid(false)
+{
+	GLint progStatus = programcache::acquire("res/vhiz.glsl", "res/fhiz.glsl");
+	if (progStatus == -1){
+		std::cerr << "HiZ: Failed to load depth reduction program\n";
+	}
+	else {
+		program = progStatus;
+		programcache::use(program);
+		glUniform1i(glGetUniformLocation(program, "depth"), DEPTH_UNIT);
+	}
+	//The boxes only need to be depth tested, so any fragment shader will do
+	progStatus = programcache::acquire("res/vhizbox.glsl", "res/fshadow.glsl");
+	if (progStatus == -1){
+		std::cerr << "HiZ: Failed to load box test program\n";
+	}
+	else {
+		boxProgram = progStatus;
+		boxLoUnif = glGetUniformLocation(boxProgram, "lo");
+		boxHiUnif = glGetUniformLocation(boxProgram, "hi");
+		FrameUniforms::bindBlock(boxProgram);
+	}
+	//The reduction draws a single triangle from gl_VertexID but core
+	//profiles still need a VAO bound to draw
+	glGenVertexArrays(1, &vao);
+
+	glGenTextures(1, &tex);
+	glGenBuffers(RING_SIZE, pbos);
+	for (int i = 0; i < RING_SIZE; ++i){
+		fences[i] = 0;
+		generations[i] = 0;
+		captureIds[i] = 0;
+	}
+	allocate();
+
+	glGenFramebuffers(1, &fbo);
+	glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, tex, 0);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+HiZ::~HiZ(){
+	for (int i = 0; i < RING_SIZE; ++i){
+		if (fences[i]){
+			glDeleteSync(fences[i]);
+		}
+	}
+	glDeleteBuffers(RING_SIZE, pbos);
+	if (!queries.empty()){
+		glDeleteQueries(queries.size(), &queries[0]);
+	}
+	glDeleteFramebuffers(1, &fbo);
+	glDeleteTextures(1, &tex);
+	glDeleteVertexArrays(1, &vao);
+	if (program != 0){
+		programcache::release(program);
+	}
+	if (boxProgram != 0){
+		programcache::release(boxProgram);
+	}
+}
+bool HiZ::ready() const {
+	if (program == 0 || boxProgram == 0){
+		return false;
+	}
+	glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+	GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	if (status != GL_FRAMEBUFFER_COMPLETE){
+		std::cerr << "HiZ: Reduction framebuffer incomplete: " << status << "\n";
+		return false;
+	}
+	return true;
+}
+void HiZ::resize(int w, int h){
+	//Readbacks in flight are the old size, drop them
+	for (int i = 0; i < RING_SIZE; ++i){
+		if (fences[i]){
+			glDeleteSync(fences[i]);
+			fences[i] = 0;
+		}
+	}
+	next = pending = 0;
+	invalidate();
+	width = w;
+	height = h;
+	baseWidth = (width + SCALE - 1) / SCALE;
+	baseHeight = (height + SCALE - 1) / SCALE;
+	allocate();
+}
+void HiZ::capture(GLuint depthTex, const glm::mat4 &vp){
+	//Every slot is still waiting on the GPU, skip this frame rather than stall
+	if (fences[next] != 0){
+		return;
+	}
+	GLint viewport[4];
+	glGetIntegerv(GL_VIEWPORT, viewport);
+	glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+	glViewport(0, 0, baseWidth, baseHeight);
+	glDisable(GL_DEPTH_TEST);
+	programcache::use(program);
+	glActiveTexture(GL_TEXTURE0 + DEPTH_UNIT);
+	glBindTexture(GL_TEXTURE_2D, depthTex);
+	glBindVertexArray(vao);
+	glDrawArrays(GL_TRIANGLES, 0, 3);
+	glEnable(GL_DEPTH_TEST);
+
+	//The read goes into the pixel buffer so glReadPixels returns right away
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, pbos[next]);
+	glReadPixels(0, 0, baseWidth, baseHeight, GL_RED, GL_FLOAT, 0);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	fences[next] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	viewProjs[next] = vp;
+	generations[next] = generation;
+	captureIds[next] = captures++;
+	next = (next + 1) % RING_SIZE;
+
+	glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+}
+bool HiZ::update(){
+	bool rebuilt = false;
+	while (fences[pending] != 0){
+		GLenum status = glClientWaitSync(fences[pending], 0, 0);
+		if (status == GL_TIMEOUT_EXPIRED){
+			break;
+		}
+		glDeleteSync(fences[pending]);
+		fences[pending] = 0;
+		//Readbacks from before the last invalidate don't match the scene anymore
+		if (status != GL_WAIT_FAILED && generations[pending] == generation){
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, pbos[pending]);
+			const float *data = static_cast<const float*>(glMapBufferRange(GL_PIXEL_PACK_BUFFER,
+				0, baseWidth * baseHeight * sizeof(float), GL_MAP_READ_BIT));
+			if (data){
+				std::copy(data, data + baseWidth * baseHeight, levels[0].begin());
+				viewProj = viewProjs[pending];
+				buildPyramid();
+				valid = true;
+				rebuilt = true;
+				//Drop where objects were when this was captured if they've moved
+				//since, boxes moved from before it are already out of the depth
+				size_t kept = 0;
+				for (const Stale &st : stale){
+					if (st.captures > captureIds[pending]){
+						clearRect(st.lo, st.hi);
+						stale[kept++] = st;
+					}
+				}
+				stale.resize(kept);
+			}
+			glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+		}
+		pending = (pending + 1) % RING_SIZE;
+	}
+	return rebuilt;
+}
+void HiZ::invalidate(){
+	++generation;
+	valid = false;
+	stale.clear();
+}
+void HiZ::moved(const glm::vec3 &lo, const glm::vec3 &hi){
+	//Readbacks in flight were all captured with the object still in the box
+	if (fences[pending] != 0){
+		Stale st = { captures, lo, hi };
+		stale.push_back(st);
+	}
+	if (valid){
+		clearRect(lo, hi);
+	}
+}
+bool HiZ::active() const {
+	return valid;
+}
+bool HiZ::occluded(const glm::vec3 &lo, const glm::vec3 &hi) const {
+	if (!valid){
+		return false;
+	}
+	//Parts of the box off the captured screen could be seen now that the
+	//camera has moved, and a box crossing the near plane could cover anything
+	int x0, y0, x1, y1;
+	float nearest;
+	bool onScreen;
+	if (!project(lo, hi, x0, y0, x1, y1, nearest, onScreen) || !onScreen){
+		return false;
+	}
+	//Go up the pyramid until the rect covers at most 2x2 texels
+	size_t level = 0;
+	while ((x1 - x0 > 1 || y1 - y0 > 1) && level + 1 < levels.size()){
+		x0 /= 2;
+		x1 /= 2;
+		y0 /= 2;
+		y1 /= 2;
+		++level;
+	}
+	const std::vector<float> &depth = levels[level];
+	const int w = levelWidths[level];
+	for (int y = y0; y <= y1; ++y){
+		for (int x = x0; x <= x1; ++x){
+			if (nearest <= depth[y * w + x]){
+				return false;
+			}
+		}
+	}
+	return true;
+}
+HiZ::Stats HiZ::cull(const Bvh &bvh, const std::vector<char> &moving, std::vector<size_t> &visible,
+	std::vector<size_t> &hidden) const
+{
+	Stats stats = { 0, 0 };
+	hidden.clear();
+	if (!valid){
+		return stats;
+	}
+	size_t kept = 0;
+	for (size_t i = 0; i < visible.size(); ++i){
+		const size_t obj = visible[i];
+		if (obj < moving.size() && moving[obj]){
+			visible[kept++] = obj;
+			continue;
+		}
+		glm::vec3 lo, hi;
+		bvh.bounds(obj, lo, hi);
+		++stats.tested;
+		if (occluded(lo, hi)){
+			hidden.push_back(obj);
+			++stats.occluded;
+		}
+		else {
+			visible[kept++] = obj;
+		}
+	}
+	visible.resize(kept);
+	return stats;
+}
+void HiZ::testOccluded(const Bvh &bvh, const std::vector<size_t> &occluded){
+	if (occluded.empty()){
+		return;
+	}
+	if (queries.size() < occluded.size()){
+		const size_t had = queries.size();
+		queries.resize(occluded.size());
+		glGenQueries(queries.size() - had, &queries[had]);
+	}
+	programcache::use(boxProgram);
+	glBindVertexArray(vao);
+	//The boxes are only tested against the depth, they mustn't land in the targets
+	glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+	glDepthMask(GL_FALSE);
+	for (size_t i = 0; i < occluded.size(); ++i){
+		glm::vec3 lo, hi;
+		bvh.bounds(occluded[i], lo, hi);
+		glUniform3f(boxLoUnif, lo.x, lo.y, lo.z);
+		glUniform3f(boxHiUnif, hi.x, hi.y, hi.z);
+		glBeginQuery(GL_ANY_SAMPLES_PASSED, queries[i]);
+		glDrawArrays(GL_TRIANGLE_STRIP, 0, BOX_VERTICES);
+		glEndQuery(GL_ANY_SAMPLES_PASSED);
+	}
+	glDepthMask(GL_TRUE);
+	glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+}
+void HiZ::beginRevealed(size_t i) const {
+	glBeginConditionalRender(queries[i], GL_QUERY_WAIT);
+}
+void HiZ::endRevealed() const {
+	glEndConditionalRender();
+}
+void HiZ::allocate(){
+	//The depth unit already holds the G-buffer's depth, put it back once we're done
+	GLint prevTex = 0;
+	glActiveTexture(GL_TEXTURE0 + DEPTH_UNIT);
+	glGetIntegerv(GL_TEXTURE_BINDING_2D, &prevTex);
+	glBindTexture(GL_TEXTURE_2D, tex);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, baseWidth, baseHeight, 0, GL_RED, GL_FLOAT, NULL);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glBindTexture(GL_TEXTURE_2D, prevTex);
+
+	for (int i = 0; i < RING_SIZE; ++i){
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, pbos[i]);
+		glBufferData(GL_PIXEL_PACK_BUFFER, baseWidth * baseHeight * sizeof(float), NULL,
+			GL_STREAM_READ);
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+	//Size each level of the pyramid, halving down to a single texel
+	levels.clear();
+	levelWidths.clear();
+	levelHeights.clear();
+	int w = baseWidth, h = baseHeight;
+	while (true){
+		levelWidths.push_back(w);
+		levelHeights.push_back(h);
+		levels.push_back(std::vector<float>(w * h, 1.f));
+		if (w == 1 && h == 1){
+			break;
+		}
+		w = (w + 1) / 2;
+		h = (h + 1) / 2;
+	}
+}
+void HiZ::buildPyramid(){
+	//Each texel keeps the farthest depth of the 2x2 texels below it, on odd
+	//sized levels the last texel only covers the one row or column left
+	for (size_t l = 1; l < levels.size(); ++l){
+		const std::vector<float> &src = levels[l - 1];
+		std::vector<float> &dst = levels[l];
+		const int sw = levelWidths[l - 1], sh = levelHeights[l - 1];
+		const int w = levelWidths[l], h = levelHeights[l];
+		for (int y = 0; y < h; ++y){
+			const int sy0 = 2 * y, sy1 = std::min(2 * y + 1, sh - 1);
+			for (int x = 0; x < w; ++x){
+				const int sx0 = 2 * x, sx1 = std::min(2 * x + 1, sw - 1);
+				dst[y * w + x] = std::max(std::max(src[sy0 * sw + sx0], src[sy0 * sw + sx1]),
+					std::max(src[sy1 * sw + sx0], src[sy1 * sw + sx1]));
+			}
+		}
+	}
+}
+bool HiZ::project(const glm::vec3 &lo, const glm::vec3 &hi, int &x0, int &y0, int &x1, int &y1,
+	float &nearest, bool &onScreen) const
+{
+	glm::vec3 ndcLo(2.f), ndcHi(-2.f);
+	for (int i = 0; i < 8; ++i){
+		glm::vec4 corner(i & 1 ? hi.x : lo.x, i & 2 ? hi.y : lo.y, i & 4 ? hi.z : lo.z, 1.f);
+		glm::vec4 clip = viewProj * corner;
+		if (clip.w <= 1e-5f){
+			return false;
+		}
+		glm::vec3 ndc = glm::vec3(clip) / clip.w;
+		ndcLo = glm::min(ndcLo, ndc);
+		ndcHi = glm::max(ndcHi, ndc);
+	}
+	if (ndcLo.z < -1.f){
+		return false;
+	}
+	onScreen = ndcLo.x >= -1.f && ndcLo.y >= -1.f && ndcHi.x <= 1.f && ndcHi.y <= 1.f;
+	nearest = ndcLo.z * 0.5f + 0.5f;
+	ndcLo = glm::clamp(ndcLo, -1.f, 1.f);
+	ndcHi = glm::clamp(ndcHi, -1.f, 1.f);
+	x0 = std::min(static_cast<int>((ndcLo.x * 0.5f + 0.5f) * baseWidth), baseWidth - 1);
+	x1 = std::min(static_cast<int>((ndcHi.x * 0.5f + 0.5f) * baseWidth), baseWidth - 1);
+	y0 = std::min(static_cast<int>((ndcLo.y * 0.5f + 0.5f) * baseHeight), baseHeight - 1);
+	y1 = std::min(static_cast<int>((ndcHi.y * 0.5f + 0.5f) * baseHeight), baseHeight - 1);
+	return true;
+}
+void HiZ::clearRect(const glm::vec3 &lo, const glm::vec3 &hi){
+	int x0, y0, x1, y1;
+	float nearest;
+	bool onScreen;
+	//A box crossing the near plane could have covered the whole screen
+	if (!project(lo, hi, x0, y0, x1, y1, nearest, onScreen)){
+		valid = false;
+		return;
+	}
+	//Each level's texels cover twice the texels of the one below, so the
+	//rect halves going up and anything over it sees through to the far plane
+	for (size_t l = 0; l < levels.size(); ++l){
+		std::vector<float> &depth = levels[l];
+		const int w = levelWidths[l];
+		for (int y = y0 >> l; y <= y1 >> l; ++y){
+			std::fill(depth.begin() + y * w + (x0 >> l), depth.begin() + y * w + (x1 >> l) + 1, 1.f);
+		}
+	}
+}
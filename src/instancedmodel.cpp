@@ -0,0 +1,101 @@
+#include <vector>
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include "frustum.h"
+#include "model.h"
+#include "instancedmodel.h"
+
+InstancedModel::InstancedModel(const std::string &file, GLuint program, GLuint shadowProgram,
+	unsigned meshFlags)
+	: Model(file, program, shadowProgram, meshFlags), instanceBuf(0), dirty(false)
+{
+	//The instance matrices need a VAO of our own reading the arena's buffers
+	glGenVertexArrays(1, &vao);
+	glBindVertexArray(vao);
+	if (arena){
+		arena->setupVertexArray();
+	}
+	glGenBuffers(1, &instanceBuf);
+	glBindBuffer(GL_ARRAY_BUFFER, instanceBuf);
+	//A mat4 attribute takes 4 locations, one per column, each advancing per instance
+	for (GLuint i = 0; i < 4; ++i){
+		glEnableVertexAttribArray(INSTANCE_ATTRIB + i);
+		glVertexAttribPointer(INSTANCE_ATTRIB + i, 4, GL_FLOAT, GL_FALSE, sizeof(glm::mat4),
+			(void*)(sizeof(glm::vec4) * i));
+		glVertexAttribDivisor(INSTANCE_ATTRIB + i, 1);
+	}
+	glBindVertexArray(0);
+}
+InstancedModel::~InstancedModel(){
+	glDeleteBuffers(1, &instanceBuf);
+	glDeleteVertexArrays(1, &vao);
+}
+size_t InstancedModel::addInstance(const glm::mat4 &transform){
+	instances.push_back(transform);
+	dirty = true;
+	return instances.size() - 1;
+}
+void InstancedModel::setInstance(size_t i, const glm::mat4 &transform){
+	instances[i] = transform;
+	dirty = true;
+}
+void InstancedModel::clearInstances(){
+	instances.clear();
+	dirty = true;
+}
+size_t InstancedModel::instanceCount() const {
+	return instances.size();
+}
+void InstancedModel::bind(){
+	Model::bind();
+	upload();
+}
+void InstancedModel::bindShadow(){
+	Model::bindShadow();
+	upload();
+}
+void InstancedModel::bindCached(StateCache &cache, bool shadow){
+	Model::bindCached(cache, shadow);
+	upload();
+}
+void InstancedModel::selectLod(const glm::vec3 &viewPos, float pixelsPerUnit, float maxError,
+	size_t shadowBias)
+{
+	Model::selectLod(instances.data(), instances.size(), viewPos, pixelsPerUnit, maxError,
+		shadowBias);
+}
+void InstancedModel::worldBounds(glm::vec3 &lo, glm::vec3 &hi){
+	lo = hi = glm::vec3(0.f);
+	for (size_t i = 0; i < instances.size(); ++i){
+		glm::vec3 iLo, iHi;
+		transformBounds(instances[i], info.boundsMin, info.boundsMax, iLo, iHi);
+		lo = i == 0 ? iLo : glm::min(lo, iLo);
+		hi = i == 0 ? iHi : glm::max(hi, iHi);
+	}
+}
+void InstancedModel::drawLod(size_t level){
+	if (level >= info.lods.size() || instances.empty() || block == GeometryArena::INVALID){
+		return;
+	}
+	const GLint baseVertex = arena->baseVertex(block);
+	const size_t indexOffset = arena->indexOffset(block);
+	const Lod &l = info.lods[level];
+	for (size_t i = l.first; i < l.first + l.count; ++i){
+		const SubMesh &s = info.subMeshes[i];
+		glDrawElementsInstancedBaseVertex(GL_TRIANGLES, s.count, info.indexType,
+			reinterpret_cast<void*>(s.offset + indexOffset), instances.size(),
+			s.baseVertex + baseVertex);
+	}
+}
+void InstancedModel::upload(){
+	if (!dirty){
+		return;
+	}
+	//Orphan the old data so we don't wait on draws still reading it
+	glBindBuffer(GL_ARRAY_BUFFER, instanceBuf);
+	glBufferData(GL_ARRAY_BUFFER, instances.size() * sizeof(glm::mat4), NULL, GL_DYNAMIC_DRAW);
+	if (!instances.empty()){
+		glBufferSubData(GL_ARRAY_BUFFER, 0, instances.size() * sizeof(glm::mat4), instances.data());
+	}
+	dirty = false;
+}
@@ -0,0 +1,199 @@
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <thread>
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include "programcache.h"
+#include "lightgrid.h"
+
+//Number of RGBA32F texels each light takes in the lights buffer texture
+const size_t TEXELS_PER_LIGHT = 3;
+
+LightGrid::LightGrid(int width, int height) : width(width), height(height),
+	tilesX((width + TILE_SIZE - 1) / TILE_SIZE), tilesY((height + TILE_SIZE - 1) / TILE_SIZE),
+	pool(std::max(std::thread::hardware_concurrency(), 1u))
+{
+	const GLenum formats[3] = { GL_RGBA32F, GL_RG32UI, GL_R16UI };
+	const GLenum units[3] = { LIGHTS_UNIT, TILES_UNIT, INDICES_UNIT };
+	glGenBuffers(3, buffers);
+	glGenTextures(3, textures);
+	for (int i = 0; i < 3; ++i){
+		glBindBuffer(GL_TEXTURE_BUFFER, buffers[i]);
+		glBufferData(GL_TEXTURE_BUFFER, 16, NULL, GL_STREAM_DRAW);
+		glActiveTexture(GL_TEXTURE0 + units[i]);
+		glBindTexture(GL_TEXTURE_BUFFER, textures[i]);
+		glTexBuffer(GL_TEXTURE_BUFFER, formats[i], buffers[i]);
+	}
+	tileData.resize(2 * tilesX * tilesY, 0);
+}
+LightGrid::~LightGrid(){
+	glDeleteTextures(3, textures);
+	glDeleteBuffers(3, buffers);
+}
+void LightGrid::resize(int w, int h){
+	width = w;
+	height = h;
+	tilesX = (width + TILE_SIZE - 1) / TILE_SIZE;
+	tilesY = (height + TILE_SIZE - 1) / TILE_SIZE;
+	tileData.assign(2 * tilesX * tilesY, 0);
+}
+LightGrid::Stats LightGrid::update(const std::vector<Light> &lights, const glm::mat4 &view,
+	const glm::mat4 &proj)
+{
+	std::chrono::high_resolution_clock::time_point start
+		= std::chrono::high_resolution_clock::now();
+	const size_t count = std::min(lights.size(), MAX_LIGHTS);
+	//Recover the near plane distance from the perspective projection
+	const float nearPlane = proj[3][2] / (proj[2][2] - 1.f);
+	size_t threads = 1;
+	if (count >= MIN_PARALLEL_LIGHTS){
+		threads = std::min(pool.size(), static_cast<size_t>(tilesY));
+	}
+	//Find the tiles each light touches and pack it for upload
+	rects.resize(count);
+	lightData.resize(std::max(count, static_cast<size_t>(1)) * TEXELS_PER_LIGHT * 4);
+	pool.run(threads, [&](size_t t){
+		for (size_t i = count * t / threads; i < count * (t + 1) / threads; ++i){
+			const Light &l = lights[i];
+			rects[i] = screenRect(l, view, proj, nearPlane);
+			GLfloat *d = &lightData[i * TEXELS_PER_LIGHT * 4];
+			d[0] = l.pos.x;
+			d[1] = l.pos.y;
+			d[2] = l.pos.z;
+			d[3] = l.radius;
+			d[4] = l.color.x;
+			d[5] = l.color.y;
+			d[6] = l.color.z;
+			d[7] = l.type == Light::SPOT ? l.cosInner : -1.f;
+			d[8] = l.dir.x;
+			d[9] = l.dir.y;
+			d[10] = l.dir.z;
+			d[11] = l.type == Light::SPOT ? l.cosOuter : -1.f;
+		}
+	});
+	//Each thread bins the lights for a band of tile rows into its own list, so
+	//the lists concatenated in thread order give the lights in tile order
+	threadIndices.resize(threads);
+	pool.run(threads, [&](size_t t){
+		std::vector<GLushort> &out = threadIndices[t];
+		out.clear();
+		std::vector<int> counts(tilesX + 1);
+		std::vector<size_t> cursor(tilesX);
+		for (int y = tilesY * t / threads; y < static_cast<int>(tilesY * (t + 1) / threads); ++y){
+			//Count the lights in each tile of the row by marking where each
+			//light's span starts and ends and summing along the row
+			std::fill(counts.begin(), counts.end(), 0);
+			for (size_t i = 0; i < count; ++i){
+				const Rect &r = rects[i];
+				if (r.x0 <= r.x1 && r.y0 <= y && y <= r.y1){
+					++counts[r.x0];
+					--counts[r.x1 + 1];
+				}
+			}
+			int inTile = 0;
+			size_t offset = out.size();
+			GLuint *tiles = &tileData[2 * y * tilesX];
+			for (int x = 0; x < tilesX; ++x){
+				inTile += counts[x];
+				tiles[2 * x] = offset;
+				tiles[2 * x + 1] = inTile;
+				cursor[x] = offset;
+				offset += inTile;
+			}
+			out.resize(offset);
+			for (size_t i = 0; i < count; ++i){
+				const Rect &r = rects[i];
+				if (r.x0 <= r.x1 && r.y0 <= y && y <= r.y1){
+					for (int x = r.x0; x <= r.x1; ++x){
+						out[cursor[x]++] = i;
+					}
+				}
+			}
+		}
+	});
+	//Offsets were relative to each thread's list, move them to the full list
+	Stats stats = { 0, 0, 0.0 };
+	for (size_t t = 0; t < threads; ++t){
+		for (int y = tilesY * t / threads; y < static_cast<int>(tilesY * (t + 1) / threads); ++y){
+			for (int x = 0; x < tilesX; ++x){
+				tileData[2 * (y * tilesX + x)] += stats.indices;
+			}
+		}
+		stats.indices += threadIndices[t].size();
+	}
+	for (const Rect &r : rects){
+		if (r.x0 <= r.x1){
+			++stats.visible;
+		}
+	}
+
+	glBindBuffer(GL_TEXTURE_BUFFER, buffers[0]);
+	glBufferData(GL_TEXTURE_BUFFER, lightData.size() * sizeof(GLfloat), lightData.data(),
+		GL_STREAM_DRAW);
+	glBindBuffer(GL_TEXTURE_BUFFER, buffers[1]);
+	glBufferData(GL_TEXTURE_BUFFER, tileData.size() * sizeof(GLuint), tileData.data(),
+		GL_STREAM_DRAW);
+	//Send each thread's list straight into its place in the buffer
+	glBindBuffer(GL_TEXTURE_BUFFER, buffers[2]);
+	glBufferData(GL_TEXTURE_BUFFER, std::max(stats.indices, static_cast<size_t>(1)) * sizeof(GLushort),
+		NULL, GL_STREAM_DRAW);
+	size_t offset = 0;
+	for (const std::vector<GLushort> &list : threadIndices){
+		if (!list.empty()){
+			glBufferSubData(GL_TEXTURE_BUFFER, offset * sizeof(GLushort),
+				list.size() * sizeof(GLushort), list.data());
+		}
+		offset += list.size();
+	}
+	glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+	stats.ms = std::chrono::duration<double, std::milli>(
+		std::chrono::high_resolution_clock::now() - start).count();
+	return stats;
+}
+void LightGrid::setupProgram(GLuint program) const {
+	programcache::use(program);
+	glUniform1i(glGetUniformLocation(program, "lights"), LIGHTS_UNIT);
+	glUniform1i(glGetUniformLocation(program, "light_tiles"), TILES_UNIT);
+	glUniform1i(glGetUniformLocation(program, "light_indices"), INDICES_UNIT);
+	glUniform1i(glGetUniformLocation(program, "tiles_x"), tilesX);
+}
+LightGrid::Rect LightGrid::screenRect(const Light &light, const glm::mat4 &view,
+	const glm::mat4 &proj, float nearPlane) const
+{
+	const Rect empty = { 0, 0, -1, -1 };
+	const Rect full = { 0, 0, tilesX - 1, tilesY - 1 };
+	const glm::vec3 c = glm::vec3(view * glm::vec4(light.pos, 1.f));
+	const float r = light.radius;
+	//Entirely on the camera's side of the near plane, or reaching across it
+	//where projecting the sphere doesn't give a bounded rect
+	if (c.z - r >= -nearPlane){
+		return empty;
+	}
+	if (c.z + r > -nearPlane){
+		return full;
+	}
+	//Project the corners of the sphere's view space box, the box around them
+	//holds the sphere's projection
+	glm::vec2 lo(1e9f), hi(-1e9f);
+	for (int i = 0; i < 8; ++i){
+		glm::vec4 corner(c.x + (i & 1 ? r : -r), c.y + (i & 2 ? r : -r),
+			c.z + (i & 4 ? r : -r), 1.f);
+		glm::vec4 clip = proj * corner;
+		glm::vec2 ndc = glm::vec2(clip.x, clip.y) / clip.w;
+		lo = glm::min(lo, ndc);
+		hi = glm::max(hi, ndc);
+	}
+	lo = (lo * 0.5f + 0.5f) * glm::vec2(width, height) / static_cast<float>(TILE_SIZE);
+	hi = (hi * 0.5f + 0.5f) * glm::vec2(width, height) / static_cast<float>(TILE_SIZE);
+	if (hi.x < 0.f || hi.y < 0.f || lo.x >= tilesX || lo.y >= tilesY){
+		return empty;
+	}
+	Rect rect;
+	rect.x0 = std::max(static_cast<int>(lo.x), 0);
+	rect.y0 = std::max(static_cast<int>(lo.y), 0);
+	rect.x1 = std::min(static_cast<int>(hi.x), tilesX - 1);
+	rect.y1 = std::min(static_cast<int>(hi.y), tilesY - 1);
+	return rect;
+}
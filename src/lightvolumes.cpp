@@ -0,0 +1,111 @@
+#include <iostream>
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include "frameuniforms.h"
+#include "frustum.h"
+#include "programcache.h"
+#include "lightvolumes.h"
+
+LightVolumes::LightVolumes(const LightGrid &grid, const std::string &gbufferDefines)
+	: loaded(true)
+{
+	const char *files[VOLUME_COUNT] = { "res/sphere.obj", "res/cone.obj" };
+	const char *defines[VOLUME_COUNT] = { "", "#define SPOT\n" };
+	for (int v = 0; v < VOLUME_COUNT; ++v){
+		volumes[v] = nullptr;
+		GLint program = programcache::acquire("res/vlightvolume.glsl", "res/flightvolume.glsl",
+			defines[v] + gbufferDefines);
+		GLint stencilProgram = programcache::acquire("res/vlightvolume.glsl", "res/fshadow.glsl",
+			defines[v]);
+		if (program == -1 || stencilProgram == -1){
+			std::cerr << "LightVolumes: Failed to load light volume programs\n";
+			if (program != -1){
+				programcache::release(program);
+			}
+			if (stencilProgram != -1){
+				programcache::release(stencilProgram);
+			}
+			loaded = false;
+			continue;
+		}
+		FrameUniforms::bindBlock(program);
+		FrameUniforms::bindBlock(stencilProgram);
+		grid.setupProgram(program);
+		grid.setupProgram(stencilProgram);
+		programcache::use(program);
+		glUniform1i(glGetUniformLocation(program, "diffuse"), 0);
+		glUniform1i(glGetUniformLocation(program, "normal"), 1);
+		glUniform1i(glGetUniformLocation(program, "depth"), 2);
+		indexUnifs[v] = glGetUniformLocation(program, "light_index");
+		stencilIndexUnifs[v] = glGetUniformLocation(stencilProgram, "light_index");
+		//Simplified levels of detail might not enclose the light
+		volumes[v] = new Model(files[v], program, stencilProgram, MESH_NO_LOD);
+		loaded = loaded && volumes[v]->elems() > 0;
+	}
+}
+LightVolumes::~LightVolumes(){
+	for (int v = 0; v < VOLUME_COUNT; ++v){
+		delete volumes[v];
+	}
+}
+bool LightVolumes::ready() const {
+	return loaded;
+}
+size_t LightVolumes::render(const std::vector<Light> &lights, const glm::mat4 &viewProj){
+	const Frustum frustum(viewProj);
+	size_t drawn = 0;
+	//The G-buffer depth is only tested against, never written
+	glDepthMask(GL_FALSE);
+	glEnable(GL_STENCIL_TEST);
+	glBlendFunc(GL_ONE, GL_ONE);
+	//Clearing ignores the viewport and would fill the whole target, so clear
+	//once here and have each volume zero the pixels it marked as it shades them
+	glClear(GL_STENCIL_BUFFER_BIT);
+	//Draw all the spheres then all the cones
+	for (int v = 0; v < VOLUME_COUNT; ++v){
+		const Light::Type type = v == SPOT_VOLUME ? Light::SPOT : Light::POINT;
+		for (size_t i = 0; i < lights.size() && i < LightGrid::MAX_LIGHTS; ++i){
+			const Light &l = lights[i];
+			if (l.type != type || frustum.test(l.pos - glm::vec3(l.radius),
+				l.pos + glm::vec3(l.radius)) == Frustum::OUTSIDE)
+			{
+				continue;
+			}
+			++drawn;
+			//Mark the pixels whose surface is inside the volume, only the
+			//stencil is written
+			glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+			glEnable(GL_DEPTH_TEST);
+			glDisable(GL_CULL_FACE);
+			glDisable(GL_BLEND);
+			glStencilFunc(GL_ALWAYS, 0, 0);
+			glStencilOpSeparate(GL_BACK, GL_KEEP, GL_INCR_WRAP, GL_KEEP);
+			glStencilOpSeparate(GL_FRONT, GL_KEEP, GL_DECR_WRAP, GL_KEEP);
+			volumes[v]->bindShadow();
+			glUniform1i(stencilIndexUnifs[v], i);
+			volumes[v]->drawShadow();
+
+			//Shade the marked pixels, drawing the back faces so the light still
+			//shows when the camera's inside the volume. The back faces cover
+			//every marked pixel, so zeroing the stencil leaves it clear for the
+			//next light
+			glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+			glDisable(GL_DEPTH_TEST);
+			glEnable(GL_CULL_FACE);
+			glCullFace(GL_FRONT);
+			glEnable(GL_BLEND);
+			glStencilFunc(GL_NOTEQUAL, 0, 0xFF);
+			glStencilOp(GL_ZERO, GL_ZERO, GL_ZERO);
+			volumes[v]->bind();
+			glUniform1i(indexUnifs[v], i);
+			volumes[v]->draw();
+		}
+	}
+	glDisable(GL_STENCIL_TEST);
+	glDisable(GL_BLEND);
+	glDisable(GL_CULL_FACE);
+	glCullFace(GL_BACK);
+	glEnable(GL_DEPTH_TEST);
+	glDepthMask(GL_TRUE);
+	return drawn;
+}
@@ -1,4 +1,7 @@
+#include <algorithm>
 #include <iostream>
+#include <cmath>
+#include <cstdlib>
 #include <string>
 #include <vector>
 #include <GL/glew.h>
@@ -11,49 +14,292 @@
 #include <SDL.h>
 #endif
 
+#include "benchstats.h"
+#include "bvh.h"
+#include "dynamicresolution.h"
+#include "frameuniforms.h"
+#include "frustum.h"
+#include "geometryarena.h"
+#include "glcheck.h"
+#include "gbuffer.h"
+#include "hiz.h"
 #include "model.h"
+#include "profiler.h"
+#include "instancedmodel.h"
+#include "lightgrid.h"
+#include "lightvolumes.h"
+#include "programcache.h"
+#include "renderqueue.h"
+#include "shadowcascades.h"
+#include "transforms.h"
 #include "util.h"
 
+//Initial size of the window, it can be resized after
 const int WIN_WIDTH = 640;
 const int WIN_HEIGHT = 480;
+//Vertical field of view of the camera in degrees
+const float FOV = 75.f;
+//Time each headless frame steps the scripted camera, models and lights by,
+//so every run animates the same no matter how fast the frames are drawn
+const float HEADLESS_STEP = 1.f / 60.f;
+//Number of frames the profiler summary covers and is printed every
+const size_t PROFILE_FRAMES = 60;
 
 /*
  * Load up the models being drawn in the scene and return them in the vector passed
  * TODO: Setup proper ref-counting for GL objects so I don't need to return a pointer
- * The view and proj matrices are the viewing and projection matrices for the scene
- * Texture units 0-2 are reserved for the deferred pass and 3 is used by the shadow map
- * but 4+ will be used by model textures
+ * The view and projection matrices come from the Frame uniform block
+ * Texture units 0-2 are reserved for the deferred pass, 3 and 5 are used by the shadow
+ * maps, 6 by the model matrices (transforms::TEXTURE_UNIT) and 7-9 by the light lists
+ * (LightGrid) which leaves 4 for model textures, the models' programs are shared
+ * through programcache so each model binds its texture to unit 4 when drawn
  * As a side note, the handles to the textures created here are lost and leaked
  * not a big deal now, but should make a wrapper around Texture2D that can be
  * associated with a Model or something
+ * meshFlags are the MeshFlags to load the models with and gbufferDefines pick
+ * how the programs write the G-buffer, see GBuffer::defines. If multiDraw is set the
+ * programs are built with MULTI_DRAW so the models can be drawn in multi-draw batches,
+ * see RenderQueue
  */
-std::vector<Model*> setupModels(const glm::mat4 &view, const glm::mat4 &proj);
+std::vector<Model*> setupModels(unsigned meshFlags, const std::string &gbufferDefines,
+	bool multiDraw);
 /*
- * Setup the depth buffer for the shadow map pass and return the texture
- * and framebuffer in the params passed. The texture will be active in
- * GL_TEXTURE3
+ * Load the suzanne model drawn with instancing for the instancing benchmark
+ * scene, with no instances yet. Returns null if loading failed
  */
-void setupShadowMap(GLuint &fbo, GLuint &tex);
+InstancedModel* setupInstancedModel(unsigned meshFlags, const std::string &gbufferDefines);
 /*
- * Perform the shadow map rendering pass
+ * Replace the model's instances with count instances laid out in a cube
+ * filling the view around the origin
  */
-void renderShadowMap(GLuint &fbo, const std::vector<Model*> &models);
+void layoutInstances(InstancedModel &model, size_t count);
+/*
+ * Load the program for the full-screen second pass with the defines passed,
+ * which should include the G-buffer's defines, and point it at the G-buffer, shadow cascades, Frame and Cascades blocks
+ * returns -1 if loading failed
+ */
+GLint loadSecondPass(const std::string &defines);
+/*
+ * Make count point and spot lights scattered through the scene, every
+ * fourth light is a spot light pointing down at the scene
+ */
+std::vector<Light> makeLights(size_t count);
+/*
+ * Build the BVH over the models' world space boxes and fill out modelOf with
+ * the index of the model using each transform, -1 for transforms no model in
+ * the BVH uses
+ */
+void buildBvh(Bvh &bvh, const std::vector<Model*> &models, std::vector<int> &modelOf);
 
 int main(int argc, char **argv){
-	if (SDL_Init(SDL_INIT_EVERYTHING) != 0){
+	//Large meshes use 32bit indices unless we're asked to split them into 16bit sub-meshes
+	//and vertices are packed, optimized and given levels of detail unless we're asked not to
+	unsigned meshFlags = 0;
+	//The most error in pixels a level of detail may show and how many levels
+	//coarser the shadow pass may go
+	float lodError = 1.f;
+	size_t shadowLodBias = 1;
+	//Where linked program binaries are kept, empty to always compile from source
+	std::string programCacheDir = "shadercache";
+	//Number of instanced suzannes to draw, or if benchmarking step the count
+	//from 1 to 100k instances and report the frame time at each
+	size_t instanceCount = 0;
+	bool instanceBench = false;
+	//Skip draws hidden behind the depth of earlier frames
+	bool occlusion = true;
+	//Merge draws sharing their state into multi-draw calls, if supported
+	bool multiDraw = true;
+	//Number of point and spot lights, or if benchmarking step the count from
+	//0 to 4096 lights and report the frame time at each. The lights are shaded
+	//per screen tile unless we're asked to shade each pixel with every light
+	size_t lightCount = 0;
+	bool lightBench = false;
+	bool untiledLights = false;
+	//Shade the point and spot lights by drawing their volumes instead of
+	//looping over the tile lists, toggled with L
+	bool lightVolumes = false;
+	//Keep the casters that have never moved in their own cached shadow map
+	//so moving casters only redraw a map of the moving casters
+	bool shadowLayers = false;
+	//Size in texels of each shadow cascade, how many cascades to split the
+	//view into and how far from the camera they reach
+	int shadowSize = 1024;
+	int cascadeCount = 3;
+	float shadowDistance = 20.f;
+	//How the G-buffer stores normals and depth, see GBuffer. Depth stays 32bit
+	//float unless 24bit is asked for to save bandwidth
+	GBuffer::Normals gbufferNormals = GBuffer::NORMALS_OCT8;
+	GBuffer::Depth gbufferDepth = GBuffer::DEPTH_32F;
+	//Frame time in milliseconds to hold by scaling the resolution, 0 for
+	//always full resolution, and the smallest scale allowed
+	float frameBudget = 0.f;
+	float minScale = 0.5f;
+	//Draw a fixed number of frames along a scripted camera and model path
+	//without showing a window and report the passes' timings as JSON, to
+	//stdout if no file is given, optionally saving the last frame as a BMP
+	bool headless = false;
+	int headlessFrames = 300;
+	//Frames drawn before the headless stats start, at the start of the path
+	int warmupFrames = 30;
+	std::string statsJson, dumpImage;
+	//Where to write a Chrome trace of the last frames profiled on exit
+	std::string traceFile;
+	//How often the frame polls for GL errors, see glcheck. Debug builds sample
+	//every interval frames by default and release builds don't check, G cycles
+	//through the modes
+#ifdef DEBUG
+	glcheck::Mode glErrors = glcheck::SAMPLED;
+#else
+	glcheck::Mode glErrors = glcheck::OFF;
+#endif
+	unsigned glErrorInterval = 60;
+	for (int i = 1; i < argc; ++i){
+		std::string arg = argv[i];
+		if (arg == "--split16"){
+			meshFlags |= MESH_SPLIT_16BIT;
+		}
+		else if (arg == "--float-verts"){
+			meshFlags |= MESH_FLOAT_VERTICES;
+		}
+		else if (arg == "--no-optimize"){
+			meshFlags |= MESH_NO_OPTIMIZE;
+		}
+		else if (arg == "--no-lod"){
+			meshFlags |= MESH_NO_LOD;
+		}
+		else if (arg == "--lod-error" && i + 1 < argc){
+			lodError = std::atof(argv[++i]);
+		}
+		else if (arg == "--shadow-lod-bias" && i + 1 < argc){
+			const int bias = std::atoi(argv[++i]);
+			if (bias < 0){
+				std::cerr << "Invalid shadow LOD bias " << argv[i]
+					<< ", expected a level count of 0 or more\n";
+				return 1;
+			}
+			shadowLodBias = bias;
+		}
+		else if (arg == "--program-cache-dir" && i + 1 < argc){
+			programCacheDir = argv[++i];
+		}
+		else if (arg == "--no-program-cache"){
+			programCacheDir.clear();
+		}
+		else if (arg == "--instances" && i + 1 < argc){
+			instanceCount = std::atoi(argv[++i]);
+		}
+		else if (arg == "--instance-bench"){
+			instanceBench = true;
+		}
+		else if (arg == "--no-occlusion"){
+			occlusion = false;
+		}
+		else if (arg == "--no-multi-draw"){
+			multiDraw = false;
+		}
+		else if (arg == "--lights" && i + 1 < argc){
+			lightCount = std::atoi(argv[++i]);
+		}
+		else if (arg == "--light-bench"){
+			lightBench = true;
+		}
+		else if (arg == "--untiled-lights"){
+			untiledLights = true;
+		}
+		else if (arg == "--light-volumes"){
+			lightVolumes = true;
+		}
+		else if (arg == "--shadow-layers"){
+			shadowLayers = true;
+		}
+		else if (arg == "--shadow-size" && i + 1 < argc){
+			shadowSize = std::atoi(argv[++i]);
+		}
+		else if (arg == "--cascades" && i + 1 < argc){
+			cascadeCount = std::atoi(argv[++i]);
+		}
+		else if (arg == "--shadow-distance" && i + 1 < argc){
+			shadowDistance = std::atof(argv[++i]);
+		}
+		else if (arg == "--gbuffer-normals" && i + 1 < argc){
+			if (!GBuffer::parseNormals(argv[++i], gbufferNormals)){
+				std::cerr << "Unknown G-buffer normals " << argv[i]
+					<< ", expected rgb8, oct16 or oct8\n";
+				return 1;
+			}
+		}
+		else if (arg == "--depth24"){
+			gbufferDepth = GBuffer::DEPTH_24;
+		}
+		else if (arg == "--frame-budget" && i + 1 < argc){
+			frameBudget = std::atof(argv[++i]);
+		}
+		else if (arg == "--min-scale" && i + 1 < argc){
+			minScale = std::atof(argv[++i]);
+		}
+		else if (arg == "--headless"){
+			headless = true;
+		}
+		else if (arg == "--frames" && i + 1 < argc){
+			headlessFrames = std::max(std::atoi(argv[++i]), 1);
+		}
+		else if (arg == "--warmup" && i + 1 < argc){
+			warmupFrames = std::max(std::atoi(argv[++i]), 0);
+		}
+		else if (arg == "--stats-json" && i + 1 < argc){
+			statsJson = argv[++i];
+		}
+		else if (arg == "--dump-image" && i + 1 < argc){
+			dumpImage = argv[++i];
+		}
+		else if (arg == "--trace" && i + 1 < argc){
+			traceFile = argv[++i];
+		}
+		else if (arg == "--gl-errors" && i + 1 < argc){
+			if (!glcheck::parseMode(argv[++i], glErrors)){
+				std::cerr << "Unknown GL error mode " << argv[i]
+					<< ", expected off, sampled or sync\n";
+				return 1;
+			}
+		}
+		else if (arg == "--gl-error-interval" && i + 1 < argc){
+			glErrorInterval = std::max(std::atoi(argv[++i]), 1);
+		}
+	}
+	//The benchmarks step through their counts on the same frame counters
+	if (lightBench && instanceBench){
+		std::cerr << "--light-bench and --instance-bench can't be run together\n";
+		return 1;
+	}
+	//SDL's offscreen driver makes a surfaceless EGL context, which Mesa's
+	//llvmpipe can back when there's no GPU or display. SDL_VIDEODRIVER set in
+	//the environment still takes precedence
+	if (headless){
+		SDL_SetHint(SDL_HINT_VIDEODRIVER, "offscreen");
+	}
+	//Headless runs only need a window and timers, audio and input devices may
+	//not be there on the machines they run on
+	if (SDL_Init(headless ? SDL_INIT_VIDEO | SDL_INIT_TIMER : SDL_INIT_EVERYTHING) != 0){
 		std::cout << "Failed to init: " << SDL_GetError() << std::endl;
 		return 1;
 	}
 	
 	SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 3);
 	SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 3);
-#ifdef DEBUG
-	SDL_GL_SetAttribute(SDL_GL_CONTEXT_FLAGS, SDL_GL_CONTEXT_DEBUG_FLAG);
-#endif
+	//Drivers with only ARB_debug_output send messages to debug contexts
+	if (glErrors != glcheck::OFF){
+		SDL_GL_SetAttribute(SDL_GL_CONTEXT_FLAGS, SDL_GL_CONTEXT_DEBUG_FLAG);
+	}
 
+	const Uint32 winFlags = headless ? SDL_WINDOW_OPENGL | SDL_WINDOW_HIDDEN
+		: SDL_WINDOW_OPENGL | SDL_WINDOW_RESIZABLE;
 	SDL_Window *win = SDL_CreateWindow("Deferred Renderer",
-		SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, WIN_WIDTH, WIN_HEIGHT,
-		SDL_WINDOW_OPENGL);
+		SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, WIN_WIDTH, WIN_HEIGHT, winFlags);
+	if (!win){
+		std::cout << "Failed to create window: " << SDL_GetError() << std::endl;
+		return 1;
+	}
+	int winWidth = WIN_WIDTH, winHeight = WIN_HEIGHT;
 	
 	SDL_GLContext context = SDL_GL_CreateContext(win);
 
@@ -78,270 +324,619 @@ int main(int argc, char **argv){
 		<< "OpenGL Renderer: " << glGetString(GL_RENDERER) << "\n"
 		<< "GLSL Version: " << glGetString(GL_SHADING_LANGUAGE_VERSION) << "\n";
 
-#ifdef DEBUG
-	glEnable(GL_DEBUG_OUTPUT_SYNCHRONOUS_ARB);
-	glDebugMessageCallbackARB(util::glDebugCallback, NULL);
-	glDebugMessageControlARB(GL_DONT_CARE, GL_DONT_CARE, GL_DONT_CARE,
-		0, NULL, GL_TRUE);
-#endif
-	
-	glm::mat4 projection = glm::perspective(75.f,
-		WIN_WIDTH / static_cast<float>(WIN_HEIGHT), 1.f, 100.f);
-	glm::vec4 viewPos(0.f, 0.f, 5.f, 1.f);
-	glm::mat4 view = glm::lookAt(glm::vec3(viewPos), glm::vec3(0.f, 0.f, 0.f),
-		glm::vec3(0.f, 1.f, 0.f));
-
-	std::vector<Model*> models = setupModels(view, projection);
-
-	//The light direction and half vector
-	glm::vec4 lightDir = glm::normalize(glm::vec4(1.f, 0.f, 1.f, 0.f));
-	//Setup the light's view & projection matrix for the light
-	glm::mat4 lightView = glm::lookAt(glm::vec3(lightDir) * 8.f, glm::vec3(0.f, 0.f, 0.f),
-		glm::vec3(0.f, 1.f, 0.f));
-	//For a directional light orthographic projection (point use perspective)
-	glm::mat4 lightVP = glm::ortho(-4.f, 4.f, -4.f, 4.f, 1.f, 100.f) * lightView;
-
-	//Setup our render targets
-	GLuint fbo;
-	glGenFramebuffers(1, &fbo);
-	glBindFramebuffer(GL_FRAMEBUFFER, fbo);
-
-	util::logGLError("Made fbo");
-
-	//0: diffuse, 1: normals, 2: depth
-	GLuint texBuffers[3];
-	glGenTextures(3, texBuffers);
-	for (int i = 0; i < 2; ++i){
-		glActiveTexture(GL_TEXTURE0 + i);
-		glBindTexture(GL_TEXTURE_2D, texBuffers[i]);
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, WIN_WIDTH, WIN_HEIGHT, 0, GL_RGB,
-			GL_UNSIGNED_BYTE, NULL);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + i, GL_TEXTURE_2D,
-			texBuffers[i], 0);
+	glcheck::init(glErrors, glErrorInterval);
+	if (!programCacheDir.empty()){
+		programcache::enableBinaryCache(programCacheDir);
 	}
-	glActiveTexture(GL_TEXTURE2);
-	glBindTexture(GL_TEXTURE_2D, texBuffers[2]);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT32, WIN_WIDTH, WIN_HEIGHT,
-		0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D,
-		texBuffers[2], 0);
-
-	GLenum drawBuffers[2] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
-	glDrawBuffers(2, drawBuffers);
-
-	util::logGLError("made & attached render targets");
-
-	//Need another shader program for the second pass
-	GLint progStatus = util::loadProgram("res/vsecondpass.glsl", "res/fsecondpass.glsl");
-	if (progStatus == -1){
-		return 1;
-	}
-	GLuint quadProg = progStatus;
-	glUseProgram(quadProg);
-	GLuint diffuseUnif = glGetUniformLocation(quadProg, "diffuse");
-	GLuint normalUnif = glGetUniformLocation(quadProg, "normal");
-	GLuint depthUnif = glGetUniformLocation(quadProg, "depth");
-	glUniform1i(diffuseUnif, 0);
-	glUniform1i(normalUnif, 1);
-	glUniform1i(depthUnif, 2);
+	
+	//The render state lives in this scope so everything owning GL objects is
+	//destroyed while the context is still current
+	{
+		glm::mat4 projection = glm::perspective(FOV,
+			winWidth / static_cast<float>(winHeight), 1.f, 100.f);
+		glm::vec4 viewPos(0.f, 0.f, 5.f, 1.f);
+		glm::mat4 view = glm::lookAt(glm::vec3(viewPos), glm::vec3(0.f, 0.f, 0.f),
+			glm::vec3(0.f, 1.f, 0.f));
 
-	GLuint invProjUnif = glGetUniformLocation(quadProg, "inv_proj");
-	GLuint invViewUnif = glGetUniformLocation(quadProg, "inv_view");
-	glm::mat4 invProj = glm::inverse(projection);
-	glm::mat4 invView = glm::inverse(view);
-	glUniformMatrix4fv(invProjUnif, 1, GL_FALSE, glm::value_ptr(invProj));
-	glUniformMatrix4fv(invViewUnif, 1, GL_FALSE, glm::value_ptr(invView));
-
-	//Pass them to the first pass shader for a forward lighting test
-	GLuint lightDirUnif = glGetUniformLocation(quadProg, "light_dir");
-	GLuint viewPosUnif = glGetUniformLocation(quadProg, "view_pos");
-	glUniform4fv(lightDirUnif, 1, glm::value_ptr(lightDir));
-	glUniform4fv(viewPosUnif, 1, glm::value_ptr(viewPos));
-
-	//Shadow map is bound to texture unit 3
-	GLuint shadowMapUnif = glGetUniformLocation(quadProg, "shadow_map");
-	glUniform1i(shadowMapUnif, 3);
-	GLuint lightVPUnif = glGetUniformLocation(quadProg, "light_vp");
-	glUniformMatrix4fv(lightVPUnif, 1, GL_FALSE, glm::value_ptr(lightVP));
+		//The camera and light data for each frame, the buffer is bound to the
+		//Frame block of the programs that use it as they're loaded
+		FrameUniforms frameUniforms;
+		FrameUniforms::Data frameData;
 
-	//We render the second pass onto a quad drawn to the NDC
-	Model quad("res/quad.obj", quadProg);
+		//Setup our render targets, the models' programs have to match the layout
+		GBuffer gbuffer(winWidth, winHeight, gbufferNormals, gbufferDepth);
+		if (!gbuffer.ready()){
+			return 1;
+		}
+		gbuffer.printStats();
+		const std::string gbufferDefines = gbuffer.defines();
 
-	//Setup the shadow map
-	GLuint shadowTex, shadowFbo;
-	setupShadowMap(shadowFbo, shadowTex);
-	for (Model *m : models){
-		m->setShadowVP(lightVP);
-	}
-	
-	//Setup a debug output quad to be drawn to NDC after all other rendering
-	GLuint dbgProgram = util::loadProgram("res/vforward.glsl", "res/fforward_lum.glsl");
-	Model dbgOut("res/quad.obj", dbgProgram);
-	dbgOut.scale(glm::vec3(0.3f, 0.3f, 1.f));
-	dbgOut.translate(glm::vec3(-0.7f, 0.7f, 0.f));
-	glUseProgram(dbgProgram);
-	GLuint dbgTex = glGetUniformLocation(dbgProgram, "tex");
-	glUniform1i(dbgTex, 3);
-
-	if (util::logGLError("Pre-loop error check")){
-		return 1;
-	}
-	
-	//For tracking fps
-	float frameTime = 0.0;
-	bool printFps = false;
-	int start = SDL_GetTicks();
-	SDL_Event e;
-	bool quit = false;
-	while (!quit){
-		while (SDL_PollEvent(&e)){
-			if (e.type == SDL_QUIT || (e.type == SDL_KEYDOWN && e.key.keysym.sym == SDLK_ESCAPE)){
-				quit = true;
+		//Batching draws needs gl_DrawIDARB for each draw to find its transform
+		multiDraw = multiDraw && GLEW_ARB_shader_draw_parameters;
+		std::cout << "Multi-draw batching: " << (multiDraw ? "on" : "off") << "\n";
+		std::vector<Model*> models = setupModels(meshFlags, gbufferDefines, multiDraw);
+		//The instancing and light benchmarks step through these instance and light counts
+		const size_t benchCounts[] = { 1, 10, 100, 1000, 10000, 100000 };
+		const size_t benchSteps = sizeof(benchCounts) / sizeof(benchCounts[0]);
+		const size_t lightBenchCounts[] = { 0, 16, 64, 256, 1024, 4096 };
+		const size_t lightBenchSteps = sizeof(lightBenchCounts) / sizeof(lightBenchCounts[0]);
+		const int BENCH_FRAMES = 100;
+		InstancedModel *instanced = nullptr;
+		if (instanceCount > 0 || instanceBench){
+			instanced = setupInstancedModel(meshFlags, gbufferDefines);
+			if (!instanced){
+				return 1;
 			}
-			if (e.type == SDL_KEYDOWN){
-				//Move the main subject around (model 0)
-				switch (e.key.keysym.sym){
-					case SDLK_f:
-						printFps = !printFps;
-						break;
-					case SDLK_a:
-						models.at(0)->translate(frameTime * glm::vec3(-2.f, 0.f, 0.f));
-						break;
-					case SDLK_d:
-						models.at(0)->translate(frameTime * glm::vec3(2.f, 0.f, 0.f));
-						break;
-					case SDLK_w:
-						models.at(0)->translate(frameTime * glm::vec3(0.f, 2.f, 0.f));
-						break;
-					case SDLK_s:
-						models.at(0)->translate(frameTime * glm::vec3(0.f, -2.f, 0.f));
-						break;
-					case SDLK_z:
-						models.at(0)->translate(frameTime * glm::vec3(0.f, 0.f, -2.f));
-						break;
-					case SDLK_x:
-						models.at(0)->translate(frameTime * glm::vec3(0.f, 0.f, 2.f));
-						break;
-					case SDLK_q:
-						models.at(0)->rotate(glm::rotate<GLfloat>(frameTime * -45.f, 0.f, 1.f, 0.f));
-						break;
-					case SDLK_e:
-						models.at(0)->rotate(glm::rotate<GLfloat>(frameTime * 45.f, 0.f, 1.f, 0.f));
-						break;
-					default:
-						break;
+			layoutInstances(*instanced, instanceBench ? benchCounts[0] : instanceCount);
+			models.push_back(instanced);
+		}
+		//Don't let vsync hide the cost of drawing the instances or lights
+		if (instanceBench || lightBench || headless){
+			SDL_GL_SetSwapInterval(0);
+		}
+		//Report how much VBO memory the packed vertex layouts are saving us
+		size_t vboBytes = 0, floatVboBytes = 0;
+		for (Model *m : models){
+			vboBytes += m->meshInfo().vboBytes();
+			floatVboBytes += m->meshInfo().floatVboBytes();
+		}
+		std::cout << "Scene VBO memory: " << vboBytes << " bytes, " << floatVboBytes
+			<< " bytes with the float vertex layout\n";
+		geometry::printStats();
+		//Cull the models against the camera and the shadow cascades through a BVH
+		//over their world space boxes, refit as the models move
+		Bvh bvh;
+		std::vector<int> modelOf;
+		buildBvh(bvh, models, modelOf);
+		std::vector<size_t> cameraVisible;
+		//The models hidden behind the Hi-Z depth and the ones that moved this frame,
+		//which can't be tested against it
+		std::vector<size_t> occludedModels;
+		std::vector<char> movingModels(models.size(), 0);
+		//The visible models are drawn sorted by the state they need
+		RenderQueue gbufferQueue;
+
+		//The light direction and half vector
+		glm::vec4 lightDir = glm::normalize(glm::vec4(1.f, 0.f, 1.f, 0.f));
+
+		//Occlusion culling against the depth buffer of earlier frames
+		HiZ hiz(winWidth, winHeight);
+		occlusion = occlusion && hiz.ready();
+
+		//Need another shader program for the second pass
+		const std::string secondPassDefines = gbufferDefines
+			+ (shadowLayers ? "#define SHADOW_LAYERS\n" : "");
+		GLint progStatus = loadSecondPass(secondPassDefines
+			+ (untiledLights ? "#define UNTILED_LIGHTS\n" : ""));
+		if (progStatus == -1){
+			return 1;
+		}
+		GLuint quadProg = progStatus;
+
+		//The point and spot lights are binned into screen tiles for the second pass
+		LightGrid lightGrid(winWidth, winHeight);
+		lightGrid.setupProgram(quadProg);
+		std::vector<Light> lights = makeLights(lightBench ? lightBenchCounts[0] : lightCount);
+
+		//We render the second pass onto a quad drawn to the NDC
+		Model quad("res/quad.obj", quadProg);
+
+		//Or shade just the directional light in the second pass and draw a volume
+		//for each point and spot light
+		progStatus = loadSecondPass(secondPassDefines + "#define NO_LIGHT_LIST\n");
+		if (progStatus == -1){
+			return 1;
+		}
+		Model directionalQuad("res/quad.obj", progStatus);
+		LightVolumes volumes(lightGrid, gbufferDefines);
+		const bool volumesReady = volumes.ready();
+		lightVolumes = lightVolumes && volumesReady;
+		size_t volumesDrawn = 0;
+
+		//The geometry and lighting passes draw into a rect of the targets scaled
+		//to hold the frame budget, the lighting is then upscaled to the window.
+		//The light volumes test against a copy of the G-buffer's depth
+		DynamicResolution dynamicRes(winWidth, winHeight,
+			volumesReady ? gbuffer.depthStencilFormat() : GL_NONE, frameBudget, minScale);
+		if (!dynamicRes.ready()){
+			return 1;
+		}
+		if (headless && frameBudget > 0.f){
+			std::cout << "Headless runs draw at a fixed full resolution, ignoring --frame-budget\n";
+		}
+
+		//Setup the shadow cascades, each cascade is only redrawn while something
+		//it draws has changed. With shadow layers the cascades on unit 3 only hold
+		//the casters that have never moved and the ones that have are drawn into
+		//a second set of cascades on unit 5
+		ShadowCascades shadowCascades(shadowSize, cascadeCount, GL_TEXTURE3, shadowDistance);
+		ShadowCascades dynamicShadowCascades(shadowLayers ? shadowSize : 1, cascadeCount,
+			GL_TEXTURE5, shadowDistance);
+		if (!shadowCascades.ready() || !dynamicShadowCascades.ready()){
+			return 1;
+		}
+		//Which casters go in each set of cascades, all of them without shadow layers
+		std::vector<char> dynamicCaster(models.size(), 0);
+		std::vector<char> staticLayer(models.size(), 1), dynamicLayer(models.size(), 0);
+		
+		//Setup a debug output quad to be drawn to NDC after all other rendering
+		//showing one of the shadow cascades, C picks which
+		GLuint dbgProgram = programcache::acquire("res/vforward.glsl", "res/fforward_lum.glsl",
+			"#define ARRAY_TEXTURE\n");
+		Model dbgOut("res/quad.obj", dbgProgram);
+		dbgOut.scale(glm::vec3(0.3f, 0.3f, 1.f));
+		dbgOut.translate(glm::vec3(-0.7f, 0.7f, 0.f));
+		programcache::use(dbgProgram);
+		GLuint dbgTex = glGetUniformLocation(dbgProgram, "tex");
+		glUniform1i(dbgTex, 3);
+		GLint dbgLayerUnif = glGetUniformLocation(dbgProgram, "layer");
+		int dbgCascade = 0;
+
+		//The passes timed in headless runs, by the profiler sections of the same names
+		std::vector<std::string> benchPasses;
+		if (headless){
+			benchPasses = { "shadow", "gbuffer", "lighting" };
+		}
+		BenchStats benchStats(benchPasses, warmupFrames);
+		std::vector<double> benchPassMs;
+		//Where the scripted path last left model 0
+		glm::vec3 scriptedOffset(0.f);
+
+		//CPU and GPU times of the passes, P shows a rolling summary of them in
+		//the window title and on stdout. Headless runs need every frame's times
+		//for their stats so they wait on the GPU for them
+		Profiler profiler(headless);
+		bool printProfile = false;
+		size_t profileFrames = 0;
+
+		if (util::logGLError("Pre-loop error check")){
+			return 1;
+		}
+		//With a warm binary cache the setup time should drop since nothing's compiled
+		const programcache::Stats &progStats = programcache::stats();
+		std::cout << "Programs linked: " << progStats.linked << ", shared: " << progStats.shared
+			<< ", from binary cache: " << progStats.binaryLoads << ", shader setup time: "
+			<< progStats.seconds * 1000.0 << "ms ("
+			<< (progStats.binaryLoads == progStats.linked && progStats.linked > 0 ? "warm" : "cold")
+			<< " start)\n";
+		
+		size_t benchStep = 0;
+		int benchFrames = 0;
+		Uint64 benchStart = SDL_GetPerformanceCounter();
+		//For tracking fps and program switches per frame
+		float frameTime = 0.0;
+		size_t programSwitches = programcache::stats().switches;
+		bool printFps = false;
+		int start = SDL_GetTicks();
+		SDL_Event e;
+		bool quit = false;
+		while (!quit){
+			const Uint64 frameStart = SDL_GetPerformanceCounter();
+			profiler.begin("frame");
+			while (SDL_PollEvent(&e)){
+				if (e.type == SDL_QUIT || (e.type == SDL_KEYDOWN && e.key.keysym.sym == SDLK_ESCAPE)){
+					quit = true;
+				}
+				//Resize the targets to the window, they're only reallocated here and
+				//not when the resolution scale changes
+				if (e.type == SDL_WINDOWEVENT && e.window.event == SDL_WINDOWEVENT_SIZE_CHANGED
+					&& e.window.data1 > 0 && e.window.data2 > 0)
+				{
+					winWidth = e.window.data1;
+					winHeight = e.window.data2;
+					projection = glm::perspective(FOV, winWidth / static_cast<float>(winHeight),
+						1.f, 100.f);
+					gbuffer.resize(winWidth, winHeight);
+					dynamicRes.resize(winWidth, winHeight);
+					hiz.resize(winWidth, winHeight);
+					lightGrid.resize(winWidth, winHeight);
+					lightGrid.setupProgram(quadProg);
+				}
+				if (e.type == SDL_KEYDOWN){
+					//Move the main subject around (model 0)
+					switch (e.key.keysym.sym){
+						case SDLK_f:
+							printFps = !printFps;
+							break;
+						case SDLK_g:
+							glcheck::setMode(static_cast<glcheck::Mode>((glcheck::mode() + 1) % 3));
+							std::cout << "GL error checks: " << glcheck::modeName(glcheck::mode()) << "\n";
+							break;
+						case SDLK_p:
+							printProfile = !printProfile;
+							if (!printProfile){
+								SDL_SetWindowTitle(win, "Deferred Renderer");
+							}
+							break;
+						case SDLK_c:
+							dbgCascade = (dbgCascade + 1) % shadowCascades.cascades();
+							break;
+						case SDLK_l:
+							lightVolumes = !lightVolumes && volumesReady;
+							std::cout << "Lighting with " << (lightVolumes ? "light volumes\n" : "tile lists\n");
+							break;
+						case SDLK_a:
+							models.at(0)->translate(frameTime * glm::vec3(-2.f, 0.f, 0.f));
+							break;
+						case SDLK_d:
+							models.at(0)->translate(frameTime * glm::vec3(2.f, 0.f, 0.f));
+							break;
+						case SDLK_w:
+							models.at(0)->translate(frameTime * glm::vec3(0.f, 2.f, 0.f));
+							break;
+						case SDLK_s:
+							models.at(0)->translate(frameTime * glm::vec3(0.f, -2.f, 0.f));
+							break;
+						case SDLK_z:
+							models.at(0)->translate(frameTime * glm::vec3(0.f, 0.f, -2.f));
+							break;
+						case SDLK_x:
+							models.at(0)->translate(frameTime * glm::vec3(0.f, 0.f, 2.f));
+							break;
+						case SDLK_q:
+							models.at(0)->rotate(glm::rotate<GLfloat>(frameTime * -45.f, 0.f, 1.f, 0.f));
+							break;
+						case SDLK_e:
+							models.at(0)->rotate(glm::rotate<GLfloat>(frameTime * 45.f, 0.f, 1.f, 0.f));
+							break;
+						default:
+							break;
+					}
 				}
 			}
-		}
-		//Shadow map pass
-		renderShadowMap(shadowFbo, models);
+			//Headless runs orbit the camera around the scene while the main subject
+			//sways side to side, holding still at the start during the warm-up
+			if (headless){
+				const float t = benchStats.frames() * HEADLESS_STEP;
+				viewPos = glm::vec4(5.f * std::sin(t * 0.5f), 1.f + std::sin(t * 0.3f),
+					5.f * std::cos(t * 0.5f), 1.f);
+				view = glm::lookAt(glm::vec3(viewPos), glm::vec3(0.f, 0.f, 0.f),
+					glm::vec3(0.f, 1.f, 0.f));
+				const glm::vec3 offset(std::sin(t), 0.f, 0.f);
+				models.at(0)->translate(offset - scriptedOffset);
+				scriptedOffset = offset;
+			}
+			//Upload the camera and light state once for all programs
+			frameData.proj = projection;
+			frameData.view = view;
+			frameData.invProj = glm::inverse(projection);
+			frameData.invView = glm::inverse(view);
+			frameData.lightDir = lightDir;
+			frameData.viewPos = viewPos;
+			frameData.renderScale = dynamicRes.frameScale();
+			frameUniforms.update(frameData);
+			//Both sets of cascades are fit the same so either's Cascades buffer will do
+			const float aspect = winWidth / static_cast<float>(winHeight);
+			shadowCascades.fit(view, FOV, aspect, 1.f, glm::vec3(lightDir));
+			if (shadowLayers){
+				dynamicShadowCascades.fit(view, FOV, aspect, 1.f, glm::vec3(lightDir));
+			}
+
+			//Compose the transforms changed this frame and send them in one batch
+			transforms::update();
+			transforms::upload();
+			//Refit the BVH around the models that moved, the depth we have for
+			//occlusion culling may show them hiding things they no longer hide
+			//and the shadows they cast have moved
+			std::fill(movingModels.begin(), movingModels.end(), 0);
+			for (transforms::Handle h : transforms::updated()){
+				if (h < modelOf.size() && modelOf[h] != -1){
+					const size_t i = modelOf[h];
+					glm::vec3 lo, hi;
+					bvh.bounds(i, lo, hi);
+					hiz.moved(lo, hi);
+					movingModels[i] = 1;
+					models[i]->worldBounds(lo, hi);
+					bvh.update(i, lo, hi);
+					//A caster moving for the first time leaves the static layer
+					if (shadowLayers && !dynamicCaster[i]){
+						dynamicCaster[i] = 1;
+						staticLayer[i] = 0;
+						dynamicLayer[i] = 1;
+						shadowCascades.invalidate();
+					}
+					(shadowLayers ? dynamicShadowCascades : shadowCascades).invalidate();
+				}
+			}
+			const Bvh::CullStats cameraCull = bvh.cull(Frustum(projection * view), cameraVisible);
+			HiZ::Stats occlusionCull = { 0, 0 };
+			if (occlusion){
+				hiz.update();
+				occlusionCull = hiz.cull(bvh, movingModels, cameraVisible, occludedModels);
+			}
+			//Orbit the lights around the scene and bin them for the second pass
+			const float animStep = headless ? (benchStats.warmingUp() ? 0.f : HEADLESS_STEP)
+				: frameTime;
+			const glm::mat3 lightOrbit = glm::mat3(glm::rotate<GLfloat>(animStep * 20.f, 0.f, 1.f, 0.f));
+			for (Light &l : lights){
+				l.pos = lightOrbit * l.pos;
+				l.dir = lightOrbit * l.dir;
+			}
+			//The tiles are laid over the targets, so bin in the render rect's part of them
+			const glm::mat4 targetProj = dynamicRes.targetProjection() * projection;
+			const LightGrid::Stats lightStats = lightGrid.update(lights, view, targetProj);
 
-		//First pass
-		glBindFramebuffer(GL_FRAMEBUFFER, fbo);
-		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+			//Pick each model's levels of detail for this frame, size in pixels of one
+			//unit at a distance of 1 from the camera projects the errors to the screen
+			const float lodPixelsPerUnit = dynamicRes.renderHeight()
+				/ (2.f * std::tan(glm::radians(FOV) / 2.f));
+			for (Model *m : models){
+				m->selectLod(glm::vec3(viewPos), lodPixelsPerUnit, lodError, shadowLodBias);
+			}
+			//Shadow pass, each cascade culls its own casters and is only redrawn
+			//if they changed
+			{
+				Profiler::Scope scope(profiler, "shadow");
+				shadowCascades.render(bvh, models, staticLayer);
+				if (shadowLayers){
+					dynamicShadowCascades.render(bvh, models, dynamicLayer);
+				}
+			}
+
+			//First pass
+			{
+				Profiler::Scope scope(profiler, "gbuffer");
+				glBindFramebuffer(GL_FRAMEBUFFER, gbuffer.framebuffer());
+				glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+				dynamicRes.viewport();
+				gbufferQueue.resetStats();
+				for (size_t i : cameraVisible){
+					glm::vec3 lo, hi;
+					bvh.bounds(i, lo, hi);
+					gbufferQueue.submit(RenderQueue::GBUFFER, models[i],
+						glm::length((lo + hi) * 0.5f - glm::vec3(viewPos)));
+				}
+				gbufferQueue.execute();
+				//The depth we culled against is a few frames old, so draw the culled
+				//models whose boxes show in front of this frame's depth
+				if (!occludedModels.empty()){
+					hiz.testOccluded(bvh, occludedModels);
+					for (size_t j = 0; j < occludedModels.size(); ++j){
+						Model *m = models[occludedModels[j]];
+						hiz.beginRevealed(j);
+						m->bind();
+						m->draw();
+						hiz.endRevealed();
+					}
+				}
+			}
+			glcheck::check("post first pass");
+			if (occlusion){
+				hiz.capture(gbuffer.texture(GBuffer::DEPTH_STENCIL), targetProj * view);
+			}
+
+			//Second pass, the light volumes depth test against a copy of the G-buffer's depth
+			{
+				Profiler::Scope scope(profiler, "lighting");
+				dynamicRes.begin(lightVolumes ? gbuffer.framebuffer() : 0);
+				glDepthMask(GL_FALSE);
+				glDisable(GL_DEPTH_TEST);
+				Model &lightingQuad = lightVolumes ? directionalQuad : quad;
+				lightingQuad.bind();
+				lightingQuad.draw();
+				glEnable(GL_DEPTH_TEST);
+				glDepthMask(GL_TRUE);
+				if (lightVolumes){
+					volumesDrawn = volumes.render(lights, projection * view);
+				}
+				dynamicRes.resolve();
+			}
+
+			glcheck::check("post second pass");
+
+			//Draw debug texture, headless runs leave it out of the frame
+			if (!headless){
+				Profiler::Scope scope(profiler, "overlay");
+				glDisable(GL_DEPTH_TEST);
+				//Unset the compare mode so that we can draw it properly
+				glActiveTexture(GL_TEXTURE3);
+				glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_MODE, GL_NONE);
+				dbgOut.bind();
+				glUniform1i(dbgLayerUnif, dbgCascade);
+				dbgOut.draw();
+				//Set it back to the shadow map compare mode
+				glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+				glEnable(GL_DEPTH_TEST);
+			}
+			profiler.end();
+			profiler.endFrame();
+			if (headless){
+				//Time the frame until the GPU has finished it, the last frame is
+				//saved before it's swapped away
+				glFinish();
+				profiler.gpuTimes(benchStats.passNames(), benchPassMs);
+				benchStats.endFrame((SDL_GetPerformanceCounter() - frameStart) * 1000.0
+					/ SDL_GetPerformanceFrequency(), benchPassMs);
+				if (benchStats.frames() == static_cast<size_t>(headlessFrames)){
+					if (!dumpImage.empty()){
+						util::saveScreenshot(dumpImage, winWidth, winHeight);
+					}
+					benchStats.writeJson(statsJson, winWidth, winHeight);
+					quit = true;
+				}
+			}
+
+			SDL_GL_SwapWindow(win);
+			glcheck::endFrame();
+			//Pack the geometry arenas if released meshes have left them fragmented
+			geometry::defragment();
+			if (printProfile && ++profileFrames % PROFILE_FRAMES == 0){
+				const std::string summary = profiler.summaryLine(PROFILE_FRAMES);
+				std::cout << summary << "\n";
+				SDL_SetWindowTitle(win, ("Deferred Renderer - " + summary).c_str());
+			}
+			int end = SDL_GetTicks();
+			//Keep a smoothed average of the time per frame
+			frameTime = 0.9 * (end - start) / 1000.f + 0.1 * frameTime;
+			start = end;
+			//Headless runs keep the scale fixed so they draw the same frames every run
+			if (!headless){
+				dynamicRes.update(frameTime);
+			}
+			if (printFps){
+				std::cout << "frame time: " << frameTime << "ms, program switches: "
+					<< programcache::stats().switches - programSwitches
+					<< ", camera tested/culled/drawn: " << cameraCull.objectsTested << "/"
+					<< cameraCull.culled << "/" << cameraCull.drawn
+					<< ", occluded: " << occlusionCull.occluded << "/" << occlusionCull.tested
+					<< (hiz.active() ? "" : " (no depth yet)")
+					<< ", lights on screen: " << lightStats.visible << "/" << lights.size()
+					<< ", light indices: " << lightStats.indices << ", binning: " << lightStats.ms
+					<< "ms";
+				if (lightVolumes){
+					std::cout << ", light volumes drawn: " << volumesDrawn;
+				}
+				std::cout << ", render resolution: " << dynamicRes.renderWidth() << "x"
+					<< dynamicRes.renderHeight() << " of " << winWidth << "x" << winHeight;
+				//Casters drawn into each cascade and its GPU time, or skipped if it
+				//was left as it was
+				std::cout << ", cascades drawn/ms:";
+				for (int c = 0; c < shadowCascades.cascades(); ++c){
+					std::cout << " " << shadowCascades.drawn(c) << "/";
+					if (shadowCascades.skipped(c)){
+						std::cout << "skipped";
+					}
+					else {
+						std::cout << shadowCascades.ms(c);
+					}
+					if (shadowLayers){
+						std::cout << " (moving " << dynamicShadowCascades.drawn(c) << "/";
+						if (dynamicShadowCascades.skipped(c)){
+							std::cout << "skipped)";
+						}
+						else {
+							std::cout << dynamicShadowCascades.ms(c) << ")";
+						}
+					}
+				}
+				std::cout << ", shadow passes skipped: "
+					<< shadowCascades.skippedPasses() + dynamicShadowCascades.skippedPasses() << "/"
+					<< shadowCascades.skippedPasses() + dynamicShadowCascades.skippedPasses()
+					+ shadowCascades.renderedPasses() + dynamicShadowCascades.renderedPasses();
+				//Binds the shadow and G-buffer passes would make drawing each model
+				//in the order they're culled, and what they made sorted and filtered
+				RenderQueue::Stats stateStats = gbufferQueue.stats();
+				for (const ShadowCascades *sc : { &shadowCascades, &dynamicShadowCascades }){
+					stateStats.draws += sc->stateStats().draws;
+					stateStats.unsortedChanges += sc->stateStats().unsortedChanges;
+					stateStats.changes += sc->stateStats().changes;
+					stateStats.drawCalls += sc->stateStats().drawCalls;
+				}
+				std::cout << ", state changes unsorted/sorted: " << stateStats.unsortedChanges << "/"
+					<< stateStats.changes << " for " << stateStats.draws << " draws in "
+					<< stateStats.drawCalls << " submissions";
+				const glcheck::Stats glStats = glcheck::stats();
+				std::cout << ", GL errors (" << glcheck::modeName(glcheck::mode()) << "): "
+					<< glStats.errors << " in " << glStats.polls << " polls, debug errors: "
+					<< glStats.debugErrors << "/" << glStats.debugMessages;
+				std::cout << "\n";
+			}
+			programSwitches = programcache::stats().switches;
+
+			if (lightBench && ++benchFrames == BENCH_FRAMES){
+				glFinish();
+				double ms = (SDL_GetPerformanceCounter() - benchStart) * 1000.0
+					/ SDL_GetPerformanceFrequency() / BENCH_FRAMES;
+				std::cout << "Lights: " << lightBenchCounts[benchStep] << ", frame time: " << ms
+					<< "ms, light indices: " << lightStats.indices << ", binning: "
+					<< lightStats.ms << "ms" << (lightVolumes ? ", light volumes\n" : "\n");
+				if (++benchStep == lightBenchSteps){
+					quit = true;
+				}
+				else {
+					lights = makeLights(lightBenchCounts[benchStep]);
+				}
+				benchFrames = 0;
+				benchStart = SDL_GetPerformanceCounter();
+			}
+			else if (instanceBench && ++benchFrames == BENCH_FRAMES){
+				//Wait for the GPU so we time the frames it actually finished
+				glFinish();
+				double ms = (SDL_GetPerformanceCounter() - benchStart) * 1000.0
+					/ SDL_GetPerformanceFrequency() / BENCH_FRAMES;
+				std::cout << "Instances: " << benchCounts[benchStep] << ", frame time: " << ms
+					<< "ms, " << benchCounts[benchStep] * instanced->elems() / 3 / (ms / 1000.0)
+					<< " full detail tris/s\n";
+				if (++benchStep == benchSteps){
+					quit = true;
+				}
+				else {
+					glm::vec3 lo, hi;
+					bvh.bounds(models.size() - 1, lo, hi);
+					hiz.moved(lo, hi);
+					layoutInstances(*instanced, benchCounts[benchStep]);
+					instanced->worldBounds(lo, hi);
+					bvh.update(models.size() - 1, lo, hi);
+					(dynamicCaster.back() ? dynamicShadowCascades : shadowCascades).invalidate();
+				}
+				benchFrames = 0;
+				benchStart = SDL_GetPerformanceCounter();
+			}
+		}
+		if (!traceFile.empty()){
+			profiler.writeTrace(traceFile);
+		}
 		for (Model *m : models){
-			m->bind();
-			glDrawElements(GL_TRIANGLES, m->elems(), GL_UNSIGNED_SHORT, 0);
-		}
-		util::logGLError("post first pass");
-
-		//Second pass
-		glBindFramebuffer(GL_FRAMEBUFFER, 0);
-		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-		quad.bind();
-		glDrawElements(GL_TRIANGLES, quad.elems(), GL_UNSIGNED_SHORT, 0);
-
-		util::logGLError("post second pass");
-
-		//Draw debug texture
-		glDisable(GL_DEPTH_TEST);
-		//Unset the compare mode so that we can draw it properly
-		glActiveTexture(GL_TEXTURE3);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_NONE);
-		dbgOut.bind();
-		glDrawElements(GL_TRIANGLES, dbgOut.elems(), GL_UNSIGNED_SHORT, 0);
-		//Set it back to the shadow map compare mode
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
-		glEnable(GL_DEPTH_TEST);
-
-		SDL_GL_SwapWindow(win);
-		int end = SDL_GetTicks();
-		//Keep a smoothed average of the time per frame
-		frameTime = 0.9 * (end - start) / 1000.f + 0.1 * frameTime;
-		start = end;
-		if (printFps){
-			std::cout << "frame time: " << frameTime << "ms\n";
+			delete m;
 		}
 	}
-	glDeleteFramebuffers(1, &shadowFbo);
-	glDeleteTextures(1, &shadowTex);
-
-	glDeleteFramebuffers(1, &fbo);
-	glDeleteTextures(3, texBuffers);
+	geometry::shutdown();
+	transforms::shutdown();
 	
 	SDL_GL_DeleteContext(context);
 	SDL_DestroyWindow(win);
 
 	return 0;
 }
-std::vector<Model*> setupModels(const glm::mat4 &view, const glm::mat4 &proj){
+std::vector<Model*> setupModels(unsigned meshFlags, const std::string &gbufferDefines,
+	bool multiDraw)
+{
 	std::vector<Model*> models;
-	GLint progStatus = util::loadProgram("res/vshader.glsl", "res/fshader.glsl");
+	//The multi-draw programs' draw_transforms are sized to the queue's batches
+	const std::string drawDefines = multiDraw ? "#define MULTI_DRAW\n#define MAX_BATCH "
+		+ std::to_string(RenderQueue::MAX_BATCH) + "\n" : "";
+	GLint progStatus = programcache::acquire("res/vshader.glsl", "res/fshader.glsl",
+		gbufferDefines + drawDefines);
 	if (progStatus == -1){
 		std::cerr << "Failed to load program\n";
 		return models;
 	}
 	GLuint program = progStatus;
-	glUseProgram(program);
+	programcache::use(program);
+	//Each model binds its diffuse texture to unit 4 when it's drawn
+	GLuint texUnif = glGetUniformLocation(program, "tex_diffuse");
+	glUniform1i(texUnif, 4);
+	FrameUniforms::bindBlock(program);
+
+	progStatus = programcache::acquire("res/vshadow.glsl", "res/fshadow.glsl", drawDefines);
+	if (progStatus == -1){
+		std::cerr << "Failed to load shadow program\n";
+		return models;
+	}
+	GLuint shadowProgram = progStatus;
+	FrameUniforms::bindBlock(shadowProgram);
+	ShadowCascades::bindBlocks(shadowProgram);
 
 	//Load a texture for the polyhedron
 	glActiveTexture(GL_TEXTURE4);
 	GLuint texture = util::loadTexture("res/texture.bmp");
-	glBindTexture(GL_TEXTURE_2D, texture);
-	GLuint texUnif = glGetUniformLocation(program, "tex_diffuse");
-	glUniform1i(texUnif, 4);
-	//Pass the view/projection matrices
-	GLint projUnif = glGetUniformLocation(program, "proj");
-	GLint viewUnif = glGetUniformLocation(program, "view");
-	glUniformMatrix4fv(projUnif, 1, GL_FALSE, glm::value_ptr(proj));
-	glUniformMatrix4fv(viewUnif, 1, GL_FALSE, glm::value_ptr(view));
-
-	GLuint shadowProgram = util::loadProgram("res/vshadow.glsl", "res/fshadow.glsl");
 	//With suzanne the self-shadowing is much easier to see
-	Model *polyhedron = new Model("res/suzanne.obj", program, shadowProgram);
+	Model *polyhedron = new Model("res/suzanne.obj", program, shadowProgram, meshFlags);
+	polyhedron->setTexture(texture, 4);
+	polyhedron->setMaterial(0.8f, 96.f);
 	polyhedron->translate(glm::vec3(1.f, 0.f, 1.f));
 	models.push_back(polyhedron);
 
-	//TODO: Perhaps in the future a way to share programs across models and optimize drawing
-	//order to reduce calls to glUseProgram? could also share proj/view matrices with UBOs
-	progStatus = util::loadProgram("res/vshader.glsl", "res/fshader.glsl");
-	if (progStatus == -1){
-		std::cerr << "Failed to load program\n";
-		return models;
-	}
-	program = progStatus;
-	glUseProgram(program);
+	//The floor shares the programs, we just need another reference to them
+	programcache::acquire("res/vshader.glsl", "res/fshader.glsl", gbufferDefines + drawDefines);
+	programcache::acquire("res/vshadow.glsl", "res/fshadow.glsl", drawDefines);
 
 	//Load a texture for the floor
-	glActiveTexture(GL_TEXTURE5);
+	glActiveTexture(GL_TEXTURE4);
 	texture = util::loadTexture("res/texture2.bmp");
-	glBindTexture(GL_TEXTURE_2D, texture);
-	texUnif = glGetUniformLocation(program, "tex_diffuse");
-	glUniform1i(texUnif, 5);
-	
-	projUnif = glGetUniformLocation(program, "proj");
-	viewUnif = glGetUniformLocation(program, "view");
-	glUniformMatrix4fv(projUnif, 1, GL_FALSE, glm::value_ptr(proj));
-	glUniformMatrix4fv(viewUnif, 1, GL_FALSE, glm::value_ptr(view));
-
-	shadowProgram = util::loadProgram("res/vshadow.glsl", "res/fshadow.glsl");
-	Model *floor = new Model("res/quad.obj", program, shadowProgram);
+	Model *floor = new Model("res/quad.obj", program, shadowProgram, meshFlags);
+	floor->setTexture(texture, 4);
+	floor->setMaterial(0.1f, 8.f);
 	//Get it laying perpindicularish to the light direction and behind the camera some
 	floor->scale(glm::vec3(3.f, 3.f, 1.f));
 	floor->rotate(glm::rotate(-35.f, 1.f, 0.f, 0.f));
@@ -350,75 +945,111 @@ std::vector<Model*> setupModels(const glm::mat4 &view, const glm::mat4 &proj){
 
 	return models;
 }
-void setupShadowMap(GLuint &fbo, GLuint &tex){
-	glActiveTexture(GL_TEXTURE3);
-	glGenTextures(1, &tex);
-	glBindTexture(GL_TEXTURE_2D, tex);
-	//Will just use a shadow map equal to the window dimensions
-	//Must use specific formats for depth_stencil attachment
-	//Mesa refuses to accept this type/format combination, what is valid?
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT32F,
-		WIN_WIDTH, WIN_HEIGHT, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
-	//No mip maps
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, 0);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	//Setup depth comparison mode
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE,	GL_COMPARE_REF_TO_TEXTURE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
-	//Don't wrap edges
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-
-	glGenFramebuffers(1, &fbo);
-	glBindFramebuffer(GL_FRAMEBUFFER, fbo);
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, tex, 0);
-	glDrawBuffer(GL_NONE);
-
-	GLenum fboStatus = glCheckFramebufferStatus(GL_FRAMEBUFFER);
-	switch (fboStatus){
-	case GL_FRAMEBUFFER_UNDEFINED:
-		std::cout << "Shadow FBO incomplete: undefined\n";
-		break;
-	case GL_FRAMEBUFFER_INCOMPLETE_ATTACHMENT:
-		std::cout << "Shadow FBO incomplete: attachment\n";
-		break;
-	case GL_FRAMEBUFFER_INCOMPLETE_MISSING_ATTACHMENT:
-		std::cout << "Shadow FBO incomplete: missing attachment\n";
-		break;
-	case GL_FRAMEBUFFER_INCOMPLETE_DRAW_BUFFER:
-		std::cout << "Shadow FBO incomplete: draw buffer\n";
-		break;
-	case GL_FRAMEBUFFER_INCOMPLETE_READ_BUFFER:
-		std::cout << "Shadow FBO incomplete: read buffer\n";
-		break;
-	case GL_FRAMEBUFFER_UNSUPPORTED:
-		std::cout << "Shadow FBO incomplete: unsupported\n";
-		break;
-	case GL_FRAMEBUFFER_INCOMPLETE_MULTISAMPLE:
-		std::cout << "Shadow FBO incomplete: multisample\n";
-		break;
-	case GL_FRAMEBUFFER_INCOMPLETE_LAYER_TARGETS:
-		std::cout << "Shadow FBO incomplete: layer targets\n";
-		break;
-	default:
-		break;
+InstancedModel* setupInstancedModel(unsigned meshFlags, const std::string &gbufferDefines){
+	//The same shaders as the other models, but taking the model matrix per instance
+	GLint program = programcache::acquire("res/vshader.glsl", "res/fshader.glsl",
+		"#define INSTANCED\n" + gbufferDefines);
+	GLint shadowProgram = programcache::acquire("res/vshadow.glsl", "res/fshadow.glsl",
+		"#define INSTANCED\n");
+	if (program == -1 || shadowProgram == -1){
+		std::cerr << "Failed to load instanced programs\n";
+		return nullptr;
 	}
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
-	util::logGLError("Setup shadow map fbo & texture");
+	programcache::use(program);
+	GLuint texUnif = glGetUniformLocation(program, "tex_diffuse");
+	glUniform1i(texUnif, 4);
+	FrameUniforms::bindBlock(program);
+	FrameUniforms::bindBlock(shadowProgram);
+	ShadowCascades::bindBlocks(shadowProgram);
+
+	glActiveTexture(GL_TEXTURE4);
+	GLuint texture = util::loadTexture("res/texture.bmp");
+	InstancedModel *model = new InstancedModel("res/suzanne.obj", program, shadowProgram,
+		meshFlags);
+	model->setTexture(texture, 4);
+	return model;
 }
-void renderShadowMap(GLuint &fbo, const std::vector<Model*> &models){
-	glBindFramebuffer(GL_FRAMEBUFFER, fbo);
-	glClear(GL_DEPTH_BUFFER_BIT);
-	//Polygon offset fill helps resolve depth-fighting
-	glEnable(GL_POLYGON_OFFSET_FILL);
-	glPolygonOffset(2.f, 4.f);
-	for (Model *m : models){
-		m->bindShadow();
-		glDrawElements(GL_TRIANGLES, m->elems(), GL_UNSIGNED_SHORT, 0);
+void layoutInstances(InstancedModel &model, size_t count){
+	model.clearInstances();
+	size_t side = 1;
+	while (side * side * side < count){
+		++side;
+	}
+	//Fit the cube of instances in a 4 unit box, suzanne is about 2.7 units across
+	const float spacing = 4.f / side;
+	const glm::mat4 scale = glm::scale<GLfloat>(glm::vec3(spacing / 3.f));
+	for (size_t i = 0; i < count; ++i){
+		glm::vec3 pos(i % side, (i / side) % side, i / (side * side));
+		pos = (pos + 0.5f) * spacing - 2.f;
+		model.addInstance(glm::translate<GLfloat>(pos) * scale);
 	}
-	glDisable(GL_POLYGON_OFFSET_FILL);
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
-
 }
+void buildBvh(Bvh &bvh, const std::vector<Model*> &models, std::vector<int> &modelOf){
+	//Make sure the models' matrices are composed before taking their boxes
+	transforms::update();
+	std::vector<glm::vec3> lo(models.size()), hi(models.size());
+	modelOf.clear();
+	for (size_t i = 0; i < models.size(); ++i){
+		models[i]->worldBounds(lo[i], hi[i]);
+		const transforms::Handle h = models[i]->transformHandle();
+		if (h >= modelOf.size()){
+			modelOf.resize(h + 1, -1);
+		}
+		modelOf[h] = i;
+	}
+	bvh.build(lo, hi);
+}
+GLint loadSecondPass(const std::string &defines){
+	GLint progStatus = programcache::acquire("res/vsecondpass.glsl", "res/fsecondpass.glsl",
+		defines);
+	if (progStatus == -1){
+		return -1;
+	}
+	GLuint program = progStatus;
+	programcache::use(program);
+	GLuint diffuseUnif = glGetUniformLocation(program, "diffuse");
+	GLuint normalUnif = glGetUniformLocation(program, "normal");
+	GLuint depthUnif = glGetUniformLocation(program, "depth");
+	glUniform1i(diffuseUnif, 0);
+	glUniform1i(normalUnif, 1);
+	glUniform1i(depthUnif, 2);
 
+	//The camera and light data comes from the Frame uniform block and the
+	//cascades' matrices and splits from the Cascades block
+	FrameUniforms::bindBlock(program);
+	ShadowCascades::bindBlocks(program);
+
+	//Shadow cascades are bound to texture unit 3 and the moving casters' to unit 5
+	GLuint shadowMapUnif = glGetUniformLocation(program, "shadow_map");
+	glUniform1i(shadowMapUnif, 3);
+	GLint dynamicShadowMapUnif = glGetUniformLocation(program, "dynamic_shadow_map");
+	glUniform1i(dynamicShadowMapUnif, 5);
+	return program;
+}
+std::vector<Light> makeLights(size_t count){
+	std::vector<Light> lights(count);
+	//Fixed seed so benchmark runs are comparable
+	std::srand(1);
+	for (size_t i = 0; i < count; ++i){
+		Light &l = lights[i];
+		l.pos = glm::vec3(std::rand() / static_cast<float>(RAND_MAX) * 8.f - 4.f,
+			std::rand() / static_cast<float>(RAND_MAX) * 4.f - 2.f,
+			std::rand() / static_cast<float>(RAND_MAX) * 8.f - 4.f);
+		l.color = glm::vec3(std::rand() / static_cast<float>(RAND_MAX),
+			std::rand() / static_cast<float>(RAND_MAX),
+			std::rand() / static_cast<float>(RAND_MAX)) * 0.5f;
+		l.radius = 1.5f;
+		l.dir = glm::vec3(0.f, -1.f, 0.f);
+		if (i % 4 == 3){
+			l.type = Light::SPOT;
+			l.radius = 3.f;
+			l.cosInner = std::cos(glm::radians(20.f));
+			l.cosOuter = std::cos(glm::radians(30.f));
+		}
+		else {
+			l.type = Light::POINT;
+			l.cosInner = l.cosOuter = -1.f;
+		}
+	}
+	return lights;
+}
@@ -0,0 +1,127 @@
+#include <string>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#include "mappedfile.h"
+
+#ifdef _WIN32
+MappedFile::MappedFile() : ptr(nullptr), len(0), mapped(false),
+	file(INVALID_HANDLE_VALUE), mapping(nullptr)
+{}
+#else
+MappedFile::MappedFile() : ptr(nullptr), len(0), mapped(false), fd(-1){}
+#endif
+MappedFile::MappedFile(const std::string &fName) : MappedFile(){
+	open(fName);
+}
+MappedFile::~MappedFile(){
+	close();
+}
+#ifdef _WIN32
+bool MappedFile::open(const std::string &fName){
+	close();
+	file = CreateFileA(fName.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+		OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (file == INVALID_HANDLE_VALUE){
+		return false;
+	}
+	LARGE_INTEGER fsize;
+	if (!GetFileSizeEx(file, &fsize)){
+		close();
+		return false;
+	}
+	len = static_cast<size_t>(fsize.QuadPart);
+	//Can't create a mapping of an empty file
+	if (len == 0){
+		mapped = true;
+		return true;
+	}
+	mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (!mapping){
+		close();
+		return false;
+	}
+	ptr = static_cast<const char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+	if (!ptr){
+		close();
+		return false;
+	}
+	mapped = true;
+	return true;
+}
+void MappedFile::close(){
+	if (ptr){
+		UnmapViewOfFile(ptr);
+	}
+	if (mapping){
+		CloseHandle(mapping);
+	}
+	if (file != INVALID_HANDLE_VALUE){
+		CloseHandle(file);
+	}
+	ptr = nullptr;
+	len = 0;
+	mapped = false;
+	file = INVALID_HANDLE_VALUE;
+	mapping = nullptr;
+}
+#else
+bool MappedFile::open(const std::string &fName){
+	close();
+	fd = ::open(fName.c_str(), O_RDONLY);
+	if (fd == -1){
+		return false;
+	}
+	struct stat st;
+	if (fstat(fd, &st) != 0){
+		close();
+		return false;
+	}
+	len = static_cast<size_t>(st.st_size);
+	//mmap refuses zero length mappings
+	if (len == 0){
+		mapped = true;
+		return true;
+	}
+	void *m = mmap(nullptr, len, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (m == MAP_FAILED){
+		close();
+		return false;
+	}
+	//We read the file front to back so let the kernel read ahead aggressively
+	madvise(m, len, MADV_SEQUENTIAL);
+	ptr = static_cast<const char*>(m);
+	mapped = true;
+	return true;
+}
+void MappedFile::close(){
+	if (ptr){
+		munmap(const_cast<char*>(ptr), len);
+	}
+	if (fd != -1){
+		::close(fd);
+	}
+	ptr = nullptr;
+	len = 0;
+	mapped = false;
+	fd = -1;
+}
+#endif
+bool MappedFile::isOpen() const {
+	return mapped;
+}
+const char* MappedFile::data() const {
+	return ptr;
+}
+size_t MappedFile::size() const {
+	return len;
+}
+
@@ -0,0 +1,219 @@
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include "mesh.h"
+
+namespace {
+	//Allowed half float rounding error for positions, relative to the mesh's size
+	const float POS_TOLERANCE = 1.f / 2048.f;
+	//Allowed half float rounding error for uvs, about a texel of a 1024x1024 texture
+	const float UV_TOLERANCE = 1.f / 1024.f;
+
+	GLuint packSnorm10(float v){
+		int i = static_cast<int>(std::floor(std::min(std::max(v, -1.f), 1.f) * 511.f + 0.5f));
+		return static_cast<GLuint>(i) & 0x3FF;
+	}
+}
+
+MeshInfo::MeshInfo() : layout(VERTEX_FLOAT), indexType(GL_UNSIGNED_SHORT), vertexCount(0),
+	boundsMin(0.f), boundsMax(0.f), sphereCenter(0.f), sphereRadius(0.f)
+{}
+size_t MeshInfo::vboBytes() const {
+	return vertexCount * vertexStride(layout);
+}
+size_t MeshInfo::floatVboBytes() const {
+	return vertexCount * vertexStride(VERTEX_FLOAT);
+}
+
+void splitMesh(const std::vector<Vertex> &vertices, const std::vector<GLuint> &indices,
+	std::vector<Vertex> &outVerts, std::vector<GLushort> &outIndices,
+	std::vector<SubMesh> &subMeshes)
+{
+	const size_t MAX_VERTS = std::numeric_limits<GLushort>::max() + 1;
+	const GLuint UNUSED = std::numeric_limits<GLuint>::max();
+	//Maps a mesh vertex to its index in the current chunk, the vertices
+	//used by the chunk are tracked so the map can be reset cheaply
+	std::vector<GLuint> remap(vertices.size(), UNUSED);
+	std::vector<GLuint> used;
+	used.reserve(MAX_VERTS);
+
+	SubMesh chunk = { 0, static_cast<GLint>(outVerts.size()),
+		outIndices.size() * sizeof(GLushort) };
+	for (size_t i = 0; i + 2 < indices.size(); i += 3){
+		size_t newVerts = 0;
+		for (size_t j = 0; j < 3; ++j){
+			if (remap[indices[i + j]] == UNUSED){
+				++newVerts;
+			}
+		}
+		//Close off the chunk if this triangle won't fit
+		if (used.size() + newVerts > MAX_VERTS){
+			subMeshes.push_back(chunk);
+			for (GLuint v : used){
+				remap[v] = UNUSED;
+			}
+			used.clear();
+			chunk.count = 0;
+			chunk.baseVertex = outVerts.size();
+			chunk.offset = outIndices.size() * sizeof(GLushort);
+		}
+		for (size_t j = 0; j < 3; ++j){
+			GLuint v = indices[i + j];
+			if (remap[v] == UNUSED){
+				remap[v] = used.size();
+				used.push_back(v);
+				outVerts.push_back(vertices[v]);
+			}
+			outIndices.push_back(static_cast<GLushort>(remap[v]));
+		}
+		chunk.count += 3;
+	}
+	if (chunk.count > 0){
+		subMeshes.push_back(chunk);
+	}
+}
+
+size_t vertexStride(VertexLayout layout){
+	switch (layout){
+	case VERTEX_PACKED_FLOAT_POS:
+		return sizeof(PackedVertexFloatPos);
+	case VERTEX_PACKED_HALF_POS:
+		return sizeof(PackedVertexHalfPos);
+	default:
+		return sizeof(Vertex);
+	}
+}
+void computeBounds(const std::vector<Vertex> &vertices, glm::vec3 &lo, glm::vec3 &hi){
+	lo = hi = vertices.empty() ? glm::vec3(0.f) : vertices[0].pos;
+	for (const Vertex &v : vertices){
+		lo = glm::min(lo, v.pos);
+		hi = glm::max(hi, v.pos);
+	}
+}
+VertexLayout chooseLayout(const std::vector<Vertex> &vertices){
+	if (vertices.empty()){
+		return VERTEX_FLOAT;
+	}
+	glm::vec3 lo, hi;
+	computeBounds(vertices, lo, hi);
+	glm::vec3 size = hi - lo;
+	const float posTol = std::max(size.x, std::max(size.y, size.z)) * POS_TOLERANCE;
+	bool halfPos = true;
+	for (const Vertex &v : vertices){
+		for (int i = 0; i < 2; ++i){
+			if (std::abs(unpackHalf(packHalf(v.uv[i])) - v.uv[i]) > UV_TOLERANCE){
+				return VERTEX_FLOAT;
+			}
+		}
+		for (int i = 0; halfPos && i < 3; ++i){
+			halfPos = std::abs(unpackHalf(packHalf(v.pos[i])) - v.pos[i]) <= posTol;
+		}
+	}
+	return halfPos ? VERTEX_PACKED_HALF_POS : VERTEX_PACKED_FLOAT_POS;
+}
+void packVertices(const std::vector<Vertex> &vertices, VertexLayout layout,
+	std::vector<char> &out)
+{
+	out.resize(vertices.size() * vertexStride(layout));
+	switch (layout){
+	case VERTEX_PACKED_FLOAT_POS:
+		for (size_t i = 0; i < vertices.size(); ++i){
+			const Vertex &v = vertices[i];
+			PackedVertexFloatPos p;
+			p.pos[0] = v.pos.x;
+			p.pos[1] = v.pos.y;
+			p.pos[2] = v.pos.z;
+			p.normal = packNormal(v.normal);
+			p.uv[0] = packHalf(v.uv.x);
+			p.uv[1] = packHalf(v.uv.y);
+			std::memcpy(&out[i * sizeof(p)], &p, sizeof(p));
+		}
+		break;
+	case VERTEX_PACKED_HALF_POS:
+		for (size_t i = 0; i < vertices.size(); ++i){
+			const Vertex &v = vertices[i];
+			PackedVertexHalfPos p;
+			p.pos[0] = packHalf(v.pos.x);
+			p.pos[1] = packHalf(v.pos.y);
+			p.pos[2] = packHalf(v.pos.z);
+			p.pos[3] = packHalf(1.f);
+			p.normal = packNormal(v.normal);
+			p.uv[0] = packHalf(v.uv.x);
+			p.uv[1] = packHalf(v.uv.y);
+			std::memcpy(&out[i * sizeof(p)], &p, sizeof(p));
+		}
+		break;
+	default:
+		if (!vertices.empty()){
+			std::memcpy(&out[0], vertices.data(), out.size());
+		}
+	}
+}
+GLhalf packHalf(float f){
+	uint32_t x;
+	std::memcpy(&x, &f, sizeof(x));
+	const uint32_t sign = (x >> 16) & 0x8000;
+	const uint32_t fexp = (x >> 23) & 0xFF;
+	uint32_t mant = x & 0x7FFFFF;
+	//Inf and NaN
+	if (fexp == 0xFF){
+		return sign | 0x7C00 | (mant ? 0x200 : 0);
+	}
+	const int exp = static_cast<int>(fexp) - 127 + 15;
+	//Too big, round to inf
+	if (exp >= 31){
+		return sign | 0x7C00;
+	}
+	//Too small for a normal half, make a denormal or round to 0
+	if (exp <= 0){
+		if (exp < -10){
+			return sign;
+		}
+		mant |= 0x800000;
+		const uint32_t shift = 14 - exp;
+		uint32_t h = mant >> shift;
+		const uint32_t rem = mant & ((1u << shift) - 1);
+		const uint32_t halfway = 1u << (shift - 1);
+		//Round to nearest even, a carry out of the mantissa gives the smallest normal
+		if (rem > halfway || (rem == halfway && (h & 1))){
+			++h;
+		}
+		return sign | h;
+	}
+	uint32_t h = (exp << 10) | (mant >> 13);
+	const uint32_t rem = mant & 0x1FFF;
+	//Round to nearest even, a carry here correctly bumps the exponent (or gives inf)
+	if (rem > 0x1000 || (rem == 0x1000 && (h & 1))){
+		++h;
+	}
+	return sign | h;
+}
+float unpackHalf(GLhalf h){
+	const uint32_t sign = static_cast<uint32_t>(h & 0x8000) << 16;
+	const uint32_t exp = (h >> 10) & 0x1F;
+	const uint32_t mant = h & 0x3FF;
+	if (exp == 0){
+		//Zero or denormal: mant * 2^-24
+		float f = std::ldexp(static_cast<float>(mant), -24);
+		return sign ? -f : f;
+	}
+	uint32_t x;
+	if (exp == 31){
+		x = sign | 0x7F800000 | (mant << 13);
+	}
+	else {
+		x = sign | ((exp - 15 + 127) << 23) | (mant << 13);
+	}
+	float f;
+	std::memcpy(&f, &x, sizeof(f));
+	return f;
+}
+GLuint packNormal(const glm::vec3 &n){
+	//The 2 bit w component is left as 0
+	return packSnorm10(n.x) | (packSnorm10(n.y) << 10) | (packSnorm10(n.z) << 20);
+}
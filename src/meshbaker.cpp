@@ -0,0 +1,61 @@
+#include <iostream>
+#include <string>
+#include "meshcache.h"
+
+/*
+ * Offline baker for the binary mesh cache, bakes each OBJ file passed into
+ * the cache file the renderer will look for next to it. Caches that are
+ * already up to date are left alone unless --force is passed. Pass --split16,
+ * --float-verts, --no-optimize or --no-lod to bake caches for a renderer run
+ * with the same options
+ */
+int main(int argc, char **argv){
+	if (argc < 2){
+		std::cout << "Usage: " << argv[0] << " [--force] [--split16] [--float-verts] [--no-optimize] [--no-lod] model.obj [model2.obj ...]\n";
+		return 1;
+	}
+	bool force = false;
+	unsigned flags = 0;
+	int failed = 0;
+	for (int i = 1; i < argc; ++i){
+		std::string arg = argv[i];
+		if (arg == "--force"){
+			force = true;
+			continue;
+		}
+		if (arg == "--split16"){
+			flags |= MESH_SPLIT_16BIT;
+			continue;
+		}
+		if (arg == "--float-verts"){
+			flags |= MESH_FLOAT_VERTICES;
+			continue;
+		}
+		if (arg == "--no-optimize"){
+			flags |= MESH_NO_OPTIMIZE;
+			continue;
+		}
+		if (arg == "--no-lod"){
+			flags |= MESH_NO_LOD;
+			continue;
+		}
+		meshcache::CachedMesh mesh;
+		if (!meshcache::load(arg, mesh, flags, force)){
+			++failed;
+			continue;
+		}
+		//The index buffer holds every level of detail, report the full detail level
+		size_t tris = 0;
+		if (mesh.view.lodCount > 0){
+			const Lod &full = mesh.view.lods[0];
+			for (size_t j = full.first; j < full.first + full.count; ++j){
+				tris += mesh.view.subMeshes[j].count / 3;
+			}
+		}
+		std::cout << meshcache::cachePath(arg) << (mesh.fromCache ? " up to date: " : " baked: ")
+			<< mesh.view.vertexCount << " verts, " << tris << " tris, "
+			<< mesh.view.lodCount << " LODs, " << mesh.view.subMeshCount << " sub-meshes, " << mesh.view.indexSize * 8 << "bit indices, "
+			<< mesh.view.vertexStride << " bytes/vertex\n";
+	}
+	return failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,313 @@
+#include <vector>
+#include <algorithm>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include "mappedfile.h"
+#include "mesh.h"
+#include "meshcache.h"
+#include "meshopt.h"
+#include "objparser.h"
+#include "simplify.h"
+
+namespace {
+	//Blobs are aligned so the mapped data is suitably aligned for any attribute type
+	const uint64_t BLOB_ALIGN = 16;
+
+	uint64_t alignUp(uint64_t x){
+		return (x + BLOB_ALIGN - 1) & ~(BLOB_ALIGN - 1);
+	}
+	void writePadding(std::ofstream &out, uint64_t from, uint64_t to){
+		const char zeros[BLOB_ALIGN] = {};
+		out.write(zeros, to - from);
+	}
+	uint64_t mix(uint64_t h){
+		h ^= h >> 33;
+		h *= 0xFF51AFD7ED558CCDull;
+		h ^= h >> 33;
+		h *= 0xC4CEB9FE1A85EC53ull;
+		h ^= h >> 33;
+		return h;
+	}
+}
+
+meshcache::MeshView::MeshView() : vertices(nullptr), indices(nullptr), subMeshes(nullptr),
+	lods(nullptr), vertexCount(0), vertexStride(0), indexCount(0), indexSize(0), subMeshCount(0),
+	lodCount(0), flags(0), layout(VERTEX_FLOAT), boundsMin(0.f), boundsMax(0.f)
+{}
+size_t meshcache::MeshView::vertexBytes() const {
+	return vertexCount * vertexStride;
+}
+size_t meshcache::MeshView::indexBytes() const {
+	return indexCount * indexSize;
+}
+GLenum meshcache::MeshView::indexType() const {
+	return indexSize == sizeof(GLuint) ? GL_UNSIGNED_INT : GL_UNSIGNED_SHORT;
+}
+std::string meshcache::cachePath(const std::string &source){
+	return source + ".mesh";
+}
+uint64_t meshcache::hash(const char *data, size_t len){
+	//Hash 8 bytes at a time, this needs to be much faster than parsing
+	//the OBJ or there's no point to the cache
+	uint64_t h = mix(len ^ 0x9E3779B97F4A7C15ull);
+	size_t i = 0;
+	for (; i + 8 <= len; i += 8){
+		uint64_t w;
+		std::memcpy(&w, data + i, 8);
+		h = (h ^ mix(w)) * 0x100000001B3ull;
+	}
+	uint64_t tail = 0;
+	if (i < len){
+		std::memcpy(&tail, data + i, len - i);
+	}
+	h = (h ^ mix(tail)) * 0x100000001B3ull;
+	return mix(h);
+}
+meshcache::MeshView meshcache::makeView(const Mesh &mesh, unsigned flags, PackedMesh &packed){
+	packed.vertices.clear();
+	packed.vertexData.clear();
+	packed.shortIndices.clear();
+	packed.subMeshes.clear();
+	packed.lods.clear();
+	std::vector<Lod> lods = mesh.lods;
+	if (lods.empty()){
+		Lod all = { 0, static_cast<GLuint>(mesh.indices.size()), 0.f };
+		lods.push_back(all);
+	}
+	MeshView view;
+	view.flags = flags;
+	//16bit indices can address 65536 vertices
+	if (mesh.vertices.size() <= std::numeric_limits<GLushort>::max() + size_t(1)){
+		packed.shortIndices.assign(mesh.indices.begin(), mesh.indices.end());
+		view.vertices = mesh.vertices.data();
+		view.vertexCount = mesh.vertices.size();
+		view.indices = packed.shortIndices.data();
+		view.indexSize = sizeof(GLushort);
+	}
+	else if (flags & MESH_SPLIT_16BIT){
+		//Split each level separately so every level has its own sub-meshes
+		std::vector<GLuint> levelIndices;
+		for (Lod &l : lods){
+			levelIndices.assign(mesh.indices.begin() + l.first,
+				mesh.indices.begin() + l.first + l.count);
+			GLuint firstSubMesh = packed.subMeshes.size();
+			splitMesh(mesh.vertices, levelIndices, packed.vertices, packed.shortIndices,
+				packed.subMeshes);
+			l.first = firstSubMesh;
+			l.count = packed.subMeshes.size() - firstSubMesh;
+		}
+		view.vertices = packed.vertices.data();
+		view.vertexCount = packed.vertices.size();
+		view.indices = packed.shortIndices.data();
+		view.indexSize = sizeof(GLushort);
+	}
+	else {
+		view.vertices = mesh.vertices.data();
+		view.vertexCount = mesh.vertices.size();
+		view.indices = mesh.indices.data();
+		view.indexSize = sizeof(GLuint);
+	}
+	//Without splitting each level is drawn as a single sub-mesh
+	if (packed.subMeshes.empty()){
+		for (Lod &l : lods){
+			SubMesh s = { l.count, 0, l.first * view.indexSize };
+			l.first = packed.subMeshes.size();
+			l.count = 1;
+			packed.subMeshes.push_back(s);
+		}
+	}
+	packed.lods = lods;
+	view.indexCount = view.indexSize == sizeof(GLushort) ? packed.shortIndices.size()
+		: mesh.indices.size();
+	view.subMeshes = packed.subMeshes.data();
+	view.subMeshCount = packed.subMeshes.size();
+	view.lods = packed.lods.data();
+	view.lodCount = packed.lods.size();
+	computeBounds(mesh.vertices, view.boundsMin, view.boundsMax);
+
+	view.layout = flags & MESH_FLOAT_VERTICES ? VERTEX_FLOAT : chooseLayout(mesh.vertices);
+	view.vertexStride = vertexStride(view.layout);
+	if (view.layout != VERTEX_FLOAT){
+		packVertices(view.vertices == mesh.vertices.data() ? mesh.vertices : packed.vertices,
+			view.layout, packed.vertexData);
+		view.vertices = packed.vertexData.data();
+	}
+	return view;
+}
+bool meshcache::write(const std::string &file, const MeshView &view, uint64_t sourceHash,
+	uint64_t sourceSize)
+{
+	Header header;
+	std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+	header.version = VERSION;
+	header.sourceHash = sourceHash;
+	header.sourceSize = sourceSize;
+	header.flags = view.flags;
+	header.layout = view.layout;
+	header.vertexCount = view.vertexCount;
+	header.vertexStride = view.vertexStride;
+	header.indexCount = view.indexCount;
+	header.indexSize = view.indexSize;
+	header.subMeshCount = view.subMeshCount;
+	header.lodCount = view.lodCount;
+	for (int i = 0; i < 3; ++i){
+		header.boundsMin[i] = view.boundsMin[i];
+		header.boundsMax[i] = view.boundsMax[i];
+	}
+	header.vertexOffset = alignUp(sizeof(Header));
+	header.indexOffset = alignUp(header.vertexOffset + view.vertexBytes());
+	header.subMeshOffset = alignUp(header.indexOffset + view.indexBytes());
+	header.lodOffset = alignUp(header.subMeshOffset + view.subMeshCount * sizeof(SubMesh));
+
+	std::string tmpFile = file + ".tmp";
+	{
+		std::ofstream out(tmpFile, std::ios::binary | std::ios::trunc);
+		if (!out.is_open()){
+			std::cout << "Failed to open mesh cache for writing: " << tmpFile << std::endl;
+			return false;
+		}
+		out.write(reinterpret_cast<const char*>(&header), sizeof(Header));
+		writePadding(out, sizeof(Header), header.vertexOffset);
+		out.write(static_cast<const char*>(view.vertices), view.vertexBytes());
+		writePadding(out, header.vertexOffset + view.vertexBytes(), header.indexOffset);
+		out.write(static_cast<const char*>(view.indices), view.indexBytes());
+		writePadding(out, header.indexOffset + view.indexBytes(), header.subMeshOffset);
+		out.write(reinterpret_cast<const char*>(view.subMeshes),
+			view.subMeshCount * sizeof(SubMesh));
+		writePadding(out, header.subMeshOffset + view.subMeshCount * sizeof(SubMesh),
+			header.lodOffset);
+		out.write(reinterpret_cast<const char*>(view.lods), view.lodCount * sizeof(Lod));
+		if (!out.good()){
+			std::cout << "Failed to write mesh cache: " << tmpFile << std::endl;
+			out.close();
+			std::remove(tmpFile.c_str());
+			return false;
+		}
+	}
+	//rename won't replace an existing file on Windows
+	std::remove(file.c_str());
+	if (std::rename(tmpFile.c_str(), file.c_str()) != 0){
+		std::cout << "Failed to move mesh cache into place: " << file << std::endl;
+		std::remove(tmpFile.c_str());
+		return false;
+	}
+	return true;
+}
+bool meshcache::open(const std::string &file, MappedFile &cache, MeshView &view, Header &header){
+	if (!cache.open(file) || cache.size() < sizeof(Header)){
+		return false;
+	}
+	std::memcpy(&header, cache.data(), sizeof(Header));
+	if (std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0){
+		std::cout << "Mesh cache " << file << " is not a mesh cache file" << std::endl;
+		return false;
+	}
+	if (header.version != VERSION){
+		std::cout << "Mesh cache " << file << " is version " << header.version
+			<< ", expected " << VERSION << std::endl;
+		return false;
+	}
+	if (header.layout > VERTEX_PACKED_HALF_POS
+		|| header.vertexStride != vertexStride(static_cast<VertexLayout>(header.layout))
+		|| (header.indexSize != sizeof(GLushort) && header.indexSize != sizeof(GLuint)))
+	{
+		std::cout << "Mesh cache " << file << " has an invalid vertex or index size" << std::endl;
+		return false;
+	}
+	const uint64_t vertexBytes = uint64_t(header.vertexCount) * header.vertexStride;
+	const uint64_t indexBytes = uint64_t(header.indexCount) * header.indexSize;
+	const uint64_t subMeshBytes = uint64_t(header.subMeshCount) * sizeof(SubMesh);
+	const uint64_t lodBytes = uint64_t(header.lodCount) * sizeof(Lod);
+	if (header.vertexOffset + vertexBytes > cache.size()
+		|| header.indexOffset + indexBytes > cache.size()
+		|| header.subMeshOffset + subMeshBytes > cache.size()
+		|| header.lodOffset + lodBytes > cache.size())
+	{
+		std::cout << "Mesh cache " << file << " is truncated" << std::endl;
+		return false;
+	}
+	view.vertices = cache.data() + header.vertexOffset;
+	view.vertexCount = header.vertexCount;
+	view.vertexStride = header.vertexStride;
+	view.indices = cache.data() + header.indexOffset;
+	view.indexCount = header.indexCount;
+	view.indexSize = header.indexSize;
+	view.subMeshes = reinterpret_cast<const SubMesh*>(cache.data() + header.subMeshOffset);
+	view.subMeshCount = header.subMeshCount;
+	view.lods = reinterpret_cast<const Lod*>(cache.data() + header.lodOffset);
+	view.lodCount = header.lodCount;
+	view.flags = header.flags;
+	view.layout = static_cast<VertexLayout>(header.layout);
+	view.boundsMin = glm::vec3(header.boundsMin[0], header.boundsMin[1], header.boundsMin[2]);
+	view.boundsMax = glm::vec3(header.boundsMax[0], header.boundsMax[1], header.boundsMax[2]);
+	return true;
+}
+bool meshcache::load(const std::string &objFile, CachedMesh &out, unsigned flags, bool rebuild){
+	//If the OBJ is missing but the cache is there, e.g. only baked assets
+	//were shipped, we'll trust the cache
+	MappedFile source(objFile);
+	uint64_t sourceHash = source.isOpen() ? hash(source.data(), source.size()) : 0;
+	std::string cacheFile = cachePath(objFile);
+	Header header;
+	out.fromCache = !rebuild && open(cacheFile, out.cache, out.view, header);
+	if (out.fromCache && source.isOpen()
+		&& (header.sourceHash != sourceHash || header.sourceSize != source.size()))
+	{
+		std::cout << "Mesh cache " << cacheFile << " is out of date" << std::endl;
+		out.fromCache = false;
+	}
+	if (out.fromCache && header.flags != flags){
+		std::cout << "Mesh cache " << cacheFile << " was built with different mesh flags"
+			<< std::endl;
+		out.fromCache = false;
+	}
+	if (out.fromCache){
+		return true;
+	}
+	out.cache.close();
+	if (!source.isOpen()){
+		std::cout << "Failed to find obj file: " << objFile << std::endl;
+		return false;
+	}
+	obj::ParseStats stats;
+	if (!obj::parseParallel(source.data(), source.data() + source.size(), out.mesh, 0, &stats)){
+		std::cout << "Failed to parse obj file: " << objFile << std::endl;
+		return false;
+	}
+	obj::logStats(objFile, stats);
+	if (!(flags & MESH_NO_OPTIMIZE)){
+		meshopt::CacheStats before, after;
+		meshopt::optimize(out.mesh, before, after);
+		std::cout << objFile << " vertex cache (FIFO " << meshopt::CACHE_SIZE << "): ACMR "
+			<< before.acmr << " -> " << after.acmr << ", ATVR " << before.atvr << " -> "
+			<< after.atvr << "\n";
+	}
+	if (!(flags & MESH_NO_LOD)){
+		simplify::buildLods(out.mesh);
+		for (size_t i = 1; i < out.mesh.lods.size(); ++i){
+			const Lod &l = out.mesh.lods[i];
+			//The coarser levels reuse the full detail level's vertex order but
+			//their triangles still need ordering for the vertex cache
+			if (!(flags & MESH_NO_OPTIMIZE)){
+				std::vector<GLuint> level(out.mesh.indices.begin() + l.first,
+					out.mesh.indices.begin() + l.first + l.count);
+				meshopt::optimizeVertexCache(level, out.mesh.vertices.size());
+				std::copy(level.begin(), level.end(), out.mesh.indices.begin() + l.first);
+			}
+			std::cout << objFile << " LOD " << i << ": " << l.count / 3 << " tris, error "
+				<< l.error << "\n";
+		}
+	}
+	out.view = makeView(out.mesh, flags, out.packed);
+	if (write(cacheFile, out.view, sourceHash, source.size())){
+		std::cout << "Wrote mesh cache: " << cacheFile << "\n";
+	}
+	return true;
+}
@@ -0,0 +1,230 @@
+#include <vector>
+#include <algorithm>
+#include <limits>
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include "mesh.h"
+#include "meshopt.h"
+
+namespace {
+	//How much worse the ACMR can get from sorting clusters for overdraw before
+	//we decide it's not worth it
+	const float OVERDRAW_ACMR_THRESHOLD = 1.05f;
+
+	/*
+	 * A run of triangles from the vertex cache optimized order and the key
+	 * we sort on for overdraw
+	 */
+	struct Cluster {
+		size_t begin, end;
+		float key;
+	};
+	bool drawnBefore(const Cluster &a, const Cluster &b){
+		return a.key > b.key;
+	}
+}
+
+meshopt::CacheStats meshopt::measureCache(const std::vector<GLuint> &indices,
+	size_t vertexCount, size_t cacheSize)
+{
+	CacheStats stats = { 0, 0 };
+	if (indices.empty()){
+		return stats;
+	}
+	//A vertex is in the FIFO if fewer than cacheSize misses happened since it was
+	//added, the time starts past cacheSize so everything misses at first
+	std::vector<size_t> cacheTime(vertexCount, 0);
+	size_t time = cacheSize + 1, misses = 0, unique = 0;
+	for (GLuint v : indices){
+		if (cacheTime[v] == 0){
+			++unique;
+		}
+		if (time - cacheTime[v] > cacheSize){
+			cacheTime[v] = time;
+			++time;
+			++misses;
+		}
+	}
+	stats.acmr = static_cast<float>(misses) / (indices.size() / 3);
+	stats.atvr = static_cast<float>(misses) / unique;
+	return stats;
+}
+void meshopt::optimizeVertexCache(std::vector<GLuint> &indices, size_t vertexCount,
+	size_t cacheSize, std::vector<size_t> *clusters)
+{
+	const size_t nTris = indices.size() / 3;
+	if (nTris == 0){
+		return;
+	}
+	//Number of triangles left to emit using each vertex and the vertex's
+	//triangle adjacency, stored as one array with offsets per vertex
+	std::vector<GLuint> live(vertexCount, 0);
+	for (GLuint v : indices){
+		++live[v];
+	}
+	std::vector<size_t> offsets(vertexCount + 1, 0);
+	for (size_t v = 0; v < vertexCount; ++v){
+		offsets[v + 1] = offsets[v] + live[v];
+	}
+	std::vector<GLuint> adjacency(nTris * 3);
+	{
+		std::vector<size_t> fill(offsets.begin(), offsets.end() - 1);
+		for (size_t t = 0; t < nTris; ++t){
+			for (size_t j = 0; j < 3; ++j){
+				adjacency[fill[indices[t * 3 + j]]++] = t;
+			}
+		}
+	}
+	std::vector<size_t> cacheTime(vertexCount, 0);
+	std::vector<char> emitted(nTris, 0);
+	std::vector<GLuint> deadEnd, candidates, out;
+	out.reserve(nTris * 3);
+	size_t time = cacheSize + 1, cursor = 0;
+	//Start fanning around the first vertex of the first triangle
+	long fan = indices[0];
+	bool jumped = true;
+	while (fan >= 0){
+		if (jumped && clusters){
+			clusters->push_back(out.size() / 3);
+		}
+		//Emit all the triangles around the fanning vertex
+		candidates.clear();
+		for (size_t a = offsets[fan]; a < offsets[fan + 1]; ++a){
+			GLuint t = adjacency[a];
+			if (emitted[t]){
+				continue;
+			}
+			for (size_t j = 0; j < 3; ++j){
+				GLuint v = indices[t * 3 + j];
+				out.push_back(v);
+				deadEnd.push_back(v);
+				candidates.push_back(v);
+				--live[v];
+				if (time - cacheTime[v] > cacheSize){
+					cacheTime[v] = time;
+					++time;
+				}
+			}
+			emitted[t] = 1;
+		}
+		//Pick the next fanning vertex from the ones just used, preferring the
+		//oldest vertex that will still be in the cache after its fan is emitted
+		long next = -1;
+		size_t bestPriority = 0;
+		for (GLuint v : candidates){
+			if (live[v] == 0){
+				continue;
+			}
+			size_t priority = 0;
+			if (time - cacheTime[v] + 2 * live[v] <= cacheSize){
+				priority = time - cacheTime[v];
+			}
+			if (next == -1 || priority > bestPriority){
+				next = v;
+				bestPriority = priority;
+			}
+		}
+		jumped = false;
+		//Dead end, back track through recently used vertices or failing that jump
+		//to the next vertex with triangles left. If the vertex we land on has fallen
+		//out of the cache this starts a new cluster
+		if (next == -1){
+			while (!deadEnd.empty() && next == -1){
+				GLuint v = deadEnd.back();
+				deadEnd.pop_back();
+				if (live[v] > 0){
+					next = v;
+				}
+			}
+			if (next == -1){
+				while (cursor < vertexCount && live[cursor] == 0){
+					++cursor;
+				}
+				next = cursor < vertexCount ? static_cast<long>(cursor) : -1;
+			}
+			jumped = next != -1 && time - cacheTime[next] > cacheSize;
+		}
+		fan = next;
+	}
+	indices.swap(out);
+}
+void meshopt::optimizeOverdraw(const std::vector<Vertex> &vertices, std::vector<GLuint> &indices,
+	const std::vector<size_t> &clusters, size_t cacheSize)
+{
+	if (clusters.size() < 2){
+		return;
+	}
+	const size_t nTris = indices.size() / 3;
+	//Area weighted centroid of the mesh
+	glm::vec3 meshCenter(0.f);
+	float meshArea = 0.f;
+	std::vector<glm::vec3> triCenters(nTris), triNormals(nTris);
+	for (size_t t = 0; t < nTris; ++t){
+		const glm::vec3 &a = vertices[indices[t * 3]].pos;
+		const glm::vec3 &b = vertices[indices[t * 3 + 1]].pos;
+		const glm::vec3 &c = vertices[indices[t * 3 + 2]].pos;
+		//The cross product's length is twice the area so this is area weighted
+		triNormals[t] = glm::cross(b - a, c - a);
+		triCenters[t] = (a + b + c) / 3.f;
+		float area = glm::length(triNormals[t]);
+		meshCenter += triCenters[t] * area;
+		meshArea += area;
+	}
+	if (meshArea > 0.f){
+		meshCenter /= meshArea;
+	}
+	//Clusters facing away from the center are likely to occlude the rest of the mesh
+	std::vector<Cluster> sorted(clusters.size());
+	for (size_t i = 0; i < clusters.size(); ++i){
+		Cluster &c = sorted[i];
+		c.begin = clusters[i];
+		c.end = i + 1 < clusters.size() ? clusters[i + 1] : nTris;
+		glm::vec3 center(0.f), normal(0.f);
+		float area = 0.f;
+		for (size_t t = c.begin; t < c.end; ++t){
+			float a = glm::length(triNormals[t]);
+			center += triCenters[t] * a;
+			normal += triNormals[t];
+			area += a;
+		}
+		c.key = 0.f;
+		if (area > 0.f && glm::length(normal) > 0.f){
+			c.key = glm::dot(center / area - meshCenter, glm::normalize(normal));
+		}
+	}
+	std::stable_sort(sorted.begin(), sorted.end(), drawnBefore);
+
+	std::vector<GLuint> out;
+	out.reserve(indices.size());
+	for (const Cluster &c : sorted){
+		out.insert(out.end(), indices.begin() + c.begin * 3, indices.begin() + c.end * 3);
+	}
+	const size_t vertexCount = vertices.size();
+	if (measureCache(out, vertexCount, cacheSize).acmr
+		<= measureCache(indices, vertexCount, cacheSize).acmr * OVERDRAW_ACMR_THRESHOLD)
+	{
+		indices.swap(out);
+	}
+}
+void meshopt::optimizeVertexFetch(Mesh &mesh){
+	const GLuint UNUSED = std::numeric_limits<GLuint>::max();
+	std::vector<GLuint> remap(mesh.vertices.size(), UNUSED);
+	std::vector<Vertex> vertices;
+	vertices.reserve(mesh.vertices.size());
+	for (GLuint &i : mesh.indices){
+		if (remap[i] == UNUSED){
+			remap[i] = vertices.size();
+			vertices.push_back(mesh.vertices[i]);
+		}
+		i = remap[i];
+	}
+	mesh.vertices.swap(vertices);
+}
+void meshopt::optimize(Mesh &mesh, CacheStats &before, CacheStats &after){
+	before = measureCache(mesh.indices, mesh.vertices.size());
+	std::vector<size_t> clusters;
+	optimizeVertexCache(mesh.indices, mesh.vertices.size(), CACHE_SIZE, &clusters);
+	optimizeOverdraw(mesh.vertices, mesh.indices, clusters);
+	optimizeVertexFetch(mesh);
+	after = measureCache(mesh.indices, mesh.vertices.size());
+}
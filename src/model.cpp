@@ -1,101 +1,240 @@
 #include <iostream>
+#include <algorithm>
 #include <string>
 #include <GL/glew.h>
 #include <glm/glm.hpp>
 #include <glm/ext.hpp>
 #include "util.h"
+#include "programcache.h"
+#include "frustum.h"
+#include "renderqueue.h"
 #include "model.h"
 
-Model::Model(const std::string &file, GLuint program, GLuint shadowProgram)
-	: vao(0), nElems(0), program(program), shadowProgram(shadowProgram),
-		matUnif(-1), shadowMatUnif(-1)
+namespace {
+	/*
+	 * Find the program's transform index uniform, or its draw_transforms
+	 * array if it was built with MULTI_DRAW
+	 */
+	GLint findTransformUniform(GLuint program, bool &multiDraw){
+		GLint unif = glGetUniformLocation(program, "transform_index");
+		multiDraw = false;
+		if (unif == -1){
+			unif = glGetUniformLocation(program, "draw_transforms");
+			multiDraw = unif != -1;
+		}
+		return unif;
+	}
+}
+
+Model::Model(const std::string &file, GLuint program, GLuint shadowProgram,
+	unsigned meshFlags)
+	: arena(nullptr), block(GeometryArena::INVALID), vao(0), nElems(0), lod(0), shadowLod(0),
+		program(program), shadowProgram(shadowProgram), transform(transforms::create()),
+		indexUnif(-1), shadowIndexUnif(-1), multiDraw(false), shadowMultiDraw(false),
+		texture(0), texUnit(0), material(0.4f, 50.f), materialUnif(-1)
 {
-	load(file);
+	load(file, meshFlags);
 }
 Model::~Model(){
-	glDeleteBuffers(2, buf);
-	glDeleteVertexArrays(1, &vao);
-	glDeleteProgram(program);
+	if (arena){
+		arena->release(block);
+	}
+	transforms::destroy(transform);
+	programcache::release(program);
 	if (shadowProgram){
-		glDeleteProgram(shadowProgram);
+		programcache::release(shadowProgram);
 	}
 }
 void Model::bind(){
-	glUseProgram(program);
+	programcache::use(program);
 	glBindVertexArray(vao);
+	if (indexUnif != -1){
+		glUniform1i(indexUnif, transform);
+	}
+	if (materialUnif != -1){
+		glUniform2f(materialUnif, material.x, material.y);
+	}
+	if (texture){
+		glActiveTexture(GL_TEXTURE0 + texUnit);
+		glBindTexture(GL_TEXTURE_2D, texture);
+	}
 }
 void Model::bindShadow(){
-	glUseProgram(shadowProgram);
+	programcache::use(shadowProgram);
 	glBindVertexArray(vao);
+	if (shadowIndexUnif != -1){
+		glUniform1i(shadowIndexUnif, transform);
+	}
 }
-void Model::setShadowVP(const glm::mat4 &vp){
-	if (shadowProgram){
-		glUseProgram(shadowProgram);
-		GLuint vpUnif = glGetUniformLocation(shadowProgram, "view_proj");
-		glUniformMatrix4fv(vpUnif, 1, GL_FALSE, glm::value_ptr(vp));
+void Model::bindCached(StateCache &cache, bool shadow){
+	cache.useProgram(shadow ? shadowProgram : program);
+	cache.bindVertexArray(vao);
+	const GLint unif = shadow ? shadowIndexUnif : indexUnif;
+	if (unif != -1){
+		glUniform1i(unif, transform);
 	}
+	if (!shadow && materialUnif != -1){
+		glUniform2f(materialUnif, material.x, material.y);
+	}
+	if (!shadow && texture){
+		cache.bindTexture(texUnit, texture);
+	}
+}
+GLuint Model::passProgram(bool shadow) const {
+	return shadow ? shadowProgram : program;
+}
+GLuint Model::vertexArray() const {
+	return vao;
+}
+GLuint Model::diffuseTexture() const {
+	return texture;
+}
+const glm::vec2& Model::surfaceMaterial() const {
+	return material;
+}
+bool Model::multiDrawable(bool shadow) const {
+	return shadow ? shadowMultiDraw : multiDraw;
+}
+GLint Model::transformUniform(bool shadow) const {
+	return shadow ? shadowIndexUnif : indexUnif;
+}
+void Model::batchDraws(bool shadow, DrawBatch &batch) const {
+	const size_t level = shadow ? shadowLod : lod;
+	if (level >= info.lods.size() || block == GeometryArena::INVALID){
+		return;
+	}
+	const GLint baseVertex = arena->baseVertex(block);
+	const size_t indexOffset = arena->indexOffset(block);
+	const Lod &l = info.lods[level];
+	for (size_t i = l.first; i < l.first + l.count; ++i){
+		const SubMesh &s = info.subMeshes[i];
+		batch.counts.push_back(s.count);
+		batch.offsets.push_back(reinterpret_cast<const GLvoid*>(s.offset + indexOffset));
+		batch.baseVertices.push_back(s.baseVertex + baseVertex);
+		batch.transforms.push_back(transform);
+	}
+}
+void Model::setTexture(GLuint tex, GLuint unit){
+	texture = tex;
+	texUnit = unit;
+}
+void Model::setMaterial(float specular, float shininess){
+	material = glm::vec2(specular, shininess);
+}
+void Model::selectLod(const glm::vec3 &viewPos, float pixelsPerUnit, float maxError,
+	size_t shadowBias)
+{
+	selectLod(&transforms::matrix(transform), 1, viewPos, pixelsPerUnit, maxError, shadowBias);
+}
+void Model::draw(){
+	drawLod(lod);
+}
+void Model::drawShadow(){
+	drawLod(shadowLod);
+}
+void Model::worldBounds(glm::vec3 &lo, glm::vec3 &hi){
+	transformBounds(transforms::matrix(transform), info.boundsMin, info.boundsMax, lo, hi);
+}
+transforms::Handle Model::transformHandle() const {
+	return transform;
+}
+size_t Model::lodCount(){
+	return info.lods.size();
+}
+size_t Model::shadowLodLevel() const {
+	return shadowLod;
 }
 size_t Model::elems(){
 	return nElems;
 }
+GLenum Model::indexType(){
+	return info.indexType;
+}
+const MeshInfo& Model::meshInfo(){
+	return info;
+}
 void Model::translate(const glm::vec3 &vec){
-	if (matUnif != -1){
-		translation = glm::translate<GLfloat>(vec) * translation;
-		updateMatrix();
-	}
+	transforms::translate(transform, vec);
 }
 void Model::rotate(const glm::mat4 &rot){
-	if (matUnif != -1){
-		rotation = rot * rotation;
-		updateMatrix();
-	}
+	transforms::rotate(transform, rot);
 }
 void Model::scale(const glm::vec3 &scale){
-	if (matUnif != -1){
-		scaling = glm::scale<GLfloat>(scale) * scaling;
-		updateMatrix();
-	}
+	transforms::scale(transform, scale);
 }
-void Model::load(const std::string &file){
-	glGenVertexArrays(1, &vao);
-	glBindVertexArray(vao);
-	glGenBuffers(2, buf);
-	if (!util::loadOBJ(file, buf[0], buf[1], nElems)){
+void Model::load(const std::string &file, unsigned meshFlags){
+	if (!util::loadOBJ(file, arena, block, info, meshFlags)){
 		std::cout << "Failed to load model: " << file << "\n";
 		return;
 	}
-	//Position
-	glEnableVertexAttribArray(0);
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 9 * sizeof(GLfloat), 0);
-	//Normals
-	glEnableVertexAttribArray(1);
-	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 9 * sizeof(GL_FLOAT),
-		(void*)(3 * sizeof(GL_FLOAT)));
-	//UVs
-	glEnableVertexAttribArray(2);
-	glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 9 * sizeof(GL_FLOAT),
-		(void*)(6 * sizeof(GL_FLOAT)));
-	//Send the identity for the initial model matrix, if that uniform is available
-	glUseProgram(program);
-	matUnif = glGetUniformLocation(program, "model");
+	vao = arena->vertexArray();
+	if (!info.lods.empty()){
+		for (size_t i = 0; i < info.lods[0].count; ++i){
+			nElems += info.subMeshes[info.lods[0].first + i].count;
+		}
+	}
+	materialUnif = glGetUniformLocation(program, "material");
+	//Point the programs at the model matrices, if they use them
+	indexUnif = findTransformUniform(program, multiDraw);
+	if (indexUnif != -1){
+		programcache::use(program);
+		glUniform1i(glGetUniformLocation(program, "transforms"), transforms::TEXTURE_UNIT);
+	}
 	if (shadowProgram){
-		glUseProgram(shadowProgram);
-		shadowMatUnif = glGetUniformLocation(shadowProgram, "model");
+		shadowIndexUnif = findTransformUniform(shadowProgram, shadowMultiDraw);
+		if (shadowIndexUnif != -1){
+			programcache::use(shadowProgram);
+			glUniform1i(glGetUniformLocation(shadowProgram, "transforms"),
+				transforms::TEXTURE_UNIT);
+		}
 	}
-	if (matUnif != -1){
-		translation = glm::translate<GLfloat>(0.f, 0.f, 0.f);
-		rotation = glm::rotate<GLfloat>(0.f, 0.f, 1.f, 0.f);
-		scaling = glm::scale<GLfloat>(1.f, 1.f, 1.f);
-		updateMatrix();
+}
+void Model::drawLod(size_t level){
+	if (level >= info.lods.size() || block == GeometryArena::INVALID){
+		return;
+	}
+	const GLint baseVertex = arena->baseVertex(block);
+	const size_t indexOffset = arena->indexOffset(block);
+	const Lod &l = info.lods[level];
+	for (size_t i = l.first; i < l.first + l.count; ++i){
+		const SubMesh &s = info.subMeshes[i];
+		glDrawElementsBaseVertex(GL_TRIANGLES, s.count, info.indexType,
+			reinterpret_cast<void*>(s.offset + indexOffset), s.baseVertex + baseVertex);
 	}
 }
-void Model::updateMatrix(){
-	glUseProgram(program);
-	glm::mat4 model = translation * rotation * scaling;
-	glUniformMatrix4fv(matUnif, 1, GL_FALSE, glm::value_ptr(model));
-	if (shadowProgram){
-		glUseProgram(shadowProgram);
-		glUniformMatrix4fv(shadowMatUnif, 1, GL_FALSE, glm::value_ptr(model));
+void Model::selectLod(const glm::mat4 *matrices, size_t count, const glm::vec3 &viewPos,
+	float pixelsPerUnit, float maxError, size_t shadowBias)
+{
+	lod = 0;
+	if (info.lods.size() > 1){
+		const glm::vec4 center(info.sphereCenter, 1.f);
+		const float radius = info.sphereRadius;
+		//The largest scale / distance of any transform, the error's projected
+		//size is proportional to this
+		float maxRatio = 0.f;
+		bool inside = false;
+		for (size_t i = 0; i < count && !inside; ++i){
+			const glm::mat4 &m = matrices[i];
+			float scale = std::max(glm::length(glm::vec3(m[0])),
+				std::max(glm::length(glm::vec3(m[1])), glm::length(glm::vec3(m[2]))));
+			//Use the distance to the nearest point on the bounding sphere, if we're
+			//inside it the model gets full detail
+			float dist = glm::length(glm::vec3(m * center) - viewPos) - radius * scale;
+			if (dist <= 0.f){
+				inside = true;
+			}
+			else {
+				maxRatio = std::max(maxRatio, scale / dist);
+			}
+		}
+		if (!inside){
+			while (lod + 1 < info.lods.size()
+				&& info.lods[lod + 1].error * maxRatio * pixelsPerUnit <= maxError)
+			{
+				++lod;
+			}
+		}
 	}
+	//Clamp the bias to the levels left rather than the sum, so a huge bias can't wrap
+	shadowLod = info.lods.empty() ? 0 : lod + std::min(shadowBias, info.lods.size() - 1 - lod);
 }
-
@@ -0,0 +1,91 @@
+#include <vector>
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+#include "mappedfile.h"
+#include "mesh.h"
+#include "objparser.h"
+
+/*
+ * Benchmark comparing the serial and parallel OBJ parsers across thread counts,
+ * the parallel results are also checked to be byte-identical to the serial one
+ * Usage: ObjBench model.obj [runs]
+ */
+namespace {
+	//Best time over some runs of the parser, to filter out noise
+	template<typename F>
+	obj::ParseStats bestOf(int runs, Mesh &mesh, const F &parse){
+		obj::ParseStats best;
+		for (int i = 0; i < runs; ++i){
+			obj::ParseStats stats;
+			if (!parse(mesh, stats)){
+				return obj::ParseStats();
+			}
+			if (i == 0 || stats.seconds < best.seconds){
+				best = stats;
+			}
+		}
+		return best;
+	}
+	bool sameMesh(const Mesh &a, const Mesh &b){
+		return a.vertices.size() == b.vertices.size() && a.indices.size() == b.indices.size()
+			&& std::memcmp(a.vertices.data(), b.vertices.data(), a.vertices.size() * sizeof(Vertex)) == 0
+			&& std::memcmp(a.indices.data(), b.indices.data(), a.indices.size() * sizeof(GLuint)) == 0;
+	}
+}
+
+int main(int argc, char **argv){
+	if (argc < 2){
+		std::cout << "Usage: " << argv[0] << " model.obj [runs]\n";
+		return 1;
+	}
+	const int runs = argc > 2 ? std::max(std::atoi(argv[2]), 1) : 5;
+	MappedFile file(argv[1]);
+	if (!file.isOpen()){
+		std::cout << "Failed to open " << argv[1] << "\n";
+		return 1;
+	}
+	const char *begin = file.data(), *end = file.data() + file.size();
+
+	Mesh serial;
+	obj::ParseStats serialStats = bestOf(runs, serial, [&](Mesh &m, obj::ParseStats &s){
+		return obj::parse(begin, end, m, &s);
+	});
+	if (serialStats.seconds == 0){
+		std::cout << "Failed to parse " << argv[1] << "\n";
+		return 1;
+	}
+	std::cout << argv[1] << ": " << file.size() / (1024.0 * 1024.0) << "MB, "
+		<< serialStats.triangles << " tris, " << serialStats.vertices << " verts, best of "
+		<< runs << " runs\n"
+		<< "threads\tms\tMB/s\tMtris/s\tspeedup\n"
+		<< "serial\t" << serialStats.seconds * 1000.0 << "\t" << serialStats.mbPerSec()
+		<< "\t" << serialStats.trisPerSec() / 1e6 << "\t1\n";
+
+	std::vector<size_t> threadCounts;
+	const size_t hw = std::max(std::thread::hardware_concurrency(), 1u);
+	for (size_t t = 1; t < hw; t *= 2){
+		threadCounts.push_back(t);
+	}
+	threadCounts.push_back(hw);
+
+	bool identical = true;
+	for (size_t t : threadCounts){
+		Mesh parallel;
+		obj::ParseStats stats = bestOf(runs, parallel, [&](Mesh &m, obj::ParseStats &s){
+			return obj::parseParallel(begin, end, m, t, &s);
+		});
+		bool same = sameMesh(serial, parallel);
+		identical = identical && same;
+		std::cout << t << "\t" << stats.seconds * 1000.0 << "\t" << stats.mbPerSec()
+			<< "\t" << stats.trisPerSec() / 1e6 << "\t" << serialStats.seconds / stats.seconds
+			<< (same ? "" : "\tMISMATCH") << "\n";
+	}
+	if (!identical){
+		std::cout << "Parallel parser output differs from the serial parser!\n";
+		return 1;
+	}
+	return 0;
+}
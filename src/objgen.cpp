@@ -0,0 +1,58 @@
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+/*
+ * Generates a synthetic high-poly OBJ for benchmarking the OBJ parser: a bumpy
+ * sphere with positions, uvs and normals, written as quads so the parser's
+ * polygon triangulation gets exercised too
+ * Usage: ObjGen out.obj [segments], the mesh has segments^2 quads
+ */
+int main(int argc, char **argv){
+	if (argc < 2){
+		std::cout << "Usage: " << argv[0] << " out.obj [segments]\n";
+		return 1;
+	}
+	const int segs = argc > 2 ? std::atoi(argv[2]) : 512;
+	if (segs < 3){
+		std::cout << "Need at least 3 segments\n";
+		return 1;
+	}
+	FILE *f = std::fopen(argv[1], "w");
+	if (!f){
+		std::cout << "Failed to open " << argv[1] << " for writing\n";
+		return 1;
+	}
+	const double PI = 3.14159265358979323846;
+	std::fprintf(f, "# Synthetic bumpy sphere, %d segments\n", segs);
+	//Rows of vertices from pole to pole, the seam column is duplicated for the uvs
+	for (int j = 0; j <= segs; ++j){
+		double theta = PI * j / segs;
+		for (int i = 0; i <= segs; ++i){
+			double phi = 2 * PI * i / segs;
+			double r = 1.0 + 0.02 * std::sin(17 * phi) * std::sin(13 * theta);
+			double x = std::sin(theta) * std::cos(phi);
+			double y = std::cos(theta);
+			double z = std::sin(theta) * std::sin(phi);
+			std::fprintf(f, "v %.6f %.6f %.6f\n", r * x, r * y, r * z);
+			std::fprintf(f, "vt %.6f %.6f\n", static_cast<double>(i) / segs,
+				1.0 - static_cast<double>(j) / segs);
+			std::fprintf(f, "vn %.6f %.6f %.6f\n", x, y, z);
+		}
+	}
+	const int row = segs + 1;
+	for (int j = 0; j < segs; ++j){
+		for (int i = 0; i < segs; ++i){
+			int a = j * row + i + 1;
+			int b = a + 1;
+			int c = a + row + 1;
+			int d = a + row;
+			std::fprintf(f, "f %d/%d/%d %d/%d/%d %d/%d/%d %d/%d/%d\n",
+				a, a, a, d, d, d, c, c, c, b, b, b);
+		}
+	}
+	std::fclose(f);
+	return 0;
+}
@@ -0,0 +1,640 @@
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include "mappedfile.h"
+#include "mesh.h"
+#include "objparser.h"
+#include "parallel.h"
+
+namespace {
+	//Exactly representable powers of ten for scaling parsed mantissas
+	const double POW10[] = {
+		1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+		1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+	};
+	//Most digits we can accumulate in a uint64_t mantissa without overflow
+	const int MAX_MANTISSA_DIGITS = 19;
+
+	bool isSpace(char c){
+		return c == ' ' || c == '\t' || c == '\r';
+	}
+	bool isDigit(char c){
+		return c >= '0' && c <= '9';
+	}
+	void skipSpace(const char *&p, const char *end){
+		while (p != end && isSpace(*p)){
+			++p;
+		}
+	}
+	//Move p to the start of the next line
+	void skipLine(const char *&p, const char *end){
+		while (p != end && *p != '\n'){
+			++p;
+		}
+		if (p != end){
+			++p;
+		}
+	}
+	/*
+	 * Parse a float at p, skipping leading whitespace and advancing p past the number
+	 * returns false if there's no number at p, in which case p is left at the bad character
+	 */
+	bool parseFloat(const char *&p, const char *end, float &out){
+		skipSpace(p, end);
+		const char *start = p;
+		bool neg = false;
+		if (p != end && (*p == '-' || *p == '+')){
+			neg = *p == '-';
+			++p;
+		}
+		uint64_t mantissa = 0;
+		int exponent = 0, digits = 0, nDigits = 0;
+		for (; p != end && isDigit(*p); ++p, ++nDigits){
+			if (digits < MAX_MANTISSA_DIGITS){
+				mantissa = mantissa * 10 + (*p - '0');
+				//Leading zeros don't take up any precision
+				if (mantissa != 0){
+					++digits;
+				}
+			}
+			else {
+				++exponent;
+			}
+		}
+		if (p != end && *p == '.'){
+			++p;
+			for (; p != end && isDigit(*p); ++p, ++nDigits){
+				if (digits < MAX_MANTISSA_DIGITS){
+					mantissa = mantissa * 10 + (*p - '0');
+					--exponent;
+					if (mantissa != 0){
+						++digits;
+					}
+				}
+			}
+		}
+		if (nDigits == 0){
+			p = start;
+			return false;
+		}
+		if (p != end && (*p == 'e' || *p == 'E')){
+			const char *expStart = p;
+			++p;
+			bool negExp = false;
+			if (p != end && (*p == '-' || *p == '+')){
+				negExp = *p == '-';
+				++p;
+			}
+			if (p == end || !isDigit(*p)){
+				//Not actually an exponent, leave the 'e' for the caller to complain about
+				p = expStart;
+			}
+			else {
+				int e = 0;
+				for (; p != end && isDigit(*p); ++p){
+					if (e < 10000){
+						e = e * 10 + (*p - '0');
+					}
+				}
+				exponent += negExp ? -e : e;
+			}
+		}
+		double val = static_cast<double>(mantissa);
+		if (mantissa != 0){
+			if (exponent < 0 && exponent >= -22){
+				val /= POW10[-exponent];
+			}
+			else if (exponent > 0 && exponent <= 22){
+				val *= POW10[exponent];
+			}
+			else if (exponent != 0){
+				val *= std::pow(10.0, exponent);
+			}
+		}
+		out = static_cast<float>(neg ? -val : val);
+		return true;
+	}
+	/*
+	 * Parse a possibly negative integer at p, advancing p past it
+	 * returns false if there's no integer at p
+	 */
+	bool parseInt(const char *&p, const char *end, long &out){
+		const char *start = p;
+		bool neg = false;
+		if (p != end && *p == '-'){
+			neg = true;
+			++p;
+		}
+		if (p == end || !isDigit(*p)){
+			p = start;
+			return false;
+		}
+		long val = 0;
+		for (; p != end && isDigit(*p); ++p){
+			val = val * 10 + (*p - '0');
+		}
+		out = neg ? -val : val;
+		return true;
+	}
+	/*
+	 * Parse a face vertex: v, v/vt, v//vn or v/vt/vn, components not
+	 * present are left as 0
+	 */
+	bool parseFaceVertex(const char *&p, const char *end, long idx[3]){
+		idx[0] = idx[1] = idx[2] = 0;
+		if (!parseInt(p, end, idx[0])){
+			return false;
+		}
+		if (p != end && *p == '/'){
+			++p;
+			if (p != end && *p != '/' && !parseInt(p, end, idx[1])){
+				return false;
+			}
+			if (p != end && *p == '/'){
+				++p;
+				if (!parseInt(p, end, idx[2])){
+					return false;
+				}
+			}
+		}
+		//The vertex must be followed by a separator
+		return p == end || isSpace(*p) || *p == '\n';
+	}
+	/*
+	 * Resolve a possibly relative (negative) OBJ index into a 1-based absolute one
+	 * 0 is returned for components that weren't given, returns false if the
+	 * index is out of range
+	 */
+	bool resolveIndex(long idx, size_t count, GLuint &out){
+		if (idx < 0){
+			idx += static_cast<long>(count) + 1;
+			if (idx <= 0){
+				return false;
+			}
+		}
+		if (static_cast<size_t>(idx) > count){
+			return false;
+		}
+		out = static_cast<GLuint>(idx);
+		return true;
+	}
+	/*
+	 * An open addressing hash table with linear probing mapping v/vt/vn index
+	 * triples to the index of the unique vertex they produced. OBJ indices are
+	 * 1-based so a position index of 0 marks an empty slot
+	 */
+	class VertexHash {
+		struct Entry {
+			GLuint v, vt, vn, idx;
+		};
+		std::vector<Entry> table;
+		size_t count, mask;
+
+	public:
+		VertexHash() : table(1024), count(0), mask(1023){
+			clear();
+		}
+		/*
+		 * Find the index of the vertex triple. If it's not in the table it's
+		 * inserted with index idx and true is returned to indicate the caller
+		 * should create the vertex
+		 */
+		bool findOrInsert(GLuint v, GLuint vt, GLuint vn, GLuint idx, GLuint &found){
+			return findOrInsert(hash(v, vt, vn), v, vt, vn, idx, found);
+		}
+		/*
+		 * Find or insert the vertex triple with its hash already computed by hash
+		 */
+		bool findOrInsert(uint64_t h, GLuint v, GLuint vt, GLuint vn, GLuint idx, GLuint &found){
+			//Keep the load factor under 1/2 so probe sequences stay short
+			if (2 * (count + 1) > table.size()){
+				grow();
+			}
+			size_t i = static_cast<size_t>(h) & mask;
+			while (table[i].v != 0){
+				const Entry &e = table[i];
+				if (e.v == v && e.vt == vt && e.vn == vn){
+					found = e.idx;
+					return false;
+				}
+				i = (i + 1) & mask;
+			}
+			Entry e = { v, vt, vn, idx };
+			table[i] = e;
+			++count;
+			found = idx;
+			return true;
+		}
+
+	private:
+		void clear(){
+			Entry empty = { 0, 0, 0, 0 };
+			std::fill(table.begin(), table.end(), empty);
+		}
+		void grow(){
+			std::vector<Entry> old(table.size() * 2);
+			old.swap(table);
+			mask = table.size() - 1;
+			clear();
+			for (const Entry &e : old){
+				if (e.v != 0){
+					size_t i = static_cast<size_t>(hash(e.v, e.vt, e.vn)) & mask;
+					while (table[i].v != 0){
+						i = (i + 1) & mask;
+					}
+					table[i] = e;
+				}
+			}
+		}
+
+	public:
+		static uint64_t hash(GLuint v, GLuint vt, GLuint vn){
+			uint64_t h = v * 0x9E3779B97F4A7C15ull;
+			h ^= (vt + 0x632BE59BD9B4E019ull + (h << 6) + (h >> 2)) * 0xC2B2AE3D27D4EB4Full;
+			h ^= (vn + 0x165667B19E3779F9ull + (h << 6) + (h >> 2)) * 0x9E3779B97F4A7C15ull;
+			return h ^ (h >> 32);
+		}
+	};
+
+	//Chunks smaller than this aren't worth handing to another thread
+	const size_t MIN_CHUNK_BYTES = 1 << 20;
+
+	/*
+	 * A face read by a parser thread, the counts of each kind of vertex data
+	 * seen earlier in the chunk are kept to resolve relative indices later
+	 */
+	struct FaceRecord {
+		size_t firstCorner, nCorners;
+		size_t nPos, nUv, nNorm;
+	};
+	/*
+	 * The raw v/vt/vn indices of a face vertex as written in the file
+	 */
+	struct Corner {
+		long idx[3];
+	};
+	/*
+	 * A newline aligned chunk of the file and the records read from it by a parser thread
+	 */
+	struct Chunk {
+		const char *begin, *end;
+		std::vector<glm::vec3> pos, norm;
+		std::vector<glm::vec2> uv;
+		std::vector<FaceRecord> faces;
+		std::vector<Corner> corners;
+		//Offsets of this chunk's data in the merged arrays
+		size_t posBase, uvBase, normBase, cornerBase, triBase, nTris;
+		bool ok;
+	};
+	/*
+	 * Read the v, vt, vn and f records of a chunk, faces are stored unresolved
+	 * since relative indices depend on the data in earlier chunks
+	 */
+	void parseChunk(Chunk &chunk){
+		chunk.ok = false;
+		const char *p = chunk.begin, *end = chunk.end;
+		while (p != end){
+			skipSpace(p, end);
+			if (p == end){
+				break;
+			}
+			if (*p == 'v' && p + 1 != end){
+				bool ok = true;
+				if (isSpace(p[1])){
+					++p;
+					glm::vec3 v;
+					ok = parseFloat(p, end, v.x) && parseFloat(p, end, v.y) && parseFloat(p, end, v.z);
+					chunk.pos.push_back(v);
+				}
+				else if (p[1] == 't'){
+					p += 2;
+					glm::vec2 v;
+					ok = parseFloat(p, end, v.x) && parseFloat(p, end, v.y);
+					chunk.uv.push_back(v);
+				}
+				else if (p[1] == 'n'){
+					p += 2;
+					glm::vec3 v;
+					ok = parseFloat(p, end, v.x) && parseFloat(p, end, v.y) && parseFloat(p, end, v.z);
+					chunk.norm.push_back(v);
+				}
+				if (!ok){
+					return;
+				}
+			}
+			else if (*p == 'f' && p + 1 != end && isSpace(p[1])){
+				++p;
+				FaceRecord face = { chunk.corners.size(), 0, chunk.pos.size(),
+					chunk.uv.size(), chunk.norm.size() };
+				while (true){
+					skipSpace(p, end);
+					if (p == end || *p == '\n' || *p == '#'){
+						break;
+					}
+					Corner c;
+					if (!parseFaceVertex(p, end, c.idx)){
+						return;
+					}
+					chunk.corners.push_back(c);
+					++face.nCorners;
+				}
+				if (face.nCorners < 3){
+					return;
+				}
+				chunk.faces.push_back(face);
+				chunk.nTris += face.nCorners - 2;
+			}
+			skipLine(p, end);
+		}
+		chunk.ok = true;
+	}
+	/*
+	 * Resolve an index read by a parser thread to a global 1-based one, base is
+	 * the count of the data in earlier chunks and seen the count read in the chunk
+	 * before the face. Like the serial parser only earlier data can be referenced
+	 */
+	bool resolveChunkIndex(long idx, size_t base, size_t seen, GLuint &out){
+		return resolveIndex(idx, base + seen, out);
+	}
+}
+
+obj::ParseStats::ParseStats() : bytes(0), triangles(0), vertices(0), seconds(0){}
+double obj::ParseStats::mbPerSec() const {
+	return seconds > 0 ? bytes / (1024.0 * 1024.0) / seconds : 0;
+}
+double obj::ParseStats::trisPerSec() const {
+	return seconds > 0 ? triangles / seconds : 0;
+}
+bool obj::parse(const std::string &fName, Mesh &mesh, ParseStats *stats){
+	MappedFile file(fName);
+	if (!file.isOpen()){
+		std::cout << "Failed to find obj file: " << fName << std::endl;
+		return false;
+	}
+	if (!parse(file.data(), file.data() + file.size(), mesh, stats)){
+		std::cout << "Failed to parse obj file: " << fName << std::endl;
+		return false;
+	}
+	return true;
+}
+bool obj::parse(const char *begin, const char *end, Mesh &mesh, ParseStats *stats){
+	auto start = std::chrono::high_resolution_clock::now();
+	mesh.vertices.clear();
+	mesh.indices.clear();
+	//Temporary storage for the data we read in
+	std::vector<glm::vec3> tmpPos, tmpNorm;
+	std::vector<glm::vec2> tmpUv;
+	VertexHash vertexIndices;
+
+	size_t lineNum = 1;
+	const char *p = begin;
+	while (p != end){
+		skipSpace(p, end);
+		if (p == end){
+			break;
+		}
+		//Parse vertex info: positions, uv coords and normals
+		if (*p == 'v' && p + 1 != end){
+			bool ok = true;
+			if (isSpace(p[1])){
+				++p;
+				glm::vec3 v;
+				ok = parseFloat(p, end, v.x) && parseFloat(p, end, v.y) && parseFloat(p, end, v.z);
+				tmpPos.push_back(v);
+			}
+			else if (p[1] == 't'){
+				p += 2;
+				glm::vec2 v;
+				ok = parseFloat(p, end, v.x) && parseFloat(p, end, v.y);
+				tmpUv.push_back(v);
+			}
+			else if (p[1] == 'n'){
+				p += 2;
+				glm::vec3 v;
+				ok = parseFloat(p, end, v.x) && parseFloat(p, end, v.y) && parseFloat(p, end, v.z);
+				tmpNorm.push_back(v);
+			}
+			if (!ok){
+				std::cout << "OBJ parse error: malformed vertex data on line " << lineNum << std::endl;
+				return false;
+			}
+		}
+		//Parse faces, polygons are triangulated as fans around the first vertex
+		else if (*p == 'f' && p + 1 != end && isSpace(p[1])){
+			++p;
+			GLuint first = 0, prev = 0;
+			int n = 0;
+			while (true){
+				skipSpace(p, end);
+				if (p == end || *p == '\n' || *p == '#'){
+					break;
+				}
+				long idx[3];
+				GLuint v = 0, vt = 0, vn = 0;
+				if (!parseFaceVertex(p, end, idx) || !resolveIndex(idx[0], tmpPos.size(), v)
+					|| v == 0 || !resolveIndex(idx[1], tmpUv.size(), vt)
+					|| !resolveIndex(idx[2], tmpNorm.size(), vn))
+				{
+					std::cout << "OBJ parse error: bad face vertex on line " << lineNum << std::endl;
+					return false;
+				}
+				GLuint vi;
+				//If we find the vertex already in the table re-use the index
+				//If not we create a new vertex, note that obj data is 1-indexed
+				if (vertexIndices.findOrInsert(v, vt, vn, mesh.vertices.size(), vi)){
+					Vertex vert;
+					vert.pos = tmpPos[v - 1];
+					vert.normal = vn != 0 ? tmpNorm[vn - 1] : glm::vec3(0.f);
+					vert.uv = vt != 0 ? glm::vec3(tmpUv[vt - 1], 0.f) : glm::vec3(0.f);
+					mesh.vertices.push_back(vert);
+				}
+				if (n == 0){
+					first = vi;
+				}
+				else if (n >= 2){
+					mesh.indices.push_back(first);
+					mesh.indices.push_back(prev);
+					mesh.indices.push_back(vi);
+				}
+				prev = vi;
+				++n;
+			}
+			if (n < 3){
+				std::cout << "OBJ parse error: face with fewer than 3 vertices on line "
+					<< lineNum << std::endl;
+				return false;
+			}
+		}
+		//Anything left on the line (comments, groups, materials, etc.) is skipped
+		skipLine(p, end);
+		++lineNum;
+	}
+	if (stats){
+		auto stop = std::chrono::high_resolution_clock::now();
+		stats->bytes = end - begin;
+		stats->triangles = mesh.indices.size() / 3;
+		stats->vertices = mesh.vertices.size();
+		stats->seconds = std::chrono::duration<double>(stop - start).count();
+	}
+	return true;
+}
+void obj::logStats(const std::string &fName, const ParseStats &stats){
+	std::cout << "Parsed " << fName << ": " << stats.triangles << " tris, "
+		<< stats.vertices << " verts in " << stats.seconds * 1000.0 << "ms ("
+		<< stats.mbPerSec() << " MB/s, " << stats.trisPerSec() << " tris/s)\n";
+}
+
+bool obj::parseParallel(const char *begin, const char *end, Mesh &mesh, size_t threads,
+	ParseStats *stats)
+{
+	if (threads == 0){
+		threads = std::max(std::thread::hardware_concurrency(), 1u);
+	}
+	threads = std::min(threads, std::max(static_cast<size_t>(end - begin) / MIN_CHUNK_BYTES,
+		size_t(1)));
+	if (threads == 1){
+		return parse(begin, end, mesh, stats);
+	}
+	auto start = std::chrono::high_resolution_clock::now();
+	//Split the file into chunks, moving each split forward to the start of the next line
+	std::vector<Chunk> chunks(threads);
+	const char *split = begin;
+	for (size_t i = 0; i < threads; ++i){
+		Chunk &c = chunks[i];
+		c.begin = split;
+		split = i + 1 == threads ? end : std::max(begin + (end - begin) * (i + 1) / threads, split);
+		while (split != end && split[-1] != '\n'){
+			++split;
+		}
+		c.end = split;
+		c.nTris = 0;
+	}
+	parallel::run(threads, [&](size_t t){
+		parseChunk(chunks[t]);
+	});
+
+	//Lay out where each chunk's data goes in the merged arrays
+	size_t nPos = 0, nUv = 0, nNorm = 0, nCorners = 0, nTris = 0;
+	for (Chunk &c : chunks){
+		//If something's wrong with the file let the serial parser find and report it
+		if (!c.ok){
+			return parse(begin, end, mesh, stats);
+		}
+		c.posBase = nPos;
+		c.uvBase = nUv;
+		c.normBase = nNorm;
+		c.cornerBase = nCorners;
+		c.triBase = nTris;
+		nPos += c.pos.size();
+		nUv += c.uv.size();
+		nNorm += c.norm.size();
+		nCorners += c.corners.size();
+		nTris += c.nTris;
+	}
+	std::vector<glm::vec3> tmpPos(nPos), tmpNorm(nNorm);
+	std::vector<glm::vec2> tmpUv(nUv);
+	//The resolved v/vt/vn triple of each corner, its hash and the first corner with the same triple
+	std::vector<GLuint> keys(nCorners * 3);
+	std::vector<uint64_t> hashes(nCorners);
+	std::vector<GLuint> firstSeen(nCorners);
+	//The corners of each chunk whose hash falls in each thread's partition of
+	//the triples, in the order they appear
+	std::vector<std::vector<std::vector<GLuint>>> partitions(threads,
+		std::vector<std::vector<GLuint>>(threads));
+	//Not a vector<bool> since the threads write to it concurrently
+	std::vector<char> chunkOk(threads, 1);
+	parallel::run(threads, [&](size_t t){
+		Chunk &c = chunks[t];
+		std::copy(c.pos.begin(), c.pos.end(), tmpPos.begin() + c.posBase);
+		std::copy(c.uv.begin(), c.uv.end(), tmpUv.begin() + c.uvBase);
+		std::copy(c.norm.begin(), c.norm.end(), tmpNorm.begin() + c.normBase);
+		for (std::vector<GLuint> &p : partitions[t]){
+			p.reserve(c.corners.size() / threads + 1);
+		}
+		for (const FaceRecord &f : c.faces){
+			for (size_t i = f.firstCorner; i < f.firstCorner + f.nCorners; ++i){
+				const Corner &corner = c.corners[i];
+				GLuint *key = &keys[(c.cornerBase + i) * 3];
+				if (!resolveChunkIndex(corner.idx[0], c.posBase, f.nPos, key[0]) || key[0] == 0
+					|| !resolveChunkIndex(corner.idx[1], c.uvBase, f.nUv, key[1])
+					|| !resolveChunkIndex(corner.idx[2], c.normBase, f.nNorm, key[2]))
+				{
+					chunkOk[t] = 0;
+					return;
+				}
+				const uint64_t h = VertexHash::hash(key[0], key[1], key[2]);
+				hashes[c.cornerBase + i] = h;
+				partitions[t][(h >> 48) % threads].push_back(c.cornerBase + i);
+			}
+		}
+	});
+	for (size_t t = 0; t < threads; ++t){
+		if (!chunkOk[t]){
+			return parse(begin, end, mesh, stats);
+		}
+	}
+	//Find the first corner using each unique triple, each thread owns the triples
+	//whose hash falls in its partition so no locking is needed. Walking the
+	//chunks' corners in order keeps the first use the same as the serial parser
+	parallel::run(threads, [&](size_t t){
+		VertexHash table;
+		for (size_t c = 0; c < threads; ++c){
+			for (GLuint i : partitions[c][t]){
+				const GLuint *key = &keys[i * 3];
+				table.findOrInsert(hashes[i], key[0], key[1], key[2], i, firstSeen[i]);
+			}
+		}
+	});
+	//Number the unique vertices in order of first use, matching the serial parser
+	std::vector<GLuint> vertexIds(nCorners);
+	std::vector<GLuint> vertexCorners;
+	for (size_t i = 0; i < nCorners; ++i){
+		if (firstSeen[i] == i){
+			vertexIds[i] = vertexCorners.size();
+			vertexCorners.push_back(i);
+		}
+		else {
+			vertexIds[i] = vertexIds[firstSeen[i]];
+		}
+	}
+	mesh.vertices.resize(vertexCorners.size());
+	mesh.indices.resize(nTris * 3);
+	parallel::run(threads, [&](size_t t){
+		//Build this thread's share of the vertices
+		size_t vBegin = mesh.vertices.size() * t / threads;
+		size_t vEnd = mesh.vertices.size() * (t + 1) / threads;
+		for (size_t i = vBegin; i < vEnd; ++i){
+			const GLuint *key = &keys[vertexCorners[i] * 3];
+			Vertex &vert = mesh.vertices[i];
+			vert.pos = tmpPos[key[0] - 1];
+			vert.normal = key[2] != 0 ? tmpNorm[key[2] - 1] : glm::vec3(0.f);
+			vert.uv = key[1] != 0 ? glm::vec3(tmpUv[key[1] - 1], 0.f) : glm::vec3(0.f);
+		}
+		//and triangulate the faces from its chunk
+		const Chunk &c = chunks[t];
+		GLuint *out = mesh.indices.data() + c.triBase * 3;
+		for (const FaceRecord &f : c.faces){
+			const GLuint *ids = &vertexIds[c.cornerBase + f.firstCorner];
+			for (size_t i = 2; i < f.nCorners; ++i){
+				*out++ = ids[0];
+				*out++ = ids[i - 1];
+				*out++ = ids[i];
+			}
+		}
+	});
+	if (stats){
+		auto stop = std::chrono::high_resolution_clock::now();
+		stats->bytes = end - begin;
+		stats->triangles = mesh.indices.size() / 3;
+		stats->vertices = mesh.vertices.size();
+		stats->seconds = std::chrono::duration<double>(stop - start).count();
+	}
+	return true;
+}
@@ -0,0 +1,67 @@
+#include <algorithm>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include "parallel.h"
+
+parallel::Pool::Pool(size_t threads) : job(nullptr), jobThreads(0), remaining(0),
+	generation(0), quit(false)
+{
+	for (size_t t = 1; t < threads; ++t){
+		workers.push_back(std::thread(&Pool::work, this, t));
+	}
+}
+parallel::Pool::~Pool(){
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		quit = true;
+	}
+	wake.notify_all();
+	for (std::thread &w : workers){
+		w.join();
+	}
+}
+size_t parallel::Pool::size() const {
+	return workers.size() + 1;
+}
+void parallel::Pool::run(size_t threads, const std::function<void(size_t)> &fn){
+	threads = std::max(std::min(threads, size()), static_cast<size_t>(1));
+	if (threads == 1){
+		fn(0);
+		return;
+	}
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		job = &fn;
+		jobThreads = threads;
+		remaining = threads - 1;
+		++generation;
+	}
+	wake.notify_all();
+	fn(0);
+	std::unique_lock<std::mutex> lock(mutex);
+	done.wait(lock, [this]{ return remaining == 0; });
+	job = nullptr;
+}
+void parallel::Pool::work(size_t t){
+	unsigned seen = 0;
+	std::unique_lock<std::mutex> lock(mutex);
+	while (true){
+		wake.wait(lock, [&]{ return quit || generation != seen; });
+		if (quit){
+			return;
+		}
+		seen = generation;
+		//Jobs on fewer threads leave the later workers out
+		if (t >= jobThreads){
+			continue;
+		}
+		const std::function<void(size_t)> &fn = *job;
+		lock.unlock();
+		fn(t);
+		lock.lock();
+		if (--remaining == 0){
+			done.notify_one();
+		}
+	}
+}
@@ -0,0 +1,238 @@
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <GL/glew.h>
+#include "profiler.h"
+
+Profiler::Scope::Scope(Profiler &profiler, const std::string &name) : profiler(profiler){
+	profiler.begin(name);
+}
+Profiler::Scope::~Scope(){
+	profiler.end();
+}
+
+Profiler::Profiler(bool waitGpu) : epoch(Clock::now()), gpuEpoch(0), current(0), droppedFrames(0),
+	waitGpu(waitGpu)
+{
+	//Take the GPU's clock at about the same time so its times can be put on
+	//the CPU's timeline
+	glGetInteger64v(GL_TIMESTAMP, &gpuEpoch);
+	for (int q = 0; q < QUERY_FRAMES; ++q){
+		pending[q].queriesUsed = 0;
+	}
+}
+Profiler::~Profiler(){
+	for (int q = 0; q < QUERY_FRAMES; ++q){
+		if (!queries[q].empty()){
+			glDeleteQueries(queries[q].size(), queries[q].data());
+		}
+	}
+}
+void Profiler::begin(const std::string &name){
+	Frame &frame = pending[current];
+	std::vector<GLuint> &set = queries[current];
+	//The sets grow to fit the most sections seen in a frame
+	if (frame.queriesUsed + 2 > set.size()){
+		const size_t prev = set.size();
+		set.resize(prev + 2);
+		glGenQueries(2, &set[prev]);
+	}
+	Event e;
+	e.section = sectionIndex(name);
+	e.depth = open.size();
+	e.cpuStart = cpuNow();
+	e.cpuEnd = e.cpuStart;
+	e.gpuStart = e.gpuEnd = -1.0;
+	e.query = frame.queriesUsed;
+	frame.queriesUsed += 2;
+	glQueryCounter(set[e.query], GL_TIMESTAMP);
+	open.push_back(frame.events.size());
+	frame.events.push_back(e);
+}
+void Profiler::end(){
+	if (open.empty()){
+		std::cerr << "Profiler: end without a section open\n";
+		return;
+	}
+	Event &e = pending[current].events[open.back()];
+	open.pop_back();
+	glQueryCounter(queries[current][e.query + 1], GL_TIMESTAMP);
+	e.cpuEnd = cpuNow();
+}
+void Profiler::endFrame(){
+	if (!open.empty()){
+		std::cerr << "Profiler: frame ended with " << open.size() << " sections open\n";
+		while (!open.empty()){
+			end();
+		}
+	}
+	//The next set of queries is the oldest, it's been QUERY_FRAMES frames
+	//since it was used so it should be long done. When waiting on the GPU
+	//the frame just ended is read back and the sets are never left pending
+	if (!waitGpu){
+		current = (current + 1) % QUERY_FRAMES;
+	}
+	Frame &frame = pending[current];
+	if (!frame.events.empty()){
+		if (!resolve(current, waitGpu)){
+			++droppedFrames;
+		}
+		finished.push_back(frame);
+		if (finished.size() > TRACE_FRAMES){
+			finished.pop_front();
+		}
+	}
+	frame.events.clear();
+	frame.queriesUsed = 0;
+}
+std::vector<Profiler::Summary> Profiler::summarize(size_t frames) const {
+	std::vector<Summary> summary(sections.size());
+	std::vector<size_t> cpuFrames(sections.size(), 0), gpuFrames(sections.size(), 0);
+	for (size_t i = 0; i < sections.size(); ++i){
+		Summary &s = summary[i];
+		s.name = sections[i];
+		s.depth = 0;
+		s.cpuMs = s.cpuMaxMs = s.gpuMs = s.gpuMaxMs = 0.0;
+	}
+	frames = std::min(frames, finished.size());
+	//A section may be timed more than once in a frame, so total it up per
+	//frame before taking the average and max over the frames
+	std::vector<double> cpu(sections.size()), gpu(sections.size());
+	std::vector<char> seen(sections.size()), gpuSeen(sections.size());
+	for (size_t f = finished.size() - frames; f < finished.size(); ++f){
+		std::fill(cpu.begin(), cpu.end(), 0.0);
+		std::fill(gpu.begin(), gpu.end(), 0.0);
+		std::fill(seen.begin(), seen.end(), 0);
+		std::fill(gpuSeen.begin(), gpuSeen.end(), 0);
+		for (const Event &e : finished[f].events){
+			cpu[e.section] += e.cpuEnd - e.cpuStart;
+			seen[e.section] = 1;
+			summary[e.section].depth = e.depth;
+			if (e.gpuStart >= 0.0){
+				gpu[e.section] += e.gpuEnd - e.gpuStart;
+				gpuSeen[e.section] = 1;
+			}
+		}
+		for (size_t i = 0; i < sections.size(); ++i){
+			Summary &s = summary[i];
+			if (seen[i]){
+				s.cpuMs += cpu[i];
+				s.cpuMaxMs = std::max(s.cpuMaxMs, cpu[i]);
+				++cpuFrames[i];
+			}
+			if (gpuSeen[i]){
+				s.gpuMs += gpu[i];
+				s.gpuMaxMs = std::max(s.gpuMaxMs, gpu[i]);
+				++gpuFrames[i];
+			}
+		}
+	}
+	for (size_t i = 0; i < sections.size(); ++i){
+		if (cpuFrames[i] > 0){
+			summary[i].cpuMs /= cpuFrames[i];
+		}
+		if (gpuFrames[i] > 0){
+			summary[i].gpuMs /= gpuFrames[i];
+		}
+	}
+	return summary;
+}
+std::string Profiler::summaryLine(size_t frames) const {
+	std::ostringstream line;
+	line << std::fixed << std::setprecision(2) << "cpu/gpu ms over "
+		<< std::min(frames, finished.size()) << " frames:";
+	for (const Summary &s : summarize(frames)){
+		line << " " << std::string(s.depth, '>') << s.name << " " << s.cpuMs << "/" << s.gpuMs
+			<< " (max " << s.gpuMaxMs << ")";
+	}
+	return line.str();
+}
+bool Profiler::gpuTimes(const std::vector<std::string> &names, std::vector<double> &ms) const {
+	ms.assign(names.size(), 0.0);
+	if (finished.empty()){
+		return false;
+	}
+	for (const Event &e : finished.back().events){
+		if (e.gpuStart < 0.0){
+			return false;
+		}
+		for (size_t i = 0; i < names.size(); ++i){
+			if (names[i] == sections[e.section]){
+				ms[i] += e.gpuEnd - e.gpuStart;
+			}
+		}
+	}
+	return true;
+}
+bool Profiler::writeTrace(const std::string &file) const {
+	std::ofstream out(file, std::ios::trunc);
+	if (!out.is_open()){
+		std::cerr << "Profiler: Failed to open " << file << "\n";
+		return false;
+	}
+	//Chrome traces take times in microseconds, the CPU and GPU are shown as
+	//two threads of one process
+	out << std::fixed << std::setprecision(3)
+		<< "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n"
+		<< "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": 1, "
+		<< "\"args\": {\"name\": \"CPU\"}},\n"
+		<< "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": 2, "
+		<< "\"args\": {\"name\": \"GPU\"}}";
+	for (const Frame &frame : finished){
+		for (const Event &e : frame.events){
+			out << ",\n{\"name\": \"" << sections[e.section] << "\", \"cat\": \"cpu\", "
+				<< "\"ph\": \"X\", \"pid\": 1, \"tid\": 1, \"ts\": " << e.cpuStart * 1000.0
+				<< ", \"dur\": " << (e.cpuEnd - e.cpuStart) * 1000.0 << "}";
+			if (e.gpuStart >= 0.0){
+				out << ",\n{\"name\": \"" << sections[e.section] << "\", \"cat\": \"gpu\", "
+					<< "\"ph\": \"X\", \"pid\": 1, \"tid\": 2, \"ts\": " << e.gpuStart * 1000.0
+					<< ", \"dur\": " << (e.gpuEnd - e.gpuStart) * 1000.0 << "}";
+			}
+		}
+	}
+	out << "\n]}\n";
+	if (!out){
+		std::cerr << "Profiler: Failed to write " << file << "\n";
+		return false;
+	}
+	return true;
+}
+size_t Profiler::dropped() const {
+	return droppedFrames;
+}
+double Profiler::cpuNow() const {
+	return std::chrono::duration<double, std::milli>(Clock::now() - epoch).count();
+}
+size_t Profiler::sectionIndex(const std::string &name){
+	//There's only a handful of sections so a search is fine
+	std::vector<std::string>::iterator it = std::find(sections.begin(), sections.end(), name);
+	if (it != sections.end()){
+		return it - sections.begin();
+	}
+	sections.push_back(name);
+	return sections.size() - 1;
+}
+bool Profiler::resolve(int q, bool wait){
+	Frame &frame = pending[q];
+	const std::vector<GLuint> &set = queries[q];
+	//Check every query's done first so reading them back never waits
+	if (!wait){
+		for (const Event &e : frame.events){
+			GLint available = 0;
+			glGetQueryObjectiv(set[e.query + 1], GL_QUERY_RESULT_AVAILABLE, &available);
+			if (!available){
+				return false;
+			}
+		}
+	}
+	for (Event &e : frame.events){
+		GLint64 start = 0, stop = 0;
+		glGetQueryObjecti64v(set[e.query], GL_QUERY_RESULT, &start);
+		glGetQueryObjecti64v(set[e.query + 1], GL_QUERY_RESULT, &stop);
+		e.gpuStart = (start - gpuEpoch) / 1e6;
+		e.gpuEnd = (stop - gpuEpoch) / 1e6;
+	}
+	return true;
+}
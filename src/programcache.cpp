@@ -0,0 +1,224 @@
+#include <map>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <GL/glew.h>
+
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
+
+#include "meshcache.h"
+#include "util.h"
+#include "programcache.h"
+
+namespace {
+	const char BINARY_MAGIC[4] = { 'D', 'R', 'P', 'B' };
+	const uint32_t BINARY_VERSION = 1;
+
+	struct Entry {
+		std::string key;
+		unsigned refs;
+	};
+	/*
+	 * Header of a program binary file, the binary follows it
+	 */
+	struct BinaryHeader {
+		char magic[4];
+		uint32_t version;
+		uint64_t key;
+		uint32_t format, length;
+	};
+	std::map<std::string, GLuint> programs;
+	std::map<GLuint, Entry> entries;
+	GLuint bound = 0;
+	programcache::Stats cacheStats = { 0, 0, 0, 0, 0.0 };
+	//Empty if the binary cache isn't enabled
+	std::string binaryDir;
+
+	/*
+	 * Hash everything that could make a saved binary invalid, the sources
+	 * are hashed instead of their paths so edited shaders are rebuilt
+	 */
+	uint64_t binaryKey(const std::string &vertfname, const std::string &fragfname,
+		const std::string &defines)
+	{
+		std::string k = util::readFile(vertfname) + '\0' + util::readFile(fragfname) + '\0'
+			+ defines + '\0';
+		for (GLenum s : { GL_VENDOR, GL_RENDERER, GL_VERSION }){
+			const GLubyte *str = glGetString(s);
+			k += str ? reinterpret_cast<const char*>(str) : "";
+			k += '\0';
+		}
+		return meshcache::hash(k.data(), k.size());
+	}
+	std::string binaryPath(uint64_t key){
+		char name[17];
+		std::snprintf(name, sizeof(name), "%016llx", static_cast<unsigned long long>(key));
+		return binaryDir + "/" + name + ".bin";
+	}
+	/*
+	 * Create a program from a saved binary
+	 * returns -1 if there's no binary or the driver rejects it
+	 */
+	GLint loadBinary(const std::string &file, uint64_t key){
+		std::ifstream in(file, std::ios::binary);
+		if (!in.is_open()){
+			return -1;
+		}
+		BinaryHeader header;
+		if (!in.read(reinterpret_cast<char*>(&header), sizeof(header))
+			|| std::memcmp(header.magic, BINARY_MAGIC, sizeof(BINARY_MAGIC)) != 0
+			|| header.version != BINARY_VERSION || header.key != key)
+		{
+			return -1;
+		}
+		std::vector<char> binary(header.length);
+		if (!in.read(binary.data(), binary.size())){
+			return -1;
+		}
+		GLuint program = glCreateProgram();
+		glProgramBinary(program, header.format, binary.data(), binary.size());
+		GLint status;
+		glGetProgramiv(program, GL_LINK_STATUS, &status);
+		if (status == GL_FALSE){
+			//Usually the driver was updated, we'll rebuild and overwrite it
+			std::cout << "Program binary " << file << " was rejected, compiling from source\n";
+			glDeleteProgram(program);
+			return -1;
+		}
+		return program;
+	}
+	void saveBinary(const std::string &file, uint64_t key, GLuint program){
+		GLint length = 0;
+		glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+		if (length <= 0){
+			return;
+		}
+		std::vector<char> binary(length);
+		GLenum format;
+		glGetProgramBinary(program, length, &length, &format, binary.data());
+		BinaryHeader header;
+		std::memcpy(header.magic, BINARY_MAGIC, sizeof(BINARY_MAGIC));
+		header.version = BINARY_VERSION;
+		header.key = key;
+		header.format = format;
+		header.length = length;
+
+		//Written to a temporary file and moved into place like the mesh cache
+		std::string tmpFile = file + ".tmp";
+		{
+			std::ofstream out(tmpFile, std::ios::binary | std::ios::trunc);
+			out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+			out.write(binary.data(), length);
+			if (!out.good()){
+				std::cout << "Failed to write program binary: " << tmpFile << std::endl;
+				out.close();
+				std::remove(tmpFile.c_str());
+				return;
+			}
+		}
+		std::remove(file.c_str());
+		if (std::rename(tmpFile.c_str(), file.c_str()) != 0){
+			std::remove(tmpFile.c_str());
+		}
+	}
+	/*
+	 * Load the program from the binary cache or build it from source, saving
+	 * the binary if it was built
+	 */
+	GLint buildProgram(const std::string &vertfname, const std::string &fragfname,
+		const std::string &defines)
+	{
+		if (binaryDir.empty()){
+			return util::loadProgram(vertfname, fragfname, defines);
+		}
+		const uint64_t key = binaryKey(vertfname, fragfname, defines);
+		const std::string file = binaryPath(key);
+		GLint program = loadBinary(file, key);
+		if (program != -1){
+			++cacheStats.binaryLoads;
+			return program;
+		}
+		program = util::loadProgram(vertfname, fragfname, defines, true);
+		if (program != -1){
+			saveBinary(file, key, program);
+		}
+		return program;
+	}
+}
+
+void programcache::enableBinaryCache(const std::string &dir){
+	GLint formats = 0;
+	if (GLEW_ARB_get_program_binary){
+		glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+	}
+	if (formats == 0){
+		std::cout << "Program binaries aren't supported by the driver, compiling from source\n";
+		binaryDir.clear();
+		return;
+	}
+#ifdef _WIN32
+	_mkdir(dir.c_str());
+#else
+	mkdir(dir.c_str(), 0755);
+#endif
+	binaryDir = dir;
+}
+
+GLint programcache::acquire(const std::string &vertfname, const std::string &fragfname,
+	const std::string &defines)
+{
+	const std::string key = vertfname + "\n" + fragfname + "\n" + defines;
+	auto found = programs.find(key);
+	if (found != programs.end()){
+		++entries[found->second].refs;
+		++cacheStats.shared;
+		return found->second;
+	}
+	auto start = std::chrono::high_resolution_clock::now();
+	GLint program = buildProgram(vertfname, fragfname, defines);
+	auto stop = std::chrono::high_resolution_clock::now();
+	cacheStats.seconds += std::chrono::duration<double>(stop - start).count();
+	if (program == -1){
+		return -1;
+	}
+	programs[key] = program;
+	Entry e = { key, 1 };
+	entries[program] = e;
+	++cacheStats.linked;
+	return program;
+}
+void programcache::release(GLuint program){
+	auto found = entries.find(program);
+	if (found == entries.end()){
+		std::cerr << "programcache::release: program " << program << " isn't in the cache\n";
+		return;
+	}
+	if (--found->second.refs == 0){
+		programs.erase(found->second.key);
+		entries.erase(found);
+		glDeleteProgram(program);
+		//The name may be reused by a new program so forget that it's bound
+		if (bound == program){
+			bound = 0;
+		}
+	}
+}
+void programcache::use(GLuint program){
+	if (program != bound){
+		glUseProgram(program);
+		bound = program;
+		++cacheStats.switches;
+	}
+}
+const programcache::Stats& programcache::stats(){
+	return cacheStats;
+}
@@ -0,0 +1,202 @@
+#include <algorithm>
+#include <cstring>
+#include <GL/glew.h>
+#include "model.h"
+#include "programcache.h"
+#include "renderqueue.h"
+
+//Bits of each field of the sort key
+const int PASS_BITS = 4, ID_BITS = 12, DEPTH_BITS = 24;
+
+StateCache::StateCache() : programChanges(0), vaoChanges(0), textureChanges(0){
+	reset();
+}
+void StateCache::reset(){
+	//0 is a real binding for each of these, so mark them unknown
+	program = vao = ~0u;
+	std::memset(textures, 0xff, sizeof(textures));
+}
+void StateCache::useProgram(GLuint p){
+	if (p != program){
+		programcache::use(p);
+		program = p;
+		++programChanges;
+	}
+}
+void StateCache::bindVertexArray(GLuint v){
+	if (v != vao){
+		glBindVertexArray(v);
+		vao = v;
+		++vaoChanges;
+	}
+}
+void StateCache::bindTexture(GLuint unit, GLuint texture){
+	if (unit >= static_cast<GLuint>(MAX_UNITS)){
+		glActiveTexture(GL_TEXTURE0 + unit);
+		glBindTexture(GL_TEXTURE_2D, texture);
+		++textureChanges;
+		return;
+	}
+	if (textures[unit] != texture){
+		glActiveTexture(GL_TEXTURE0 + unit);
+		glBindTexture(GL_TEXTURE_2D, texture);
+		textures[unit] = texture;
+		++textureChanges;
+	}
+}
+
+//Defined for the std::min call taking it by reference
+const size_t RenderQueue::MAX_BATCH;
+
+void DrawBatch::clear(){
+	counts.clear();
+	offsets.clear();
+	baseVertices.clear();
+	transforms.clear();
+}
+
+RenderQueue::RenderQueue(){
+	resetStats();
+}
+void RenderQueue::submit(Pass pass, Model *model, float depth){
+	const bool shadow = pass == SHADOW;
+	Packet p;
+	p.key = makeKey(pass, model->passProgram(shadow), shadow ? 0 : model->diffuseTexture(),
+		model->vertexArray(), depth);
+	p.model = model;
+	packets.push_back(p);
+}
+void RenderQueue::execute(){
+	if (packets.empty()){
+		return;
+	}
+	counts.draws += packets.size();
+	counts.unsortedChanges += countUnsortedChanges();
+	sort();
+	//Other code binds state between runs of the queue, so start from nothing known
+	cache.reset();
+	const size_t before = cache.programChanges + cache.vaoChanges + cache.textureChanges;
+	for (size_t i = 0; i < packets.size();){
+		const Packet &p = packets[i];
+		const bool shadow = p.key >> (64 - PASS_BITS) == SHADOW;
+		p.model->bindCached(cache, shadow);
+		//Find the run of draws that can go in one multi-draw with this one
+		size_t end = i + 1;
+		if (p.model->multiDrawable(shadow)){
+			while (end < packets.size() && sameState(p, packets[end], shadow)){
+				++end;
+			}
+		}
+		if (end - i == 1){
+			if (shadow){
+				p.model->drawShadow();
+			}
+			else {
+				p.model->draw();
+			}
+			++counts.drawCalls;
+		}
+		else {
+			batch.clear();
+			for (size_t j = i; j < end; ++j){
+				packets[j].model->batchDraws(shadow, batch);
+			}
+			drawBatch(p.model->transformUniform(shadow), p.model->indexType());
+		}
+		i = end;
+	}
+	counts.changes += cache.programChanges + cache.vaoChanges + cache.textureChanges - before;
+	packets.clear();
+}
+size_t RenderQueue::size() const {
+	return packets.size();
+}
+const RenderQueue::Stats& RenderQueue::stats() const {
+	return counts;
+}
+void RenderQueue::resetStats(){
+	counts.draws = 0;
+	counts.unsortedChanges = 0;
+	counts.changes = 0;
+	counts.drawCalls = 0;
+}
+uint64_t RenderQueue::makeKey(Pass pass, GLuint program, GLuint texture, GLuint vao,
+	float depth)
+{
+	const uint64_t idMask = (1 << ID_BITS) - 1;
+	//Non-negative floats order the same as their bits, so the top bits of
+	//the float are the depth quantized relative to its magnitude
+	uint32_t depthBits = 0;
+	depth = depth > 0.f ? depth : 0.f;
+	std::memcpy(&depthBits, &depth, sizeof(depthBits));
+	uint64_t key = static_cast<uint64_t>(pass) << (64 - PASS_BITS);
+	key |= (program & idMask) << (64 - PASS_BITS - ID_BITS);
+	key |= (texture & idMask) << (64 - PASS_BITS - 2 * ID_BITS);
+	key |= (vao & idMask) << DEPTH_BITS;
+	key |= depthBits >> (32 - DEPTH_BITS);
+	return key;
+}
+void RenderQueue::sort(){
+	//Count every byte's histogram in one sweep so bytes all the keys share
+	//can be skipped, the pass and high id bits often are
+	size_t histograms[8][256];
+	std::memset(histograms, 0, sizeof(histograms));
+	for (const Packet &p : packets){
+		for (int b = 0; b < 8; ++b){
+			++histograms[b][(p.key >> (8 * b)) & 0xff];
+		}
+	}
+	scratch.resize(packets.size());
+	for (int b = 0; b < 8; ++b){
+		size_t *counts = histograms[b];
+		if (counts[(packets[0].key >> (8 * b)) & 0xff] == packets.size()){
+			continue;
+		}
+		size_t offset = 0;
+		for (int i = 0; i < 256; ++i){
+			const size_t c = counts[i];
+			counts[i] = offset;
+			offset += c;
+		}
+		for (const Packet &p : packets){
+			scratch[counts[(p.key >> (8 * b)) & 0xff]++] = p;
+		}
+		packets.swap(scratch);
+	}
+}
+size_t RenderQueue::countUnsortedChanges() const {
+	size_t changes = 0;
+	GLuint program = ~0u;
+	for (const Packet &p : packets){
+		const bool shadow = p.key >> (64 - PASS_BITS) == SHADOW;
+		const GLuint next = p.model->passProgram(shadow);
+		if (next != program){
+			++changes;
+			program = next;
+		}
+		//bind and bindShadow always bind the VAO, and bind the texture
+		++changes;
+		if (!shadow && p.model->diffuseTexture()){
+			++changes;
+		}
+	}
+	return changes;
+}
+bool RenderQueue::sameState(const Packet &a, const Packet &b, bool shadow){
+	//The keys only sort the draws, their ids may collide so check the real ones
+	return (a.key >> (64 - PASS_BITS)) == (b.key >> (64 - PASS_BITS))
+		&& b.model->multiDrawable(shadow)
+		&& a.model->passProgram(shadow) == b.model->passProgram(shadow)
+		&& a.model->vertexArray() == b.model->vertexArray()
+		&& (shadow || (a.model->diffuseTexture() == b.model->diffuseTexture()
+			&& a.model->surfaceMaterial() == b.model->surfaceMaterial()));
+}
+void RenderQueue::drawBatch(GLint transformsUnif, GLenum indexType){
+	for (size_t first = 0; first < batch.counts.size(); first += MAX_BATCH){
+		const size_t n = std::min(MAX_BATCH, batch.counts.size() - first);
+		glUniform1iv(transformsUnif, n, &batch.transforms[first]);
+		glMultiDrawElementsBaseVertex(GL_TRIANGLES, &batch.counts[first], indexType,
+			&batch.offsets[first], n, &batch.baseVertices[first]);
+		++counts.drawCalls;
+	}
+}
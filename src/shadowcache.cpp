@@ -0,0 +1,36 @@
+#include <vector>
+#include <glm/glm.hpp>
+#include "model.h"
+#include "shadowcache.h"
+
+ShadowCache::ShadowCache() : valid(false), skipped(0), rendered(0){}
+bool ShadowCache::stale(const glm::mat4 &vp, const std::vector<size_t> &visible,
+	const std::vector<Model*> &models)
+{
+	bool same = valid && vp == lightVP && visible == casters;
+	for (size_t i = 0; same && i < visible.size(); ++i){
+		same = models[visible[i]]->shadowLodLevel() == lods[i];
+	}
+	if (same){
+		++skipped;
+		return false;
+	}
+	lightVP = vp;
+	casters = visible;
+	lods.resize(visible.size());
+	for (size_t i = 0; i < visible.size(); ++i){
+		lods[i] = models[visible[i]]->shadowLodLevel();
+	}
+	valid = true;
+	++rendered;
+	return true;
+}
+void ShadowCache::invalidate(){
+	valid = false;
+}
+size_t ShadowCache::skippedPasses() const {
+	return skipped;
+}
+size_t ShadowCache::renderedPasses() const {
+	return rendered;
+}
@@ -0,0 +1,258 @@
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <vector>
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include <glm/ext.hpp>
+#include "frustum.h"
+#include "shadowcascades.h"
+
+//How far past a cascade's slice of the view towards the light casters
+//are still drawn into it
+const float CASTER_RANGE = 50.f;
+//Cascade radii are rounded up to a multiple of this so they don't change
+//size with every small turn of the camera
+const float RADIUS_STEP = 1.f / 16.f;
+
+namespace {
+	/*
+	 * The contents of the Cascades block, padded out to MAX_CASCADES
+	 */
+	struct CascadeData {
+		glm::mat4 viewProjs[ShadowCascades::MAX_CASCADES];
+		glm::vec4 splits;
+	};
+}
+
+ShadowCascades::ShadowCascades(int size, int count, GLenum unit, float distance, float lambda)
+	: size(size), count(glm::clamp(count, 1, static_cast<int>(MAX_CASCADES))),
+	distance(distance), lambda(lambda), queryFrame(0)
+{
+	glActiveTexture(unit);
+	glGenTextures(1, &tex);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, tex);
+	glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_DEPTH_COMPONENT32F, size, size, this->count, 0,
+		GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, 0);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+	glGenFramebuffers(1, &fbo);
+	glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+	glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, tex, 0, 0);
+	glDrawBuffer(GL_NONE);
+	glReadBuffer(GL_NONE);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	GLint align = 0;
+	glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &align);
+	align = std::max(align, 1);
+	passStride = ((sizeof(glm::mat4) + align - 1) / align) * align;
+	glGenBuffers(1, &ubo);
+	glBindBuffer(GL_UNIFORM_BUFFER, ubo);
+	glBufferData(GL_UNIFORM_BUFFER, sizeof(CascadeData), NULL, GL_STREAM_DRAW);
+	glGenBuffers(1, &passUbo);
+	glBindBuffer(GL_UNIFORM_BUFFER, passUbo);
+	glBufferData(GL_UNIFORM_BUFFER, passStride * MAX_CASCADES, NULL, GL_STREAM_DRAW);
+
+	glGenQueries(QUERY_FRAMES * MAX_CASCADES, &queries[0][0]);
+	for (int c = 0; c < MAX_CASCADES; ++c){
+		for (int f = 0; f < QUERY_FRAMES; ++f){
+			queryPending[f][c] = false;
+		}
+		splits[c] = -1.f;
+		drawCounts[c] = 0;
+		skippedCascades[c] = false;
+		times[c] = 0.0;
+	}
+}
+ShadowCascades::~ShadowCascades(){
+	glDeleteQueries(QUERY_FRAMES * MAX_CASCADES, &queries[0][0]);
+	glDeleteBuffers(1, &passUbo);
+	glDeleteBuffers(1, &ubo);
+	glDeleteFramebuffers(1, &fbo);
+	glDeleteTextures(1, &tex);
+}
+bool ShadowCascades::ready() const {
+	glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+	GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	if (status != GL_FRAMEBUFFER_COMPLETE){
+		std::cerr << "ShadowCascades: Framebuffer incomplete: " << status << "\n";
+		return false;
+	}
+	return true;
+}
+void ShadowCascades::fit(const glm::mat4 &view, float fovy, float aspect, float nearPlane,
+	const glm::vec3 &lightDir)
+{
+	const float tanY = std::tan(glm::radians(fovy) / 2.f);
+	const float tanX = tanY * aspect;
+	const glm::mat4 invView = glm::inverse(view);
+	//The light looks down -lightDir, its view has no translation so snapping
+	//to texels in it doesn't depend on where the camera is
+	const glm::vec3 up = std::abs(lightDir.y) > 0.99f ? glm::vec3(1.f, 0.f, 0.f)
+		: glm::vec3(0.f, 1.f, 0.f);
+	const glm::mat4 lightView = glm::lookAt(glm::vec3(0.f), -lightDir, up);
+	CascadeData data;
+	float sliceNear = nearPlane;
+	for (int c = 0; c < MAX_CASCADES; ++c){
+		if (c >= count){
+			splits[c] = -1.f;
+			data.viewProjs[c] = glm::mat4(1.f);
+			continue;
+		}
+		const float t = (c + 1) / static_cast<float>(count);
+		const float logSplit = nearPlane * std::pow(distance / nearPlane, t);
+		const float uniformSplit = nearPlane + (distance - nearPlane) * t;
+		splits[c] = lambda * logSplit + (1.f - lambda) * uniformSplit;
+
+		//Find the bounding sphere of this slice of the view frustum
+		glm::vec3 corners[8];
+		glm::vec3 center(0.f);
+		for (int i = 0; i < 8; ++i){
+			const float d = i & 4 ? splits[c] : sliceNear;
+			corners[i] = glm::vec3(invView * glm::vec4(i & 1 ? d * tanX : -d * tanX,
+				i & 2 ? d * tanY : -d * tanY, -d, 1.f));
+			center += corners[i];
+		}
+		center /= 8.f;
+		float radius = 0.f;
+		for (int i = 0; i < 8; ++i){
+			radius = std::max(radius, glm::length(corners[i] - center));
+		}
+		radius = std::ceil(radius / RADIUS_STEP) * RADIUS_STEP;
+
+		//Snap the center to whole texels so the cascade only ever moves
+		//by whole texels
+		const float texel = 2.f * radius / size;
+		glm::vec3 lc = glm::vec3(lightView * glm::vec4(center, 1.f));
+		lc.x = std::floor(lc.x / texel) * texel;
+		lc.y = std::floor(lc.y / texel) * texel;
+		const glm::mat4 proj = glm::ortho(lc.x - radius, lc.x + radius, lc.y - radius,
+			lc.y + radius, -lc.z - radius - CASTER_RANGE, -lc.z + radius);
+		viewProjs[c] = proj * lightView;
+		data.viewProjs[c] = viewProjs[c];
+		sliceNear = splits[c];
+	}
+	data.splits = glm::vec4(splits[0], splits[1], splits[2], splits[3]);
+	glBindBuffer(GL_UNIFORM_BUFFER, ubo);
+	glBufferData(GL_UNIFORM_BUFFER, sizeof(CascadeData), NULL, GL_STREAM_DRAW);
+	glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(CascadeData), &data);
+	glBindBufferBase(GL_UNIFORM_BUFFER, BINDING, ubo);
+
+	std::vector<char> passData(passStride * MAX_CASCADES, 0);
+	for (int c = 0; c < count; ++c){
+		std::memcpy(&passData[c * passStride], &viewProjs[c], sizeof(glm::mat4));
+	}
+	glBindBuffer(GL_UNIFORM_BUFFER, passUbo);
+	glBufferData(GL_UNIFORM_BUFFER, passData.size(), passData.data(), GL_STREAM_DRAW);
+}
+void ShadowCascades::render(const Bvh &bvh, const std::vector<Model*> &models,
+	const std::vector<char> &layer)
+{
+	GLint viewport[4];
+	glGetIntegerv(GL_VIEWPORT, viewport);
+	glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+	glViewport(0, 0, size, size);
+	//Polygon offset fill helps resolve depth-fighting
+	glEnable(GL_POLYGON_OFFSET_FILL);
+	glPolygonOffset(2.f, 4.f);
+	const int q = queryFrame;
+	queryFrame = (queryFrame + 1) % QUERY_FRAMES;
+	queue.resetStats();
+	for (int c = 0; c < count; ++c){
+		//Pick up the time from the last frame that used this set of queries
+		if (queryPending[q][c]){
+			GLint available = 0;
+			glGetQueryObjectiv(queries[q][c], GL_QUERY_RESULT_AVAILABLE, &available);
+			if (available){
+				GLuint64 ns = 0;
+				glGetQueryObjectui64v(queries[q][c], GL_QUERY_RESULT, &ns);
+				times[c] = ns / 1e6;
+				queryPending[q][c] = false;
+			}
+		}
+		bvh.cull(Frustum(viewProjs[c]), visible);
+		casters.clear();
+		for (size_t i : visible){
+			if (layer[i]){
+				casters.push_back(i);
+			}
+		}
+		drawCounts[c] = casters.size();
+		skippedCascades[c] = !caches[c].stale(viewProjs[c], casters, models);
+		if (skippedCascades[c]){
+			continue;
+		}
+		glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, tex, 0, c);
+		glClear(GL_DEPTH_BUFFER_BIT);
+		glBindBufferRange(GL_UNIFORM_BUFFER, PASS_BINDING, passUbo, c * passStride,
+			sizeof(glm::mat4));
+		//If the GPU's so far behind the last queries aren't done skip timing this time
+		const bool timed = !queryPending[q][c];
+		if (timed){
+			glBeginQuery(GL_TIME_ELAPSED, queries[q][c]);
+		}
+		for (size_t i : casters){
+			queue.submit(RenderQueue::SHADOW, models[i], 0.f);
+		}
+		queue.execute();
+		if (timed){
+			glEndQuery(GL_TIME_ELAPSED);
+			queryPending[q][c] = true;
+		}
+	}
+	glDisable(GL_POLYGON_OFFSET_FILL);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+}
+void ShadowCascades::invalidate(){
+	for (int c = 0; c < MAX_CASCADES; ++c){
+		caches[c].invalidate();
+	}
+}
+int ShadowCascades::cascades() const {
+	return count;
+}
+size_t ShadowCascades::drawn(int cascade) const {
+	return drawCounts[cascade];
+}
+bool ShadowCascades::skipped(int cascade) const {
+	return skippedCascades[cascade];
+}
+double ShadowCascades::ms(int cascade) const {
+	return times[cascade];
+}
+size_t ShadowCascades::skippedPasses() const {
+	size_t n = 0;
+	for (int c = 0; c < count; ++c){
+		n += caches[c].skippedPasses();
+	}
+	return n;
+}
+size_t ShadowCascades::renderedPasses() const {
+	size_t n = 0;
+	for (int c = 0; c < count; ++c){
+		n += caches[c].renderedPasses();
+	}
+	return n;
+}
+const RenderQueue::Stats& ShadowCascades::stateStats() const {
+	return queue.stats();
+}
+void ShadowCascades::bindBlocks(GLuint program){
+	GLuint block = glGetUniformBlockIndex(program, "Cascades");
+	if (block != GL_INVALID_INDEX){
+		glUniformBlockBinding(program, block, BINDING);
+	}
+	block = glGetUniformBlockIndex(program, "ShadowPass");
+	if (block != GL_INVALID_INDEX){
+		glUniformBlockBinding(program, block, PASS_BINDING);
+	}
+}
@@ -0,0 +1,290 @@
+#include <vector>
+#include <queue>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include "mesh.h"
+#include "simplify.h"
+
+namespace {
+	//A level that doesn't get below this fraction of the previous level's
+	//triangles isn't worth keeping
+	const float MIN_REDUCTION = 0.8f;
+
+	/*
+	 * The quadric error of a set of planes, the upper triangle of the
+	 * symmetric 4x4 matrix summing the planes' outer products
+	 */
+	struct Quadric {
+		double q[10];
+
+		Quadric(){
+			std::fill(q, q + 10, 0.0);
+		}
+		Quadric(double a, double b, double c, double d){
+			q[0] = a * a; q[1] = a * b; q[2] = a * c; q[3] = a * d;
+			q[4] = b * b; q[5] = b * c; q[6] = b * d;
+			q[7] = c * c; q[8] = c * d;
+			q[9] = d * d;
+		}
+		Quadric& operator+=(const Quadric &o){
+			for (int i = 0; i < 10; ++i){
+				q[i] += o.q[i];
+			}
+			return *this;
+		}
+		//Sum of squared distances from p to the planes
+		double eval(const glm::vec3 &p) const {
+			const double x = p.x, y = p.y, z = p.z;
+			return q[0] * x * x + 2 * q[1] * x * y + 2 * q[2] * x * z + 2 * q[3] * x
+				+ q[4] * y * y + 2 * q[5] * y * z + 2 * q[6] * y
+				+ q[7] * z * z + 2 * q[8] * z
+				+ q[9];
+		}
+	};
+	/*
+	 * Moving vertex from onto vertex to, the versions of the vertices when the
+	 * collapse was queued tell us if its cost is stale
+	 */
+	struct Collapse {
+		double cost;
+		GLuint from, to;
+		unsigned fromVersion, toVersion;
+	};
+	struct CostlierCollapse {
+		bool operator()(const Collapse &a, const Collapse &b) const {
+			return a.cost > b.cost;
+		}
+	};
+	typedef std::priority_queue<Collapse, std::vector<Collapse>, CostlierCollapse> CollapseQueue;
+
+	bool lessPos(const glm::vec3 &a, const glm::vec3 &b){
+		if (a.x != b.x){
+			return a.x < b.x;
+		}
+		if (a.y != b.y){
+			return a.y < b.y;
+		}
+		return a.z < b.z;
+	}
+	/*
+	 * Find the vertices we can't move: those sharing their position with
+	 * another vertex, ie. on a normal or uv seam, and those on an open border
+	 * or non-manifold edge
+	 */
+	std::vector<char> findLocked(const Mesh &mesh){
+		const std::vector<Vertex> &verts = mesh.vertices;
+		std::vector<char> locked(verts.size(), 0);
+		std::vector<GLuint> order(verts.size());
+		for (size_t i = 0; i < order.size(); ++i){
+			order[i] = i;
+		}
+		std::sort(order.begin(), order.end(), [&verts](GLuint a, GLuint b){
+			return lessPos(verts[a].pos, verts[b].pos);
+		});
+		for (size_t i = 1; i < order.size(); ++i){
+			if (verts[order[i]].pos == verts[order[i - 1]].pos){
+				locked[order[i]] = 1;
+				locked[order[i - 1]] = 1;
+			}
+		}
+		//Interior edges are shared by exactly two triangles
+		std::vector<uint64_t> edges;
+		edges.reserve(mesh.indices.size());
+		for (size_t t = 0; t + 2 < mesh.indices.size(); t += 3){
+			for (size_t j = 0; j < 3; ++j){
+				uint64_t a = mesh.indices[t + j], b = mesh.indices[t + (j + 1) % 3];
+				edges.push_back(a < b ? (a << 32) | b : (b << 32) | a);
+			}
+		}
+		std::sort(edges.begin(), edges.end());
+		for (size_t i = 0; i < edges.size();){
+			size_t j = i;
+			while (j < edges.size() && edges[j] == edges[i]){
+				++j;
+			}
+			if (j - i != 2){
+				locked[edges[i] >> 32] = 1;
+				locked[edges[i] & 0xFFFFFFFF] = 1;
+			}
+			i = j;
+		}
+		return locked;
+	}
+	glm::vec3 triNormal(const glm::vec3 &a, const glm::vec3 &b, const glm::vec3 &c){
+		return glm::cross(b - a, c - a);
+	}
+}
+
+void simplify::buildLods(Mesh &mesh, size_t maxLods){
+	mesh.lods.clear();
+	Lod full = { 0, static_cast<GLuint>(mesh.indices.size()), 0.f };
+	mesh.lods.push_back(full);
+	const size_t nTris = mesh.indices.size() / 3;
+	if (maxLods < 2 || nTris * LOD_REDUCTION < MIN_LOD_TRIS){
+		return;
+	}
+	const std::vector<Vertex> &verts = mesh.vertices;
+	const std::vector<char> locked = findLocked(mesh);
+
+	//Working copy of the triangles that we collapse edges in, along with
+	//the triangles using each vertex
+	std::vector<GLuint> tris(mesh.indices.begin(), mesh.indices.begin() + nTris * 3);
+	std::vector<char> triDead(nTris, 0);
+	std::vector<std::vector<GLuint>> vertTris(verts.size());
+	std::vector<Quadric> quadrics(verts.size());
+	size_t live = 0;
+	for (size_t t = 0; t < nTris; ++t){
+		GLuint a = tris[t * 3], b = tris[t * 3 + 1], c = tris[t * 3 + 2];
+		if (a == b || b == c || a == c){
+			triDead[t] = 1;
+			continue;
+		}
+		++live;
+		for (size_t j = 0; j < 3; ++j){
+			vertTris[tris[t * 3 + j]].push_back(t);
+		}
+		glm::vec3 n = triNormal(verts[a].pos, verts[b].pos, verts[c].pos);
+		float len = glm::length(n);
+		if (len > 0.f){
+			n /= len;
+			Quadric plane(n.x, n.y, n.z, -glm::dot(n, verts[a].pos));
+			quadrics[a] += plane;
+			quadrics[b] += plane;
+			quadrics[c] += plane;
+		}
+	}
+
+	std::vector<unsigned> version(verts.size(), 0);
+	std::vector<char> removed(verts.size(), 0);
+	CollapseQueue queue;
+	//Queue the cheaper direction of collapsing the edge between a and b
+	auto queueEdge = [&](GLuint a, GLuint b){
+		Quadric q = quadrics[a];
+		q += quadrics[b];
+		Collapse c = { 0.0, a, b, version[a], version[b] };
+		double toB = locked[a] ? -1.0 : std::max(q.eval(verts[b].pos), 0.0);
+		double toA = locked[b] ? -1.0 : std::max(q.eval(verts[a].pos), 0.0);
+		if (toB < 0.0 && toA < 0.0){
+			return;
+		}
+		if (toB >= 0.0 && (toA < 0.0 || toB <= toA)){
+			c.cost = toB;
+		}
+		else {
+			c.cost = toA;
+			std::swap(c.from, c.to);
+			std::swap(c.fromVersion, c.toVersion);
+		}
+		queue.push(c);
+	};
+	for (size_t t = 0; t < nTris; ++t){
+		if (triDead[t]){
+			continue;
+		}
+		for (size_t j = 0; j < 3; ++j){
+			GLuint a = tris[t * 3 + j], b = tris[t * 3 + (j + 1) % 3];
+			//Each interior edge is seen once in each direction
+			if (a < b){
+				queueEdge(a, b);
+			}
+		}
+	}
+
+	double maxCost = 0.0;
+	size_t prevTris = live;
+	size_t target = static_cast<size_t>(live * LOD_REDUCTION);
+	//Record the live triangles as the next level of detail
+	auto addLod = [&](){
+		Lod lod = { static_cast<GLuint>(mesh.indices.size()), 0,
+			static_cast<float>(std::sqrt(maxCost)) };
+		for (size_t t = 0; t < nTris; ++t){
+			if (!triDead[t]){
+				mesh.indices.insert(mesh.indices.end(), tris.begin() + t * 3,
+					tris.begin() + t * 3 + 3);
+			}
+		}
+		lod.count = mesh.indices.size() - lod.first;
+		mesh.lods.push_back(lod);
+		prevTris = live;
+		target = static_cast<size_t>(live * LOD_REDUCTION);
+	};
+	while (!queue.empty() && mesh.lods.size() < maxLods && target >= MIN_LOD_TRIS){
+		Collapse c = queue.top();
+		queue.pop();
+		if (removed[c.from] || removed[c.to] || version[c.from] != c.fromVersion
+			|| version[c.to] != c.toVersion)
+		{
+			continue;
+		}
+		//Don't collapse if it would flip any of the triangles being moved
+		const glm::vec3 &dest = verts[c.to].pos;
+		bool flips = false;
+		for (GLuint t : vertTris[c.from]){
+			GLuint *tri = &tris[t * 3];
+			if (triDead[t] || tri[0] == c.to || tri[1] == c.to || tri[2] == c.to){
+				continue;
+			}
+			glm::vec3 p[3];
+			for (size_t j = 0; j < 3; ++j){
+				p[j] = verts[tri[j]].pos;
+			}
+			glm::vec3 before = triNormal(p[0], p[1], p[2]);
+			for (size_t j = 0; j < 3; ++j){
+				if (tri[j] == c.from){
+					p[j] = dest;
+				}
+			}
+			if (glm::dot(before, triNormal(p[0], p[1], p[2])) <= 0.f){
+				flips = true;
+				break;
+			}
+		}
+		if (flips){
+			continue;
+		}
+		std::vector<GLuint> &toTris = vertTris[c.to];
+		for (GLuint t : vertTris[c.from]){
+			GLuint *tri = &tris[t * 3];
+			if (triDead[t]){
+				continue;
+			}
+			if (tri[0] == c.to || tri[1] == c.to || tri[2] == c.to){
+				triDead[t] = 1;
+				--live;
+				continue;
+			}
+			for (size_t j = 0; j < 3; ++j){
+				if (tri[j] == c.from){
+					tri[j] = c.to;
+				}
+			}
+			toTris.push_back(t);
+		}
+		toTris.erase(std::remove_if(toTris.begin(), toTris.end(),
+			[&triDead](GLuint t){ return triDead[t] != 0; }), toTris.end());
+		vertTris[c.from].clear();
+		removed[c.from] = 1;
+		quadrics[c.to] += quadrics[c.from];
+		++version[c.to];
+		maxCost = std::max(maxCost, c.cost);
+		//The cost of every edge around the vertex we collapsed onto has changed
+		for (GLuint t : toTris){
+			for (size_t j = 0; j < 3; ++j){
+				if (tris[t * 3 + j] != c.to){
+					queueEdge(c.to, tris[t * 3 + j]);
+				}
+			}
+		}
+		if (live <= target){
+			addLod();
+		}
+	}
+	//Keep what we got to if we ran out of edges we could collapse part way
+	//through a level, as long as it's a worthwhile reduction
+	if (mesh.lods.size() < maxLods && live > 0 && live < prevTris * MIN_REDUCTION){
+		addLod();
+	}
+}
@@ -0,0 +1,187 @@
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include <GL/glew.h>
+#include <glm/glm.hpp>
+#include "transforms.h"
+
+namespace {
+	/*
+	 * The transforms in structure of arrays form so composing runs over
+	 * contiguous floats. The rotation is a column major 3x3 matrix with
+	 * element (column c, row r) stored in rot[c * 3 + r]
+	 */
+	struct Store {
+		std::vector<float> pos[3], scale[3], rot[9];
+		std::vector<glm::mat4> matrices;
+		std::vector<char> dirty;
+		std::vector<transforms::Handle> dirtyList, freeList, updated;
+		//Range of matrices composed since the last upload, empty if first > last
+		size_t uploadFirst, uploadLast;
+		//The buffer and its buffer texture and the matrices the buffer can hold
+		GLuint buffer, texture;
+		size_t capacity;
+
+		Store() : uploadFirst(1), uploadLast(0), buffer(0), texture(0), capacity(0){}
+	};
+	Store store;
+
+	void markDirty(transforms::Handle h){
+		if (!store.dirty[h]){
+			store.dirty[h] = 1;
+			store.dirtyList.push_back(h);
+		}
+	}
+	/*
+	 * Compose the matrices of the transforms [first, last), without branches
+	 * or indirection so the compiler can vectorize across transforms
+	 */
+	void composeRange(size_t first, size_t last){
+		float *out = &store.matrices[0][0][0];
+		for (size_t i = first; i < last; ++i){
+			float *m = out + i * 16;
+			for (size_t c = 0; c < 3; ++c){
+				const float s = store.scale[c][i];
+				m[c * 4] = store.rot[c * 3][i] * s;
+				m[c * 4 + 1] = store.rot[c * 3 + 1][i] * s;
+				m[c * 4 + 2] = store.rot[c * 3 + 2][i] * s;
+				m[c * 4 + 3] = 0.f;
+			}
+			m[12] = store.pos[0][i];
+			m[13] = store.pos[1][i];
+			m[14] = store.pos[2][i];
+			m[15] = 1.f;
+		}
+	}
+}
+
+transforms::Handle transforms::create(){
+	Handle h;
+	if (!store.freeList.empty()){
+		h = store.freeList.back();
+		store.freeList.pop_back();
+	}
+	else {
+		h = store.matrices.size();
+		for (size_t i = 0; i < 3; ++i){
+			store.pos[i].push_back(0.f);
+			store.scale[i].push_back(0.f);
+		}
+		for (size_t i = 0; i < 9; ++i){
+			store.rot[i].push_back(0.f);
+		}
+		store.matrices.push_back(glm::mat4());
+		store.dirty.push_back(0);
+	}
+	for (size_t i = 0; i < 3; ++i){
+		store.pos[i][h] = 0.f;
+		store.scale[i][h] = 1.f;
+	}
+	for (size_t i = 0; i < 9; ++i){
+		store.rot[i][h] = i % 4 == 0 ? 1.f : 0.f;
+	}
+	markDirty(h);
+	return h;
+}
+void transforms::destroy(Handle h){
+	store.freeList.push_back(h);
+}
+void transforms::translate(Handle h, const glm::vec3 &vec){
+	for (size_t i = 0; i < 3; ++i){
+		store.pos[i][h] += vec[i];
+	}
+	markDirty(h);
+}
+void transforms::rotate(Handle h, const glm::mat4 &rot){
+	//Rotations are applied after the existing rotation, so R = rot * R
+	float r[9];
+	for (size_t c = 0; c < 3; ++c){
+		for (size_t row = 0; row < 3; ++row){
+			r[c * 3 + row] = rot[0][row] * store.rot[c * 3][h]
+				+ rot[1][row] * store.rot[c * 3 + 1][h]
+				+ rot[2][row] * store.rot[c * 3 + 2][h];
+		}
+	}
+	for (size_t i = 0; i < 9; ++i){
+		store.rot[i][h] = r[i];
+	}
+	markDirty(h);
+}
+void transforms::scale(Handle h, const glm::vec3 &scale){
+	for (size_t i = 0; i < 3; ++i){
+		store.scale[i][h] *= scale[i];
+	}
+	markDirty(h);
+}
+const glm::mat4& transforms::matrix(Handle h){
+	return store.matrices[h];
+}
+const std::vector<transforms::Handle>& transforms::updated(){
+	return store.updated;
+}
+size_t transforms::update(){
+	const size_t count = store.dirtyList.size();
+	store.updated.clear();
+	if (count == 0){
+		return 0;
+	}
+	size_t first = *std::min_element(store.dirtyList.begin(), store.dirtyList.end());
+	size_t last = *std::max_element(store.dirtyList.begin(), store.dirtyList.end()) + 1;
+	//If most of the range changed it's cheaper to compose all of it in one
+	//vectorizable pass than to go through the dirty list
+	if (count * 2 >= last - first){
+		composeRange(first, last);
+	}
+	else {
+		for (Handle h : store.dirtyList){
+			composeRange(h, h + 1);
+		}
+	}
+	for (Handle h : store.dirtyList){
+		store.dirty[h] = 0;
+	}
+	store.updated.swap(store.dirtyList);
+	store.dirtyList.clear();
+	if (store.uploadFirst > store.uploadLast){
+		store.uploadFirst = first;
+		store.uploadLast = last;
+	}
+	else {
+		store.uploadFirst = std::min(store.uploadFirst, first);
+		store.uploadLast = std::max(store.uploadLast, last);
+	}
+	return count;
+}
+void transforms::upload(){
+	if (!store.buffer){
+		glGenBuffers(1, &store.buffer);
+		glGenTextures(1, &store.texture);
+	}
+	glBindBuffer(GL_TEXTURE_BUFFER, store.buffer);
+	//Grow the buffer if needed, in which case everything has to be sent
+	if (store.capacity < store.matrices.size()){
+		store.capacity = std::max(store.matrices.size(), store.capacity * 2);
+		glBufferData(GL_TEXTURE_BUFFER, store.capacity * sizeof(glm::mat4), NULL, GL_DYNAMIC_DRAW);
+		glActiveTexture(GL_TEXTURE0 + TEXTURE_UNIT);
+		glBindTexture(GL_TEXTURE_BUFFER, store.texture);
+		glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, store.buffer);
+		store.uploadFirst = 0;
+		store.uploadLast = store.matrices.size();
+	}
+	if (store.uploadFirst < store.uploadLast){
+		glBufferSubData(GL_TEXTURE_BUFFER, store.uploadFirst * sizeof(glm::mat4),
+			(store.uploadLast - store.uploadFirst) * sizeof(glm::mat4),
+			&store.matrices[store.uploadFirst]);
+		store.uploadFirst = 1;
+		store.uploadLast = 0;
+	}
+	glActiveTexture(GL_TEXTURE0 + TEXTURE_UNIT);
+	glBindTexture(GL_TEXTURE_BUFFER, store.texture);
+}
+void transforms::shutdown(){
+	glDeleteBuffers(1, &store.buffer);
+	glDeleteTextures(1, &store.texture);
+	store.buffer = 0;
+	store.texture = 0;
+	store.capacity = 0;
+}
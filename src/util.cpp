@@ -1,6 +1,6 @@
 #include <vector>
-#include <array>
-#include <map>
+#include <cstddef>
+#include <cstring>
 #include <iostream>
 #include <iomanip>
 #include <fstream>
@@ -14,6 +14,7 @@
 #include <SDL.h>
 #endif
 
+#include "meshcache.h"
 #include "util.h"
 
 std::string util::readFile(const std::string &fName){
@@ -25,9 +26,18 @@ std::string util::readFile(const std::string &fName){
 	return std::string((std::istreambuf_iterator<char>(file)),
 		std::istreambuf_iterator<char>());
 }
-GLint util::loadShader(const std::string &file, GLenum type){
+GLint util::loadShader(const std::string &file, GLenum type, const std::string &defines){
 	GLuint shader = glCreateShader(type);
 	std::string src = readFile(file);
+	//The defines have to come after the #version line
+	if (!defines.empty()){
+		size_t pos = 0;
+		if (src.compare(0, 8, "#version") == 0){
+			pos = src.find('\n');
+			pos = pos == std::string::npos ? src.size() : pos + 1;
+		}
+		src.insert(pos, defines);
+	}
 	const char *csrc = src.c_str();
 	glShaderSource(shader, 1, &csrc, 0);
 	glCompileShader(shader);
@@ -58,9 +68,11 @@ GLint util::loadShader(const std::string &file, GLenum type){
 	}
 	return shader;
 }
-GLint util::loadProgram(const std::string &vertfname, const std::string &fragfname){
-	GLint vShader = loadShader(vertfname, GL_VERTEX_SHADER);
-	GLint fShader = loadShader(fragfname, GL_FRAGMENT_SHADER);
+GLint util::loadProgram(const std::string &vertfname, const std::string &fragfname,
+	const std::string &defines, bool retrievable)
+{
+	GLint vShader = loadShader(vertfname, GL_VERTEX_SHADER, defines);
+	GLint fShader = loadShader(fragfname, GL_FRAGMENT_SHADER, defines);
 	if (vShader == -1 || fShader == -1){
 		std::cerr << "Program creation failed, a required shader failed to compile\n";
 		return -1;
@@ -68,6 +80,9 @@ GLint util::loadProgram(const std::string &vertfname, const std::string &fragfna
 	GLuint program = glCreateProgram();
 	glAttachShader(program, vShader);
 	glAttachShader(program, fShader);
+	if (retrievable){
+		glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+	}
 	glLinkProgram(program);
 
 	GLint status;
@@ -132,6 +147,31 @@ GLuint util::loadTexture(const std::string &file){
 	SDL_FreeSurface(surf);
 	return tex;
 }
+bool util::saveScreenshot(const std::string &file, int width, int height){
+	std::vector<unsigned char> pixels(width * height * 3);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+	glReadBuffer(GL_BACK);
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	glReadPixels(0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, pixels.data());
+	glPixelStorei(GL_PACK_ALIGNMENT, 4);
+	SDL_Surface *surf = SDL_CreateRGBSurface(0, width, height, 24,
+		0x000000ff, 0x0000ff00, 0x00ff0000, 0);
+	if (!surf){
+		std::cerr << "Failed to create screenshot surface: " << SDL_GetError() << "\n";
+		return false;
+	}
+	//GL's rows start at the bottom, the surface's at the top
+	for (int y = 0; y < height; ++y){
+		std::memcpy(static_cast<unsigned char*>(surf->pixels) + y * surf->pitch,
+			&pixels[(height - 1 - y) * width * 3], width * 3);
+	}
+	const bool saved = SDL_SaveBMP(surf, file.c_str()) == 0;
+	if (!saved){
+		std::cerr << "Failed to save screenshot " << file << ": " << SDL_GetError() << "\n";
+	}
+	SDL_FreeSurface(surf);
+	return saved;
+}
 bool util::logGLError(const std::string &msg){
 	GLenum err = glGetError();
 	if (err != GL_NO_ERROR){
@@ -142,7 +182,7 @@ bool util::logGLError(const std::string &msg){
 	return false;
 }
 void util::glDebugCallback(GLenum src, GLenum type, GLuint id, GLenum severity,
-	GLsizei len, const GLchar *msg, GLvoid *user)
+	GLsizei len, const GLchar *msg, const GLvoid *user)
 {
 	//Print a time stamp for the message
 	float sec = SDL_GetTicks() / 1000.f;
@@ -200,98 +240,56 @@ void util::glDebugCallback(GLenum src, GLenum type, GLuint id, GLenum severity,
 	}
 	std::cout << ":\n\t" << msg << "\n";
 }
-bool util::loadOBJ(const std::string &fName, GLuint &vbo, GLuint &ebo, size_t &nElems){
-	std::ifstream file(fName);
-	if (!file.is_open()){
-		std::cout << "Failed to find obj file: " << fName << std::endl;
+bool util::loadOBJ(const std::string &fName, GeometryArena *&arena, GeometryArena::Handle &block,
+	MeshInfo &info, unsigned flags)
+{
+	meshcache::CachedMesh mesh;
+	if (!meshcache::load(fName, mesh, flags)){
 		return false;
 	}
+	info.layout = mesh.view.layout;
+	info.indexType = mesh.view.indexType();
+	info.subMeshes.assign(mesh.view.subMeshes, mesh.view.subMeshes + mesh.view.subMeshCount);
+	info.lods.assign(mesh.view.lods, mesh.view.lods + mesh.view.lodCount);
+	info.vertexCount = mesh.view.vertexCount;
+	info.boundsMin = mesh.view.boundsMin;
+	info.boundsMax = mesh.view.boundsMax;
+	info.sphereCenter = (info.boundsMin + info.boundsMax) / 2.f;
+	info.sphereRadius = glm::length(info.boundsMax - info.boundsMin) / 2.f;
+	std::cout << fName << ": " << vertexStride(info.layout) << " bytes/vertex (was "
+		<< vertexStride(VERTEX_FLOAT) << "), VBO " << info.vboBytes() << " bytes (was "
+		<< info.floatVboBytes() << ")\n";
 
-	//Temporary storage for the data we read in
-	std::vector<glm::vec3> tmpPos, tmpNorm;
-	std::vector<glm::vec2> tmpUv;
-	//A map to associate a unique vertex with its index
-	std::map<std::string, GLushort> vertexIndices;
-	//The final ordered packed vertices and indices
-	std::vector<glm::vec3> vertexData;
-	std::vector<GLushort> indices;
-
-	std::string line;
-	while (std::getline(file, line)){
-		if (line.empty()){
-			continue;
-		}
-		//Parse vertex info: positions, uv coords and normals
-		else if (line.at(0) == 'v'){
-			//positions
-			if (line.at(1) == ' '){
-				tmpPos.push_back(captureVec3(line));
-			}
-			else if (line.at(1) == 't'){
-				tmpUv.push_back(captureVec2(line));
-			}
-			else if (line.at(1) == 'n'){
-				tmpNorm.push_back(captureVec3(line));
-			}
-		}
-		//Parse faces
-		else if (line.at(0) == 'f'){
-			std::array<std::string, 3> face = captureFaces(line);
-			for (std::string &v : face){
-				auto fnd = vertexIndices.find(v);
-				//If we find the vertex already in the list re-use the index
-				//If not we create a new vertex and index
-				if (fnd != vertexIndices.end()){
-					indices.push_back(fnd->second);
-				}
-				else {
-					std::array<unsigned int, 3> vertex = captureVertex(v);
-					//Pack the position, normal and uv into the vertex data, note that obj data is
-					//1-indexed so we subtract 1
-					vertexData.push_back(tmpPos[vertex[0] - 1]);
-					vertexData.push_back(tmpNorm[vertex[2] - 1]);
-					vertexData.push_back(glm::vec3(tmpUv[vertex[1] - 1], 0));
-					//Store the new index, also subract 1 b/c size 1 => idx 0
-					//and divide by 3 b/c there are 3 components per vertex
-					indices.push_back((vertexData.size() - 1) / 3);
-					vertexIndices[v] = indices.back();
-				}
-			}
-		}
-	}
-	nElems = indices.size();
-	glBindBuffer(GL_ARRAY_BUFFER, vbo);
-	glBufferData(GL_ARRAY_BUFFER, vertexData.size() * sizeof(glm::vec3), &vertexData[0], GL_STATIC_DRAW);
-
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLushort), &indices[0], GL_STATIC_DRAW);
-
-	return true;
+	arena = &geometry::arena(info.layout, info.indexType);
+	block = arena->allocate(mesh.view.vertices, mesh.view.vertexCount, mesh.view.indices,
+		mesh.view.indexCount);
+	return block != GeometryArena::INVALID;
 }
-glm::vec2 util::captureVec2(const std::string &str){
-	glm::vec2 vec;
-	sscanf(str.c_str(), "%*s %f %f", &vec.x, &vec.y);
-	return vec;
-}
-glm::vec3 util::captureVec3(const std::string &str){
-	glm::vec3 vec;
-	sscanf(str.c_str(), "%*s %f %f %f", &vec.x, &vec.y, &vec.z);
-	return vec;
-}
-std::array<std::string, 3> util::captureFaces(const std::string &str){
-	std::array<std::string, 3> faces;
-	//There's face information between each space in the string, and 3 faces total
-	size_t prev = str.find(" ", 0);
-	size_t next = prev;
-	for (std::string &face : faces){
-		next = str.find(" ", prev + 1);
-		face = str.substr(prev + 1, next - prev - 1);
-		prev = next;
+void util::setupVertexAttribs(VertexLayout layout){
+	const GLsizei stride = vertexStride(layout);
+	glEnableVertexAttribArray(0);
+	glEnableVertexAttribArray(1);
+	glEnableVertexAttribArray(2);
+	switch (layout){
+	case VERTEX_PACKED_FLOAT_POS:
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride,
+			(void*)offsetof(PackedVertexFloatPos, pos));
+		glVertexAttribPointer(1, 4, GL_INT_2_10_10_10_REV, GL_TRUE, stride,
+			(void*)offsetof(PackedVertexFloatPos, normal));
+		glVertexAttribPointer(2, 2, GL_HALF_FLOAT, GL_FALSE, stride,
+			(void*)offsetof(PackedVertexFloatPos, uv));
+		break;
+	case VERTEX_PACKED_HALF_POS:
+		glVertexAttribPointer(0, 3, GL_HALF_FLOAT, GL_FALSE, stride,
+			(void*)offsetof(PackedVertexHalfPos, pos));
+		glVertexAttribPointer(1, 4, GL_INT_2_10_10_10_REV, GL_TRUE, stride,
+			(void*)offsetof(PackedVertexHalfPos, normal));
+		glVertexAttribPointer(2, 2, GL_HALF_FLOAT, GL_FALSE, stride,
+			(void*)offsetof(PackedVertexHalfPos, uv));
+		break;
+	default:
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, (void*)offsetof(Vertex, pos));
+		glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, stride, (void*)offsetof(Vertex, normal));
+		glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, stride, (void*)offsetof(Vertex, uv));
 	}
-	return faces;
-}
-std::array<unsigned int, 3> util::captureVertex(const std::string &str){
-	std::array<unsigned int, 3> vertex;
-	sscanf(str.c_str(), "%u/%u/%u", &vertex[0], &vertex[1], &vertex[2]);
-	return vertex;
 }